@@ -105,6 +105,7 @@ libMesa_SRC_FILES := \
     src/mesa/program/prog_parameter.cpp \
     src/mesa/program/symbol_table.c \
     src/pixelflinger2/buffer.cpp \
+    src/pixelflinger2/deferred.cpp \
     src/pixelflinger2/format.cpp \
     src/pixelflinger2/llvm_scanline.cpp \
     src/pixelflinger2/llvm_texture.cpp \
@@ -113,6 +114,8 @@ libMesa_SRC_FILES := \
     src/pixelflinger2/scanline.cpp \
     src/pixelflinger2/shader.cpp \
     src/pixelflinger2/texture.cpp \
+    src/pixelflinger2/tile.cpp \
+    src/pixelflinger2/trace.cpp \
     src/talloc/hieralloc.c
 
 libMesa_C_INCLUDES := \
@@ -209,6 +212,42 @@ LOCAL_STATIC_LIBRARIES := libMesa
 
 include $(BUILD_HOST_EXECUTABLE)
 
+# pf2_replay for host
+# ========================================================
+include $(CLEAR_VARS)
+
+LOCAL_MODULE_TAGS := optional
+
+ifeq ($(DEBUG_BUILD),true)
+LOCAL_CFLAGS += -DDEBUG -UNDEBUG -O0 -g
+endif
+
+LOCAL_MODULE := pf2_replay
+LOCAL_MODULE_CLASS := EXECUTABLES
+LOCAL_SRC_FILES := src/pixelflinger2/pf2_replay.cpp
+LOCAL_C_INCLUDES := $(libMesa_C_INCLUDES)
+LOCAL_STATIC_LIBRARIES := libMesa
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# pf2_bench for host
+# ========================================================
+include $(CLEAR_VARS)
+
+LOCAL_MODULE_TAGS := optional
+
+ifeq ($(DEBUG_BUILD),true)
+LOCAL_CFLAGS += -DDEBUG -UNDEBUG -O0 -g
+endif
+
+LOCAL_MODULE := pf2_bench
+LOCAL_MODULE_CLASS := EXECUTABLES
+LOCAL_SRC_FILES := src/pixelflinger2/pf2_bench.cpp
+LOCAL_C_INCLUDES := $(libMesa_C_INCLUDES)
+LOCAL_STATIC_LIBRARIES := libMesa
+
+include $(BUILD_HOST_EXECUTABLE)
+
 # Build children
 # ========================================================
 include $(call all-makefiles-under,$(LOCAL_PATH))
@@ -38,7 +38,9 @@
 
 #define GGL_FS_OUTPUT_OFFSET            (GGL_FS_INPUT_OFFSET + GGL_FS_INPUT_FRONTFACINGPOINTCOORD_INDEX + 1)
 #define GGL_FS_OUTPUT_FRAGCOLOR_INDEX   0
+#define GGL_FS_OUTPUT_DISCARD_INDEX     0 // vector4 index in VertexOut, x set to 1 by discard; pointSize is not a fs input
 
 #define GGL_MAX_VIEWPORT_DIMS           4096
+#define GGL_MAXTEXTURELEVELS            13 /* mipmap levels of a 4096 texture */
 
 #endif // _PIXELFLINGER2_CONSTANTS_H_
@@ -60,6 +60,9 @@ enum GGLPixelFormat {
     // reserved range. don't use.
     GGL_PIXEL_FORMAT_RESERVED_20 = 0x20,
     GGL_PIXEL_FORMAT_RESERVED_21 = 0x21,
+
+    // compressed formats
+    GGL_PIXEL_FORMAT_ETC1       = 0x22,  // 64-bit ETC1 RGB blocks of 4x4 texels
     
     
     // must be last
@@ -51,14 +51,14 @@ typedef struct GGLSurface {
    unsigned width, height;
    enum GGLPixelFormat format;
    void * data;
-   unsigned stride, version;
+   unsigned stride, version; // stride is pixels between rows, 0 means width
 } GGLSurface_t;
 
 typedef struct GGLTexture {
    unsigned type; // GL_TEXTURE_2D, or GL_TEXTURE_CUBE_MAP
 
-   // currently only support RGBA_8888, RGBX_8888 and RGB_565
-   // storage uses either int or short
+   // currently only support RGBA_8888, RGBX_8888, RGB_565, RGBA_4444, RGBA_5551, A_8, L_8, LA_88 and ETC1
+   // storage uses either int, short or byte; ETC1 uses 8 bytes per 4x4 block, always in GGL_TILED_LAYOUT order
    enum GGLPixelFormat format; // affects vs/fs jit
 
    unsigned width, height; // base level dimension
@@ -77,12 +77,30 @@ typedef struct GGLTexture {
 2, wrapT :
    2;
 
+   // mipmap filters choose levels by the derivatives of 2x2 quad shaded fragments;
+   //  elsewhere, and for cube maps, level 0 is sampled with magFilter
    enum GGLTextureMinFilter {
-      GGL_NEAREST = 0, GGL_LINEAR, /*GGL_NEAREST_MIPMAP_NEAREST = 2,
-      GGL_LINEAR_MIPMAP_NEAREST, GGL_NEAREST_MIPMAP_LINEAR, GGL_LINEAR_MIPMAP_LINEAR = 5*/
+      GGL_NEAREST = 0, GGL_LINEAR, GGL_NEAREST_MIPMAP_NEAREST = 2,
+      GGL_LINEAR_MIPMAP_NEAREST, GGL_NEAREST_MIPMAP_LINEAR, GGL_LINEAR_MIPMAP_LINEAR = 5
 } minFilter :
-1, magFilter :
-   1; // only GGL_NEAREST and GGL_LINEAR
+   3;
+   // GGL_NEAREST or GGL_LINEAR; a 1 bit enum bitfield can't hold the mipmap filters
+unsigned magFilter :
+   1;
+
+   // storage of each level and face, chosen at upload; see GGLTextureStore
+   enum GGLTextureLayout {
+      GGL_LINEAR_LAYOUT = 0, // rows of width texels
+      // 4x4 texel tiles, each one 64 byte cache line for 32bpp, in rows of (width + 3) / 4 tiles;
+      // texel x, y is at ((y / 4) * (width + 3) / 4 + x / 4) * 16 + (y % 4) * 4 + x % 4
+      GGL_TILED_LAYOUT = 1
+} layout :
+   1;
+
+   // width and height stay the same while the texture is set, like atlases; power-of-2 sizes
+   //  are then jitted as constants, and changing them recompiles
+unsigned constantSize :
+   1;
 } GGLTexture_t;
 
 typedef struct GGLStencilState {
@@ -148,6 +166,11 @@ typedef struct GGLTextureState {
    void * textureData[GGL_MAXCOMBINEDTEXTUREIMAGEUNITS];
    // array of texture dimensions synced to textures; by LLVM generated texture sampler
    unsigned textureDimensions[GGL_MAXCOMBINEDTEXTUREIMAGEUNITS * 2];
+   // texel offset of each level from textureData, and highest level of mipmap filtered samplers
+   unsigned textureLevels[GGL_MAXCOMBINEDTEXTUREIMAGEUNITS * GGL_MAXTEXTURELEVELS];
+   unsigned textureMaxLevel[GGL_MAXCOMBINEDTEXTUREIMAGEUNITS];
+   // log2 of textureDimensions when both are powers of 2, used to address with shifts
+   unsigned textureShifts[GGL_MAXCOMBINEDTEXTUREIMAGEUNITS * 2];
 } GGLTextureState_t;
 
 typedef struct GGLState {
@@ -157,10 +180,28 @@ typedef struct GGLState {
 
    GGLBlendState_t blendState; // all affect scanline jit
 
+   GLboolean statistics; // scanline jit counts fragments, see EnableStatistics
+
    GGLTextureState_t textureState; // most affect vs/fs jit
 
 } GGLState_t;
 
+typedef struct GGLStatistics {
+   // DrawElements post-transform vertex cache; hit rate is hits / (hits + misses)
+   unsigned vertexCacheHits, vertexCacheMisses;
+
+   // rest are only counted while EnableStatistics is on
+   unsigned verticesShaded;
+   // triangles entering primitive setup; culled includes rejected and scissored triangles
+   // and clipped polygon fan triangles, clipped are those crossing near, far or guard band
+   unsigned trianglesSubmitted, trianglesCulled, trianglesClipped;
+   unsigned trapezoids, scanLines;
+   unsigned fragmentsShaded; // fragment shader invocations, including helper pixels of quads
+   unsigned fragmentsDiscarded, stencilFailed, depthFailed;
+   unsigned pixelsWritten;
+   unsigned shaderCompiles; // jit variants of vertex and fragment shaders compiled
+} GGLStatistics_t;
+
 // most functions are according to GL ES 2.0 spec and uses GLenum values
 // there is some error checking for invalid GLenum
 typedef struct GGLInterface GGLInterface_t;
@@ -179,6 +220,9 @@ struct GGLInterface {
    void (* BlendFuncSeparate)(GGLInterface_t * iface, GLenum srcRGB, GLenum dstRGB,
                               GLenum srcAlpha, GLenum dstAlpha);
    void (* EnableDisable)(GGLInterface_t * iface, GLenum cap, GLboolean enable);
+   // scissor box in frame surface pixels, same origin as Viewport; used when GL_SCISSOR_TEST
+   // is enabled by raster functions and Clear
+   void (* Scissor)(GGLInterface_t * iface, GLint x, GLint y, GLsizei width, GLsizei height);
 
    void (* DepthFunc)(GGLInterface_t * iface, GLenum func);
    void (* StencilFuncSeparate)(GGLInterface_t * iface, GLenum face, GLenum func,
@@ -191,11 +235,26 @@ struct GGLInterface {
    void (* ClearColor)(GGLInterface_t * iface, GLclampf r, GLclampf g, GLclampf b, GLclampf a);
    void (* ClearDepthf)(GGLInterface_t * iface, GLclampf d);
    void (* Clear)(const GGLInterface_t * iface, GLbitfield buf);
+   // when enabled, Clear only flags whole tiles, which are filled when first rastered or by
+   // Finish; surfaces must not be read before Finish. Disabled by default
+   void (* SetFastClear)(GGLInterface_t * iface, GLboolean enable);
+   // starts rendering of calls made so far without waiting for it; see CreateGGLDeferredInterface
+   void (* Flush)(const GGLInterface_t * iface);
+   // completes all rendering into the surfaces set by SetBuffer; call before reading them
+   void (* Finish)(const GGLInterface_t * iface);
 
    // shallow copy, surface data pointed to must be valid until texture is set to another texture
    // libAgl2 needs to check ret of ShaderUniform to detect assigning to sampler unit
    void (* SetSampler)(GGLInterface_t * iface, const unsigned sampler, GGLTexture_t * texture);
 
+   // aliases surface data as level 0 of a 2D texture without copying, so a surface rendered
+   // by a previous pass can be sampled; format must be RGBA_8888, RGBX_8888 or RGB_565 and
+   // stride must be 0 or width; wrap and filter are taken from parameters, NULL means
+   // GGL_CLAMP_TO_EDGE and GGL_LINEAR; if surface is the current color buffer, pending
+   // rendering is finished first; sampling a surface while drawing to it is undefined
+   void (* SetSamplerSurface)(GGLInterface_t * iface, const unsigned sampler,
+                              const GGLSurface_t * surface, const GGLTexture_t * parameters);
+
    // shallow copy, surface data must remain valid; use GL_COLOR_BUFFER_BIT,
    // GL_DEPTH_BUFFER_BIT, GL_STENCIL_BUFFER_BIT; format must be RGBA_8888, Z_32 or S_8
    void (* SetBuffer)(GGLInterface_t * iface, const GLenum type, GGLSurface_t * surface);
@@ -204,13 +263,22 @@ struct GGLInterface {
    // runs active vertex shader using currently set program; no error checking
    void (* ProcessVertex)(const GGLInterface_t * iface, const VertexInput_t * input,
                           VertexOutput_t * output);
-   // draws a triangle given 3 unprocessed vertices; should be moved into libAgl2
+   // draws a triangle given 3 unprocessed vertices; should be moved into libAgl2; this and
+   // RasterTriangle/Trapezoid leave tiles unshaded until a batch draw, Finish or state change
    void (* DrawTriangle)(const GGLInterface_t * iface, const VertexInput_t * v0,
                          const VertexInput_t * v1, const VertexInput_t * v2);
-   // rasters a vertex processed triangle using active program; scizors to frame surface
+   // draws count unprocessed vertices starting at first, mode is GL_TRIANGLES,
+   // GL_TRIANGLE_STRIP or GL_TRIANGLE_FAN; tiles are shaded once for the whole batch
+   void (* DrawArrays)(const GGLInterface_t * iface, GLenum mode, const VertexInput_t * vertices,
+                       GLint first, GLsizei count);
+   // same as DrawArrays, but vertices are indexed by count GL_UNSIGNED_BYTE,
+   // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT indices
+   void (* DrawElements)(const GGLInterface_t * iface, GLenum mode, const VertexInput_t * vertices,
+                         GLsizei count, GLenum type, const GLvoid * indices);
+   // rasters a vertex processed triangle using active program; scizors to frame surface and scissor box
    void (* RasterTriangle)(const GGLInterface_t * iface, const VertexOutput_t * v1,
                            const VertexOutput_t * v2, const VertexOutput_t * v3);
-   // rasters a vertex processed trapezoid using active program; scizors to frame surface
+   // rasters a vertex processed trapezoid using active program; scizors to frame surface and scissor box
    void (* RasterTrapezoid)(const GGLInterface_t * iface, const VertexOutput_t * tl,
                             const VertexOutput_t * tr, const VertexOutput_t * bl,
                             const VertexOutput_t * br);
@@ -219,6 +287,16 @@ struct GGLInterface {
    void (* ScanLine)(const GGLInterface_t * iface, const VertexOutput_t * v1,
                      const VertexOutput_t * v2);
 
+   // number of threads shading screen tiles, including the calling thread; 0 uses one per cpu,
+   // 1 rasters on the calling thread without binning
+   void (* SetRasterThreads)(GGLInterface_t * iface, unsigned count);
+
+   // retrieves counters accumulated since context creation or last ResetStatistics
+   void (* GetStatistics)(const GGLInterface_t * iface, GGLStatistics_t * stats);
+   void (* ResetStatistics)(GGLInterface_t * iface);
+   // counters other than the vertex cache are off by default; toggling recompiles scanlines
+   void (* EnableStatistics)(GGLInterface_t * iface, GLboolean enable);
+
    // creates empty shader
    gl_shader_t * (* ShaderCreate)(const GGLInterface_t * iface, GLenum type);
 
@@ -296,6 +374,48 @@ extern "C"
 
    void DestroyGGLInterface(GGLInterface_t * interface);
 
+   // wraps interface, recording calls to a binary trace file before forwarding them;
+   //  shader functions without interface are recorded to the most recently created trace;
+   //  returns NULL if file can't be created
+   GGLInterface_t * CreateGGLTraceInterface(GGLInterface_t * interface, const char * fileName);
+
+   // closes trace file, does not destroy the wrapped interface; returns 0 if writing failed,
+   //  leaving the trace incomplete
+   int DestroyGGLTraceInterface(GGLInterface_t * trace);
+
+   // wraps interface, recording state changes and draws into command buffers executed by a
+   //  render thread; Flush submits recorded commands, Finish also waits for them; calls
+   //  returning results wait for the render thread first; shader functions without interface
+   //  use the most recently created deferred interface; returns NULL if the render thread
+   //  can't be started
+   GGLInterface_t * CreateGGLDeferredInterface(GGLInterface_t * interface);
+
+   // executes remaining commands, does not destroy the wrapped interface
+   void DestroyGGLDeferredInterface(GGLInterface_t * deferred);
+
+   typedef struct GGLTraceReplay GGLTraceReplay_t;
+
+   // returns NULL if file can't be opened or was recorded with different struct layouts
+   GGLTraceReplay_t * GGLTraceReplayOpen(GGLInterface_t * interface, const char * fileName);
+
+   // replays calls up to and including next Finish, returns 0 at end of trace, or where it is
+   //  truncated or corrupt, without making the call being read
+   int GGLTraceReplayFrame(GGLTraceReplay_t * replay);
+
+   // frees replay buffers; shaders and programs are left to interface
+   void GGLTraceReplayClose(GGLTraceReplay_t * replay);
+
+   // bytes of texture data for all levels and faces in texture->layout
+   unsigned GGLTextureDataSize(const GGLTexture_t * texture);
+
+   // copies tightly packed rows of pixels into level of face of texture->levels,
+   //  converting to texture->layout; face is 0 for GL_TEXTURE_2D; ETC1 pixels are rows of blocks
+   void GGLTextureStore(const GGLTexture_t * texture, const unsigned level, const unsigned face,
+                        const void * pixels);
+
+   // box filters levels 1 to levelCount - 1 of each face from level 0; not for ETC1
+   void GGLTextureGenerateMipmaps(const GGLTexture_t * texture);
+
    // creates empty shader
    gl_shader_t * GGLShaderCreate(GLenum type);
 
@@ -320,7 +440,8 @@ extern "C"
    void GGLShaderProgramDelete(gl_shader_program_t * program);
 
    // LLVM JIT and set as active program, also call after gglState change to re-JIT
-   void GGLShaderUse(void * llvmCtx, const GGLState_t * gglState, gl_shader_program_t * program);
+   // returns number of jit variants compiled
+   unsigned GGLShaderUse(void * llvmCtx, const GGLState_t * gglState, gl_shader_program_t * program);
 
    void GGLShaderGetiv(const gl_shader_t * shader, const GLenum pname, GLint * params);
 
@@ -353,11 +474,13 @@ extern "C"
                          VertexOutput_t * output, const float (*constants)[4]);
 
    // scan line given left and right processed and scizored vertices
-   // depth value bitcast float->int, if negative then ^= 0x7fffffff
-   void GGLScanLine(const gl_shader_program_t * program, const enum GGLPixelFormat colorFormat,
-                    void * frameBuffer, int * depthBuffer, unsigned char * stencilBuffer,
-                    unsigned bufferWidth, unsigned bufferHeight, GGLActiveStencil_t * activeStencil,
-                    const VertexOutput_t * start, const VertexOutput_t * end, const float (*constants)[4]);
+   // Z_32 depth value bitcast float->int, if negative then ^= 0x7fffffff;
+   // Z_16 and SZ_24 depth values are unsigned normalized, SZ_24 in the top 24 bits
+   // of the word whose low 8 bits are the SZ_8 stencil, so both surfaces share data
+   void GGLScanLine(const gl_shader_program_t * program, const GGLSurface_t * frameSurface,
+                    const GGLSurface_t * depthSurface, const GGLSurface_t * stencilSurface,
+                    GGLActiveStencil_t * activeStencil, const VertexOutput_t * start,
+                    const VertexOutput_t * end, const float (*constants)[4], GGLStatistics_t * stats);
 
 //   void GGLProcessFragment(const VertexOutput_t * inputs, VertexOutput_t * outputs,
 //                           const float (*constants[4]));
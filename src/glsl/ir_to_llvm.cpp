@@ -62,7 +62,9 @@ using namespace tr1;
 #include "ir.h"
 #include "ir_visitor.h"
 #include "glsl_types.h"
+#include "ir_optimization.h"
 #include "src/mesa/main/mtypes.h"
+#include <pixelflinger2/pixelflinger2_interface.h>
 
 // Helper function to convert array to llvm::ArrayRef
 template <typename T, size_t N>
@@ -78,8 +80,9 @@ static inline llvm::ArrayRef<T> pack(T const *ptr, size_t n) {
 
 struct GGLState;
 
+// derivatives are <dsdx, dtdx, dsdy, dtdy> for mipmap level selection, NULL if unknown
 llvm::Value * tex2D(llvm::IRBuilder<> & builder, llvm::Value * in1, const unsigned sampler,
-                     const GGLState * gglCtx);
+                     const GGLState * gglCtx, llvm::Value * derivatives = NULL);
 llvm::Value * texCube(llvm::IRBuilder<> & builder, llvm::Value * in1, const unsigned sampler,
                      const GGLState * gglCtx);
 
@@ -101,12 +104,13 @@ public:
    const char * shaderSuffix;
    llvm::Value * inputsPtr, * outputsPtr, * constantsPtr; // internal globals to store inputs/outputs/constants pointers
    llvm::Value * inputs, * outputs, * constants;
+   bool failed; // main computes some operation wrongly, like derivatives without neighbours
 
    ir_to_llvm_visitor(llvm::Module* p_mod, const GGLState * GGLCtx, const char * suffix)
    : ctx(p_mod->getContext()), mod(p_mod), fun(0), loop(std::make_pair((llvm::BasicBlock*)0,
       (llvm::BasicBlock*)0)), bb(0), bld(ctx), gglCtx(GGLCtx), shaderSuffix(suffix),
       inputsPtr(NULL), outputsPtr(NULL), constantsPtr(NULL),
-      inputs(NULL), outputs(NULL), constants(NULL)
+      inputs(NULL), outputs(NULL), constants(NULL), failed(false)
    {
       llvm::PointerType * const floatVecPtrType = llvm::PointerType::get(llvm::VectorType::get(bld.getFloatTy(),4), 0);
       llvm::Constant * const nullFloatVecPtr = llvm::Constant::getNullValue(floatVecPtrType);
@@ -589,12 +593,12 @@ public:
          assert(ir->operands[0]->type->base_type == GLSL_TYPE_FLOAT);
          return llvm_intrinsic_unop(ir->operation, ops[0]);
          // TODO: implement these somehow
-      case ir_unop_dFdx:
-         assert(0);
-         //return llvm_intrinsic(llvm::Intrinsic::ddx, ops[0]);
+      case ir_unop_dFdx: // fall through
       case ir_unop_dFdy:
-         assert(0);
-         //return llvm_intrinsic(llvm::Intrinsic::ddy, ops[0]);
+         // only shading in quads has neighbouring pixels, see ir_to_llvm_soa_generator;
+         // main still builds with derivatives of 0, used if the quad shader does not
+         failed = true;
+         return llvm::Constant::getNullValue(ops[0]->getType());
       case ir_binop_add:
          switch(ir->operands[0]->type->base_type)
          {
@@ -984,18 +988,15 @@ public:
 
       bld.SetInsertPoint(discard);
 
-      // FIXME: According to the LLVM mailing list, UnwindInst should not
-      // be used by the frontend since LLVM 3.0, and 'CreateUnwind'
-      // method has been removed from the IRBuilder.  Here's the
-      // temporary workaround.  But it would be better to remove
-      // this in the future.
-      //
-      // A solution after LLVM 3.0: To add a global boolean in the shader to
-      // store whether it was discarded or not and just continue on normally,
-      // and handle the discard outside the shader, in the scanline function.
-      // The discard instruction is not used frequently, so it should be okay
-      // performance wise.
-      //new llvm::UnwindInst(ctx, discard); /// Deprecated
+      // LLVM has no unwind from the frontend, so set the discard flag in the outputs and
+      // return; the scanline tests the flag before any depth, stencil or color write
+      llvm::Value * flag = bld.CreateConstGEP1_32(outputs, GGL_FS_OUTPUT_DISCARD_INDEX);
+      flag = bld.CreateBitCast(flag, llvm::PointerType::get(bld.getFloatTy(), 0));
+      bld.CreateStore(llvm::ConstantFP::get(bld.getFloatTy(), 1.0), flag);
+      if(fun->getReturnType()->isVoidTy())
+         bld.CreateRetVoid();
+      else
+         bld.CreateRet(llvm::UndefValue::get(fun->getReturnType()));
 
       bb = after;
       bld.SetInsertPoint(bb);
@@ -1391,13 +1392,693 @@ public:
    }
 };
 
+// Translates a shader into a function shading width vertices or fragments per call in
+// structure of arrays form: each component of a GLSL value is a <width x T> vector
+// holding that component for all invocations, so scalar code fills every SIMD lane.
+// For quad, the 4 lanes are the fragments (x, y), (x + 1, y), (x, y + 1), (x + 1, y + 1),
+// and dFdx/dFdy are differences between lanes.
+// Only straight line shaders are supported, ifs are lowered to conditional assignments;
+// anything else sets failed and the caller keeps using the per invocation main.
+class ir_to_llvm_soa_generator {
+public:
+   typedef std::vector<llvm::Value*> soa_value;
+   typedef std::map<ir_variable*, soa_value> soa_variables_t;
+
+   llvm::LLVMContext& ctx;
+   llvm::Module* mod;
+   llvm::IRBuilder<> bld;
+   const GGLState * gglCtx;
+   const unsigned width; // invocations per call
+   const bool quad; // width is 4 fragments of a 2x2 quad
+   const unsigned inputStride, outputStride; // in vec4, between consecutive invocations
+   llvm::Value * inputs, * outputs, * constants;
+   soa_variables_t variables; // temporaries and outputs, outputs are stored at the end
+   bool failed;
+
+   ir_to_llvm_soa_generator(llvm::Module* p_mod, const GGLState * GGLCtx, unsigned w, bool q,
+                            unsigned inStride, unsigned outStride)
+   : ctx(p_mod->getContext()), mod(p_mod), bld(ctx), gglCtx(GGLCtx), width(w), quad(q),
+      inputStride(inStride), outputStride(outStride),
+      inputs(NULL), outputs(NULL), constants(NULL), failed(false)
+   {
+   }
+
+   llvm::Type* scalar_type(unsigned base_type)
+   {
+      switch (base_type) {
+      case GLSL_TYPE_UINT:
+      case GLSL_TYPE_INT:
+         return bld.getInt32Ty();
+      case GLSL_TYPE_FLOAT:
+         return bld.getFloatTy();
+      case GLSL_TYPE_BOOL:
+         return bld.getInt1Ty();
+      default:
+         failed = true;
+         return bld.getFloatTy();
+      }
+   }
+
+   llvm::Type* lane_type(unsigned base_type)
+   {
+      return llvm::VectorType::get(scalar_type(base_type), width);
+   }
+
+   static const glsl_type * element_type(const glsl_type * type)
+   {
+      while (type->is_array())
+         type = type->fields.array;
+      return type;
+   }
+
+   // number of scalar components, matrices are column major
+   static unsigned components(const glsl_type * type)
+   {
+      if (type->is_array())
+         return type->length * components(type->fields.array);
+      return type->matrix_columns * type->vector_elements;
+   }
+
+   // number of vec4 slots used by in, out and uniform variables
+   static unsigned slots(const glsl_type * type)
+   {
+      if (type->is_array())
+         return type->length * slots(type->fields.array);
+      return type->matrix_columns;
+   }
+
+   llvm::Value* splat(llvm::Value * scalar)
+   {
+      llvm::Value * vec = llvm::UndefValue::get(llvm::VectorType::get(scalar->getType(), width));
+      for (unsigned i = 0; i < width; i++)
+         vec = bld.CreateInsertElement(vec, scalar, bld.getInt32(i), "soa.splat");
+      return vec;
+   }
+
+   llvm::Constant* splat_constant(llvm::Constant * scalar)
+   {
+      std::vector<llvm::Constant*> values(width, scalar);
+      return llvm::ConstantVector::get(values);
+   }
+
+   llvm::Constant* lane_imm(unsigned base_type, double v)
+   {
+      llvm::Type * type = scalar_type(base_type);
+      if (type->isFloatingPointTy())
+         return splat_constant(llvm::ConstantFP::get(type, v));
+      return splat_constant(llvm::ConstantInt::get(type, (uint64_t)(int64_t)v));
+   }
+
+   soa_value undef_value(const glsl_type * type)
+   {
+      llvm::Type * laneType = lane_type(element_type(type)->base_type);
+      return soa_value(components(type), llvm::UndefValue::get(laneType));
+   }
+
+   // calls a float libm function once per lane
+   llvm::Value* lane_call(const char * name, llvm::Value * a, llvm::Value * b = NULL)
+   {
+      llvm::Type * floatType = bld.getFloatTy();
+      llvm::Function * function = mod->getFunction(name);
+      if (!function) {
+         std::vector<llvm::Type*> args(b ? 2 : 1, floatType);
+         llvm::FunctionType* type = llvm::FunctionType::get(floatType,
+                                                            llvm::ArrayRef<llvm::Type*>(args),
+                                                            false);
+         function = llvm::Function::Create(type, llvm::Function::ExternalLinkage, name, mod);
+         function->setCallingConv(llvm::CallingConv::C);
+      }
+      llvm::Value * vec = llvm::UndefValue::get(a->getType());
+      for (unsigned i = 0; i < width; i++) {
+         llvm::Value * ea = bld.CreateExtractElement(a, bld.getInt32(i));
+         llvm::Value * r;
+         if (b)
+            r = bld.CreateCall2(function, ea, bld.CreateExtractElement(b, bld.getInt32(i)));
+         else
+            r = bld.CreateCall(function, ea);
+         vec = bld.CreateInsertElement(vec, r, bld.getInt32(i), name);
+      }
+      return vec;
+   }
+
+   llvm::Value* lane_shuffle(llvm::Value * v, unsigned a, unsigned b, unsigned c, unsigned d)
+   {
+      llvm::Constant* mask[4] = {bld.getInt32(a), bld.getInt32(b), bld.getInt32(c), bld.getInt32(d)};
+      return bld.CreateShuffleVector(v, llvm::UndefValue::get(v->getType()),
+                                     llvm::ConstantVector::get(pack(mask)));
+   }
+
+   // samples once per lane with the same code as ir_to_llvm_visitor
+   soa_value texture(ir_texture * ir)
+   {
+      ir_dereference_variable * deref = ir->sampler->as_dereference_variable();
+      if (!gglCtx || ir_tex != ir->op || !deref) {
+         failed = true;
+         return undef_value(ir->type);
+      }
+      ir_variable * sampler = deref->variable_referenced();
+      const unsigned dim = sampler->type->sampler_dimensionality;
+      if (GLSL_SAMPLER_DIM_CUBE != dim && GLSL_SAMPLER_DIM_2D != dim) {
+         failed = true;
+         return undef_value(ir->type);
+      }
+      soa_value coordinate = value(ir->coordinate);
+      if (ir->projector) {
+         llvm::Value * proj = value(ir->projector)[0];
+         for (unsigned i = 0; i < coordinate.size(); i++)
+            coordinate[i] = bld.CreateFDiv(coordinate[i], proj, "texProj");
+      }
+      if (failed)
+         return undef_value(ir->type);
+
+      // texcoord differences across the quad, the same for its 4 fragments
+      llvm::Value * derivatives = NULL;
+      if (quad && GLSL_SAMPLER_DIM_2D == dim) {
+         llvm::Value * s0 = bld.CreateExtractElement(coordinate[0], bld.getInt32(0));
+         llvm::Value * t0 = bld.CreateExtractElement(coordinate[1], bld.getInt32(0));
+         llvm::Value * d[4] = {
+            bld.CreateFSub(bld.CreateExtractElement(coordinate[0], bld.getInt32(1)), s0, "dsdx"),
+            bld.CreateFSub(bld.CreateExtractElement(coordinate[1], bld.getInt32(1)), t0, "dtdx"),
+            bld.CreateFSub(bld.CreateExtractElement(coordinate[0], bld.getInt32(2)), s0, "dsdy"),
+            bld.CreateFSub(bld.CreateExtractElement(coordinate[1], bld.getInt32(2)), t0, "dtdy")
+         };
+         derivatives = llvm::UndefValue::get(llvm::VectorType::get(bld.getFloatTy(), 4));
+         for (unsigned j = 0; j < 4; j++)
+            derivatives = bld.CreateInsertElement(derivatives, d[j], bld.getInt32(j));
+      }
+
+      llvm::Type * coordinateType = llvm::VectorType::get(bld.getFloatTy(), coordinate.size());
+      soa_value result(4, llvm::UndefValue::get(lane_type(GLSL_TYPE_FLOAT)));
+      for (unsigned i = 0; i < width; i++) {
+         llvm::Value * coord = llvm::UndefValue::get(coordinateType);
+         for (unsigned j = 0; j < coordinate.size(); j++)
+            coord = bld.CreateInsertElement(coord, bld.CreateExtractElement(coordinate[j], bld.getInt32(i)),
+                                            bld.getInt32(j));
+         llvm::Value * texel;
+         if (GLSL_SAMPLER_DIM_CUBE == dim)
+            texel = texCube(bld, coord, sampler->location, gglCtx);
+         else
+            texel = tex2D(bld, coord, sampler->location, gglCtx, derivatives);
+         for (unsigned j = 0; j < 4; j++)
+            result[j] = bld.CreateInsertElement(result[j], bld.CreateExtractElement(texel, bld.getInt32(j)),
+                                                bld.getInt32(i), "soa.texel");
+      }
+      return result;
+   }
+
+   // finds variable and first component and slot referenced by a constant dereference chain
+   bool resolve(ir_rvalue * ir, ir_variable *& var, unsigned & first, unsigned & slot)
+   {
+      if (ir_dereference_variable * deref = ir->as_dereference_variable()) {
+         var = deref->variable_referenced();
+         first = slot = 0;
+         return true;
+      }
+      ir_dereference_array * deref = ir->as_dereference_array();
+      if (!deref || !resolve(deref->array, var, first, slot))
+         return false;
+      ir_constant * index = deref->array_index->as_constant();
+      if (!index) // dynamic indexing could differ per vertex
+         return false;
+      const int i = index->value.i[0];
+      const glsl_type * type = deref->array->type;
+      if (type->is_array()) {
+         first += i * components(type->fields.array);
+         slot += i * slots(type->fields.array);
+      } else if (type->is_matrix()) {
+         first += i * type->vector_elements;
+         slot += i;
+      } else // vector indexing, constant indices are lowered to swizzles
+         return false;
+      return true;
+   }
+
+   soa_value & variable(ir_variable * var)
+   {
+      soa_variables_t::iterator vari = variables.find(var);
+      if (vari != variables.end())
+         return vari->second;
+      soa_value & value = variables[var];
+      if (var->constant_value)
+         value = constant(var->constant_value);
+      else if (ir_var_out == var->mode)
+         value = soa_value(components(var->type), NULL); // NULL for not written
+      else
+         value = undef_value(var->type);
+      return value;
+   }
+
+   // loads component of in or uniform variables, inputs differ per vertex
+   llvm::Value* load(ir_variable * var, unsigned slot, unsigned comp, unsigned base_type)
+   {
+      llvm::Type * type = GLSL_TYPE_BOOL == base_type ? bld.getInt32Ty() : scalar_type(base_type);
+      llvm::Value * vec = NULL;
+      for (unsigned i = 0; i < width; i++) {
+         llvm::Value * ptr;
+         if (ir_var_uniform == var->mode)
+            ptr = bld.CreateConstGEP1_32(constants, var->location + slot);
+         else
+            ptr = bld.CreateConstGEP1_32(inputs, i * inputStride + var->location + slot);
+         ptr = bld.CreateBitCast(ptr, llvm::PointerType::get(type, 0));
+         llvm::Value * v = bld.CreateLoad(bld.CreateConstGEP1_32(ptr, comp), var->name);
+         if (GLSL_TYPE_BOOL == base_type)
+            v = bld.CreateICmpNE(v, bld.getInt32(0));
+         if (ir_var_uniform == var->mode)
+            return splat(v);
+         if (!vec)
+            vec = llvm::UndefValue::get(llvm::VectorType::get(v->getType(), width));
+         vec = bld.CreateInsertElement(vec, v, bld.getInt32(i), "soa.input");
+      }
+      return vec;
+   }
+
+   soa_value dereference(ir_rvalue * ir)
+   {
+      ir_variable * var = NULL;
+      unsigned first = 0, slot = 0;
+      if (!resolve(ir, var, first, slot)) {
+         failed = true;
+         return undef_value(ir->type);
+      }
+      const unsigned count = components(ir->type);
+      const unsigned base_type = element_type(ir->type)->base_type;
+      soa_value value(count);
+      if (ir_var_in == var->mode || ir_var_uniform == var->mode) {
+         if (GLSL_TYPE_SAMPLER == base_type || var->location < 0) {
+            failed = true;
+            return undef_value(ir->type);
+         }
+         const unsigned rows = element_type(ir->type)->vector_elements;
+         for (unsigned i = 0; i < count; i++)
+            value[i] = load(var, slot + i / rows, i % rows, base_type);
+         return value;
+      }
+      soa_value & stored = variable(var);
+      for (unsigned i = 0; i < count; i++) {
+         value[i] = stored[first + i];
+         if (!value[i])
+            value[i] = llvm::UndefValue::get(lane_type(base_type));
+      }
+      return value;
+   }
+
+   soa_value constant(ir_constant * ir)
+   {
+      soa_value value;
+      if (ir->type->is_array()) {
+         for (unsigned i = 0; i < ir->type->length; i++) {
+            soa_value elem = constant(ir->array_elements[i]);
+            value.insert(value.end(), elem.begin(), elem.end());
+         }
+         return value;
+      }
+      if (GLSL_TYPE_STRUCT == ir->type->base_type) {
+         failed = true;
+         return value;
+      }
+      for (unsigned i = 0; i < components(ir->type); i++)
+         switch (ir->type->base_type) {
+         case GLSL_TYPE_FLOAT:
+            value.push_back(lane_imm(GLSL_TYPE_FLOAT, ir->value.f[i]));
+            break;
+         case GLSL_TYPE_UINT:
+            value.push_back(splat_constant(bld.getInt32(ir->value.u[i])));
+            break;
+         case GLSL_TYPE_INT:
+            value.push_back(splat_constant(bld.getInt32(ir->value.i[i])));
+            break;
+         case GLSL_TYPE_BOOL:
+            value.push_back(splat_constant(bld.getInt1(ir->value.b[i])));
+            break;
+         default:
+            failed = true;
+            value.push_back(llvm::UndefValue::get(lane_type(GLSL_TYPE_FLOAT)));
+         }
+      return value;
+   }
+
+   soa_value value(ir_rvalue * ir)
+   {
+      if (ir_constant * constant = ir->as_constant())
+         return this->constant(constant);
+      if (ir->as_dereference())
+         return dereference(ir);
+      if (ir_swizzle * swz = ir->as_swizzle()) {
+         soa_value val = value(swz->val);
+         const unsigned mask[4] = {swz->mask.x, swz->mask.y, swz->mask.z, swz->mask.w};
+         soa_value result(swz->mask.num_components);
+         for (unsigned i = 0; i < swz->mask.num_components; i++)
+            result[i] = val[mask[i]];
+         return result;
+      }
+      if (ir_expression * expr = ir->as_expression())
+         return expression(expr);
+      if (ir_type_texture == ir->ir_type)
+         return texture((ir_texture *)ir);
+      failed = true; // calls
+      return undef_value(ir->type);
+   }
+
+   llvm::Value* reduce(llvm::Value * sum, llvm::Value * v, bool add, unsigned base_type)
+   {
+      if (!sum)
+         return v;
+      if (!add)
+         return bld.CreateOr(sum, v);
+      if (GLSL_TYPE_FLOAT == base_type)
+         return bld.CreateFAdd(sum, v, "dot.add");
+      return bld.CreateAdd(sum, v, "dot.add");
+   }
+
+   // component wise operation, mirrors ir_to_llvm_visitor::llvm_expression
+   llvm::Value* component(ir_expression * ir, unsigned base_type, llvm::Value * a, llvm::Value * b)
+   {
+      const bool isFloat = GLSL_TYPE_FLOAT == base_type;
+      const bool isInt = GLSL_TYPE_INT == base_type;
+      switch (ir->operation) {
+      case ir_unop_bit_not:
+      case ir_unop_logic_not:
+         return bld.CreateNot(a);
+      case ir_unop_neg:
+         return isFloat ? bld.CreateFNeg(a) : bld.CreateNeg(a);
+      case ir_unop_abs:
+         if (isFloat)
+            return bld.CreateSelect(bld.CreateFCmpUGE(a, lane_imm(base_type, 0)), a, bld.CreateFNeg(a), "fabs.select");
+         if (isInt)
+            return bld.CreateSelect(bld.CreateICmpSGE(a, lane_imm(base_type, 0)), a, bld.CreateNeg(a), "sabs.select");
+         return a;
+      case ir_unop_sign:
+         if (isFloat)
+            return bld.CreateSelect(bld.CreateFCmpONE(a, lane_imm(base_type, 0)),
+                                    bld.CreateSelect(bld.CreateFCmpUGE(a, lane_imm(base_type, 0)),
+                                                     lane_imm(base_type, 1), lane_imm(base_type, -1)),
+                                    lane_imm(base_type, 0), "fsign");
+         if (isInt)
+            return bld.CreateSelect(bld.CreateICmpNE(a, lane_imm(base_type, 0)),
+                                    bld.CreateSelect(bld.CreateICmpSGE(a, lane_imm(base_type, 0)),
+                                                     lane_imm(base_type, 1), lane_imm(base_type, -1)),
+                                    lane_imm(base_type, 0), "ssign");
+         if (GLSL_TYPE_UINT == base_type)
+            return bld.CreateZExt(bld.CreateICmpNE(a, lane_imm(base_type, 0)), a->getType(), "usign");
+         return a;
+      case ir_unop_rcp:
+         return bld.CreateFDiv(lane_imm(base_type, 1), a);
+      case ir_unop_rsq:
+         return bld.CreateFDiv(lane_imm(base_type, 1), lane_call("sqrtf", a), "rsqrt.rcp");
+      case ir_unop_sqrt:
+         return lane_call("sqrtf", a);
+      case ir_unop_exp:
+         return lane_call("expf", a);
+      case ir_unop_log:
+         return lane_call("logf", a);
+      case ir_unop_exp2:
+         return lane_call("exp2f", a);
+      case ir_unop_log2:
+         return lane_call("log2f", a);
+      case ir_unop_sin:
+      case ir_unop_sin_reduced:
+         return lane_call("sinf", a);
+      case ir_unop_cos:
+      case ir_unop_cos_reduced:
+         return lane_call("cosf", a);
+      case ir_binop_pow:
+         return lane_call("powf", a, b);
+      case ir_unop_dFdx:
+         if (!quad)
+            break;
+         return bld.CreateFSub(lane_shuffle(a, 1, 1, 3, 3), lane_shuffle(a, 0, 0, 2, 2), "dFdx");
+      case ir_unop_dFdy:
+         if (!quad)
+            break;
+         return bld.CreateFSub(lane_shuffle(a, 2, 3, 2, 3), lane_shuffle(a, 0, 1, 0, 1), "dFdy");
+      case ir_unop_f2i:
+         return bld.CreateFPToSI(a, lane_type(ir->type->base_type));
+      case ir_unop_i2f:
+         return bld.CreateSIToFP(a, lane_type(ir->type->base_type));
+      case ir_unop_u2f:
+      case ir_unop_b2f:
+         return bld.CreateUIToFP(a, lane_type(ir->type->base_type));
+      case ir_unop_b2i:
+         return bld.CreateZExt(a, lane_type(ir->type->base_type));
+      case ir_unop_f2b:
+         return bld.CreateFCmpONE(a, lane_imm(base_type, 0));
+      case ir_unop_i2b:
+         return bld.CreateICmpNE(a, lane_imm(base_type, 0));
+      case ir_unop_trunc:
+         if (!isFloat)
+            return a;
+         return bld.CreateSIToFP(bld.CreateFPToSI(a, lane_type(GLSL_TYPE_INT)), a->getType(), "trunc");
+      case ir_unop_floor:
+         if (!isFloat)
+            return a;
+         return bld.CreateFSub(a, bld.CreateFRem(a, lane_imm(base_type, 1)));
+      case ir_unop_ceil:
+         if (!isFloat)
+            return a;
+         return bld.CreateFAdd(bld.CreateFSub(a, bld.CreateFRem(a, lane_imm(base_type, 1))),
+                               lane_imm(base_type, 1));
+      case ir_unop_fract:
+         if (!isFloat)
+            return lane_imm(base_type, 0);
+         return bld.CreateFRem(a, lane_imm(base_type, 1));
+      case ir_binop_add:
+         return isFloat ? bld.CreateFAdd(a, b) : bld.CreateAdd(a, b);
+      case ir_binop_sub:
+         return isFloat ? bld.CreateFSub(a, b) : bld.CreateSub(a, b);
+      case ir_binop_mul:
+         if (GLSL_TYPE_BOOL == base_type)
+            return bld.CreateAnd(a, b);
+         return isFloat ? bld.CreateFMul(a, b) : bld.CreateMul(a, b);
+      case ir_binop_div:
+         return isFloat ? bld.CreateFDiv(a, b) : isInt ? bld.CreateSDiv(a, b) : bld.CreateUDiv(a, b);
+      case ir_binop_mod:
+         return isFloat ? bld.CreateFRem(a, b) : isInt ? bld.CreateSRem(a, b) : bld.CreateURem(a, b);
+      case ir_binop_less:
+         return isFloat ? bld.CreateFCmpOLT(a, b) : isInt ? bld.CreateICmpSLT(a, b) : bld.CreateICmpULT(a, b);
+      case ir_binop_greater:
+         return isFloat ? bld.CreateFCmpOGT(a, b) : isInt ? bld.CreateICmpSGT(a, b) : bld.CreateICmpUGT(a, b);
+      case ir_binop_lequal:
+         return isFloat ? bld.CreateFCmpOLE(a, b) : isInt ? bld.CreateICmpSLE(a, b) : bld.CreateICmpULE(a, b);
+      case ir_binop_gequal:
+         return isFloat ? bld.CreateFCmpOGE(a, b) : isInt ? bld.CreateICmpSGE(a, b) : bld.CreateICmpUGE(a, b);
+      case ir_binop_equal:
+         return isFloat ? bld.CreateFCmpOEQ(a, b) : bld.CreateICmpEQ(a, b);
+      case ir_binop_nequal:
+         return isFloat ? bld.CreateFCmpONE(a, b) : bld.CreateICmpNE(a, b);
+      case ir_binop_lshift:
+         return bld.CreateShl(a, b);
+      case ir_binop_rshift:
+         return isInt ? bld.CreateAShr(a, b) : bld.CreateLShr(a, b);
+      case ir_binop_bit_and:
+      case ir_binop_logic_and:
+         return bld.CreateAnd(a, b);
+      case ir_binop_bit_xor:
+         return bld.CreateXor(a, b);
+      case ir_binop_logic_xor:
+         return bld.CreateICmpNE(a, b);
+      case ir_binop_bit_or:
+      case ir_binop_logic_or:
+         return bld.CreateOr(a, b);
+      case ir_binop_min:
+         if (GLSL_TYPE_BOOL == base_type)
+            return bld.CreateAnd(a, b, "bmin");
+         return bld.CreateSelect(isFloat ? bld.CreateFCmpULE(a, b) : isInt ? bld.CreateICmpSLE(a, b) :
+                                 bld.CreateICmpULE(a, b), a, b, "min.select");
+      case ir_binop_max:
+         if (GLSL_TYPE_BOOL == base_type)
+            return bld.CreateOr(a, b, "bmax");
+         return bld.CreateSelect(isFloat ? bld.CreateFCmpUGE(a, b) : isInt ? bld.CreateICmpSGE(a, b) :
+                                 bld.CreateICmpUGE(a, b), a, b, "max.select");
+      default:
+         break;
+      }
+      failed = true;
+      return llvm::UndefValue::get(lane_type(ir->type->base_type));
+   }
+
+   soa_value expression(ir_expression * ir)
+   {
+      const unsigned operandCount = ir->get_num_operands();
+      soa_value ops[4];
+      for (unsigned i = 0; i < operandCount; i++) {
+         if (ir->operands[i]->type->is_matrix()) // should have been lowered to vector ops
+            failed = true;
+         ops[i] = value(ir->operands[i]);
+      }
+      if (failed)
+         return undef_value(ir->type);
+
+      const unsigned base_type = ir->operands[0]->type->base_type;
+      soa_value result;
+      switch (ir->operation) {
+      case ir_quadop_vector:
+         for (unsigned i = 0; i < operandCount; i++)
+            result.push_back(ops[i][0]);
+         return result;
+      case ir_binop_dot: {
+         llvm::Value * sum = NULL;
+         for (unsigned i = 0; i < ops[0].size(); i++)
+            sum = reduce(sum, component(ir, base_type, ops[0][i], ops[1][i]), true, base_type);
+         result.push_back(sum);
+         return result;
+      }
+      case ir_unop_any: {
+         llvm::Value * any = NULL;
+         for (unsigned i = 0; i < ops[0].size(); i++)
+            any = reduce(any, ops[0][i], false, base_type);
+         result.push_back(any);
+         return result;
+      }
+      case ir_binop_all_equal:
+      case ir_binop_any_nequal: {
+         llvm::Value * any = NULL; // any component not equal
+         for (unsigned i = 0; i < ops[0].size(); i++) {
+            llvm::Value * ne = GLSL_TYPE_FLOAT == base_type ? bld.CreateFCmpONE(ops[0][i], ops[1][i]) :
+                               bld.CreateICmpNE(ops[0][i], ops[1][i]);
+            any = reduce(any, ne, false, base_type);
+         }
+         result.push_back(ir_binop_any_nequal == ir->operation ? any : bld.CreateNot(any));
+         return result;
+      }
+      default:
+         break;
+      }
+
+      // scalar operands are used for every component of vector operands
+      unsigned count = ops[0].size();
+      if (operandCount > 1 && ops[1].size() > count)
+         count = ops[1].size();
+      for (unsigned i = 0; i < count; i++) {
+         llvm::Value * a = ops[0][ops[0].size() > 1 ? i : 0];
+         llvm::Value * b = operandCount > 1 ? ops[1][ops[1].size() > 1 ? i : 0] : NULL;
+         result.push_back(component(ir, base_type, a, b));
+      }
+      return result;
+   }
+
+   void assignment(ir_assignment * ir)
+   {
+      ir_variable * var = NULL;
+      unsigned first = 0, slot = 0;
+      if (!resolve(ir->lhs, var, first, slot) || ir_var_in == var->mode || ir_var_uniform == var->mode) {
+         failed = true;
+         return;
+      }
+      soa_value rhs = value(ir->rhs);
+      llvm::Value * condition = ir->condition ? value(ir->condition)[0] : NULL;
+      if (failed)
+         return;
+      soa_value & lhs = variable(var);
+      const glsl_type * type = ir->lhs->type;
+      const bool masked = !type->is_array() && !type->is_matrix();
+      const unsigned count = components(type);
+      // each enabled channel gets the value from a consecutive channel of the rhs
+      for (unsigned i = 0, rhsChannel = 0; i < count; i++) {
+         if (masked && !(ir->write_mask & (1 << i)))
+            continue;
+         llvm::Value * v = rhs[rhs.size() > 1 ? rhsChannel++ : 0];
+         if (condition) {
+            llvm::Value * old = lhs[first + i];
+            if (!old)
+               old = llvm::UndefValue::get(v->getType());
+            v = bld.CreateSelect(condition, v, old, "assign.conditional");
+         }
+         lhs[first + i] = v;
+      }
+   }
+
+   // stores written output components of every vertex
+   void store_outputs()
+   {
+      for (soa_variables_t::iterator it = variables.begin(); it != variables.end(); it++) {
+         ir_variable * var = it->first;
+         if (ir_var_out != var->mode)
+            continue;
+         assert(var->location >= 0);
+         const unsigned rows = element_type(var->type)->vector_elements;
+         for (unsigned i = 0; i < it->second.size(); i++) {
+            llvm::Value * v = it->second[i];
+            if (!v)
+               continue;
+            llvm::Type * type = ((llvm::VectorType*)v->getType())->getElementType();
+            if (type->isIntegerTy(1)) {
+               type = bld.getInt32Ty();
+               v = bld.CreateZExt(v, lane_type(GLSL_TYPE_INT));
+            }
+            for (unsigned j = 0; j < width; j++) {
+               llvm::Value * ptr = bld.CreateConstGEP1_32(outputs, j * outputStride +
+                                                          var->location + i / rows);
+               ptr = bld.CreateBitCast(ptr, llvm::PointerType::get(type, 0));
+               ptr = bld.CreateConstGEP1_32(ptr, i % rows);
+               bld.CreateStore(bld.CreateExtractElement(v, bld.getInt32(j)), ptr);
+            }
+         }
+      }
+   }
+
+   llvm::Function* main(exec_list * ir, const char * name)
+   {
+      ir_function_signature * sig = NULL;
+      foreach_iter(exec_list_iterator, iter, *ir) {
+         ir_function * function = ((ir_instruction *)iter.get())->as_function();
+         if (!function || strcmp("main", function->name))
+            continue;
+         foreach_iter(exec_list_iterator, sigIter, *function) {
+            ir_function_signature * s = (ir_function_signature *)sigIter.get();
+            if (s->is_defined)
+               sig = s;
+         }
+      }
+      if (!sig)
+         return NULL;
+
+      llvm::PointerType * vecPtrTy = llvm::PointerType::get(llvm::VectorType::get(bld.getFloatTy(), 4), 0);
+      std::vector<llvm::Type*> params(3, vecPtrTy); // inputs, outputs, constants
+      llvm::FunctionType* ft = llvm::FunctionType::get(bld.getVoidTy(),
+                                                       llvm::ArrayRef<llvm::Type*>(params),
+                                                       false);
+      llvm::Function * fun = llvm::Function::Create(ft, llvm::Function::ExternalLinkage, name, mod);
+      bld.SetInsertPoint(llvm::BasicBlock::Create(ctx, "entry", fun));
+      llvm::Function::arg_iterator ai = fun->arg_begin();
+      inputs = ai++;
+      inputs->setName("gl_inputs");
+      outputs = ai++;
+      outputs->setName("gl_outputs");
+      constants = ai++;
+      constants->setName("gl_constants");
+
+      foreach_iter(exec_list_iterator, iter, sig->body) {
+         ir_instruction * inst = (ir_instruction *)iter.get();
+         if (inst->as_variable())
+            continue;
+         else if (ir_assignment * assign = inst->as_assignment())
+            assignment(assign);
+         else if (inst->as_return())
+            break; // no control flow, so the rest is dead
+         else
+            failed = true; // loops, remaining ifs, calls
+         if (failed)
+            break;
+      }
+
+      if (failed) {
+         fun->eraseFromParent();
+         return NULL;
+      }
+      store_outputs();
+      bld.CreateRetVoid();
+      return fun;
+   }
+};
+
 struct llvm::Module *
 glsl_ir_to_llvm_module(struct exec_list *ir, llvm::Module * mod,
-                        const struct GGLState * gglCtx, const char * shaderSuffix)
+                        const struct GGLState * gglCtx, const char * shaderSuffix, bool * failed)
 {
    ir_to_llvm_visitor v(mod, gglCtx, shaderSuffix);
 
    visit_exec_list(ir, &v);
+   *failed = v.failed;
 
 //   mod->dump();
    if(llvm::verifyModule(*mod, llvm::PrintMessageAction, 0))
@@ -1411,3 +2092,31 @@ glsl_ir_to_llvm_module(struct exec_list *ir, llvm::Module * mod,
    return mod;
    //v.ir_to_llvm_emit_op1(NULL, OPCODE_END, ir_to_llvm_undef_dst, ir_to_llvm_undef);
 }
+
+bool
+glsl_ir_to_llvm_soa_function(struct exec_list *ir, llvm::Module * mod,
+                             const struct GGLState * gglCtx, const char * name, unsigned width,
+                             bool quad, unsigned inputStride, unsigned outputStride)
+{
+   // lowering ifs changes the IR, so work on a copy
+   void * mem_ctx = hieralloc_new(NULL);
+   exec_list copy;
+   clone_ir_list(mem_ctx, &copy, ir);
+   lower_if_to_cond_assign(&copy);
+
+   assert(!quad || 4 == width);
+   ir_to_llvm_soa_generator v(mod, gglCtx, width, quad, inputStride, outputStride);
+   llvm::Function * function = v.main(&copy, name);
+   hieralloc_free(mem_ctx);
+   if (!function)
+      return false;
+
+   if(llvm::verifyModule(*mod, llvm::PrintMessageAction, 0))
+   {
+      puts("**\n SoA module verification failed **\n");
+      mod->dump();
+      assert(0);
+      return false;
+   }
+   return true;
+}
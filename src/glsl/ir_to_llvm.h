@@ -4,7 +4,16 @@
 #include "llvm/Module.h"
 #include "ir.h"
 
+// adds function main shading one invocation to mod; failed is set if main can't compute
+// some operation, like derivatives, and must not be used to shade fragments
 struct llvm::Module * glsl_ir_to_llvm_module(struct exec_list *ir, llvm::Module * mod,
-               const struct GGLState * gglCtx, const char * shaderSuffix);
+               const struct GGLState * gglCtx, const char * shaderSuffix, bool * failed);
+
+// adds function name shading width invocations at once to mod, returns false if shader
+// is not supported; quad means the 4 invocations are a 2x2 fragment quad with derivatives,
+// strides are in vec4 between consecutive inputs and outputs
+bool glsl_ir_to_llvm_soa_function(struct exec_list *ir, llvm::Module * mod,
+               const struct GGLState * gglCtx, const char * name, unsigned width,
+               bool quad, unsigned inputStride, unsigned outputStride);
 
 #endif /* IR_TO_LLVM_H_ */
@@ -174,6 +174,35 @@ private:
 };
 
 
+/**
+ * Visitor that determines whether or not a shader may discard.
+ */
+class find_discard_visitor : public ir_hierarchical_visitor {
+public:
+   find_discard_visitor()
+      : found(false)
+   {
+      /* empty */
+   }
+
+   using ir_hierarchical_visitor::visit_enter;
+   virtual ir_visitor_status visit_enter(ir_discard *ir)
+   {
+      (void) ir;
+      this->found = true;
+      return visit_stop;
+   }
+
+   bool discard_found() const
+   {
+      return this->found;
+   }
+
+private:
+   bool found;             /**< Was a discard found? */
+};
+
+
 void
 linker_error_printf(gl_shader_program *prog, const char *fmt, ...)
 {
@@ -1532,6 +1561,7 @@ link_shaders(const struct gl_context *ctx, struct gl_shader_program *prog)
    void * mem_ctx = prog; // need linked & cloned ir to persist 
 
    prog->LinkStatus = false;
+   prog->UsesDiscard = false;
    prog->Validated = false;
    prog->_Used = false;
 
@@ -1725,6 +1755,13 @@ link_shaders(const struct gl_context *ctx, struct gl_shader_program *prog)
       gl_shader *const sh = prog->_LinkedShaders[MESA_SHADER_FRAGMENT];
 
       demote_shader_inputs_and_outputs(sh, ir_var_in);
+
+      /* gl_FragDepth is not an output here, so only discard keeps the
+       * depth and stencil tests from running before the fragment shader.
+       */
+      find_discard_visitor discard;
+      discard.run(sh->ir);
+      prog->UsesDiscard = discard.discard_found();
       
       foreach_list(node, sh->ir) {
          ir_variable *const var = ((ir_instruction *) node)->as_variable();
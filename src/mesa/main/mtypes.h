@@ -2084,6 +2084,8 @@ struct gl_shader
    
    struct Executable * executable;
    void (*function)();     /**< the active function */
+   void (*batchFunction)(); /**< the active SoA vertex or quad fragment function, or NULL */
+   void (*quadFunction)(); /**< scanline for fragments shaded by batchFunction, or NULL */
    unsigned SamplersUsed;  /**< bitfield of samplers used by shader */
 };
 
@@ -2148,6 +2150,9 @@ struct gl_shader_program
    unsigned AttributeSlots;/**< [0,AttributeSlots-1] read by vertex shader */
    unsigned VaryingSlots;  /**< [0,VaryingSlots-1] read by fragment shader */
    unsigned UsesFragCoord : 1, UsesPointCoord : 1;
+   unsigned UsesDiscard : 1; /**< fragment shader may discard, so depth and stencil are tested after it */
+   const void * BinningContext; /**< pixelflinger2 context holding binned primitives of this program */
+   unsigned BoundContexts; /**< pixelflinger2 contexts with this as CurrentProgram */
 };   
 
 
@@ -16,15 +16,22 @@
  */
 
 #include "src/pixelflinger2/pixelflinger2.h"
+#include "src/mesa/main/mtypes.h"
 
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
+#include <limits.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 void SetShaderVerifyFunctions(GGLInterface *);
 
 static void DepthFunc(GGLInterface * iface, GLenum func)
 {
    GGL_GET_CONTEXT(ctx, iface);
+   FlushBinned(ctx);
    if (GL_NEVER > func || GL_ALWAYS < func)
       return gglError(GL_INVALID_ENUM);
    ctx->state.bufferState.depthFunc = func & 0x7;
@@ -34,6 +41,7 @@ static void DepthFunc(GGLInterface * iface, GLenum func)
 static void StencilFuncSeparate(GGLInterface * iface, GLenum face, GLenum func, GLint ref, GLuint mask)
 {
    GGL_GET_CONTEXT(ctx, iface);
+   FlushBinned(ctx);
    if (GL_FRONT > face || GL_FRONT_AND_BACK < face)
       return gglError(GL_INVALID_ENUM);
    if (GL_NEVER > func || GL_ALWAYS < func)
@@ -80,6 +88,7 @@ static unsigned StencilOpEnum(GLenum func, unsigned oldValue)
 static void StencilOpSeparate(GGLInterface * iface, GLenum face, GLenum sfail, GLenum dpfail, GLenum dppass)
 {
    GGL_GET_CONTEXT(ctx, iface);
+   FlushBinned(ctx);
    if (GL_FRONT > face || GL_FRONT_AND_BACK < face)
       return gglError(GL_INVALID_ENUM);
    if (GL_FRONT == face || GL_FRONT_AND_BACK == face) {
@@ -136,58 +145,464 @@ static void ClearDepthf(GGLInterface * iface, GLclampf d)
       ctx->clearState.depth ^= 0x7fffffff; // since -FLT_MAX is close to -1 when bitcasted
 }
 
-static void Clear(const GGLInterface * iface, GLbitfield buf)
+#if USE_HIERARCHICAL_Z
+
+static inline int DepthBits(float z)
 {
-   GGL_GET_CONST_CONTEXT(ctx, iface);
+   int i;
+   memcpy(&i, &z, sizeof(i)); // bit reinterpretation, same as ClearDepthf and scanline
+   if (0x80000000 & i)
+      i ^= 0x7fffffff;
+   return i;
+}
+
+// [zMin, zMax] widened for rounding of depths stepped across a span, and for the
+// quantization of normalized depth formats, as Z_32 depthSurface values
+static inline void DepthRange(const GGLPixelFormat format, float zMin, float zMax, int * min, int * max)
+{
+   float slack = (fabs(zMin) + fabs(zMax) + zMax - zMin) * (1.0f / (1 << 12));
+   if (GGL_PIXEL_FORMAT_Z_16 == format)
+      slack += 1.0f / 0xffff;
+   else if (GGL_PIXEL_FORMAT_SZ_24 == format)
+      slack += 1.0f / 0xffffff;
+   *min = DepthBits(zMin - slack);
+   *max = DepthBits(zMax + slack);
+}
+
+bool HiZVisible(const GGLContext * ctx, unsigned block, VectorComp_t zMin, VectorComp_t zMax)
+{
+   assert(block < ctx->hiZ.blocksX * ctx->hiZ.blocksY);
+   int * const bounds = ctx->hiZ.bounds + block * 2;
+   int min, max;
+   DepthRange(ctx->depthSurface.format, zMin, zMax, &min, &max);
+   const unsigned func = 0x200 | ctx->state.bufferState.depthFunc;
+   if (!ctx->state.bufferState.stencilTest) // otherwise stencil ops still run for failed pixels
+      switch (func) {
+      case GL_NEVER:
+         return false;
+      case GL_LESS:
+         if (min >= bounds[1])
+            return false;
+         break;
+      case GL_LEQUAL:
+         if (min > bounds[1])
+            return false;
+         break;
+      case GL_GREATER:
+         if (max <= bounds[0])
+            return false;
+         break;
+      case GL_GEQUAL:
+         if (max < bounds[0])
+            return false;
+         break;
+      case GL_EQUAL:
+         if (max < bounds[0] || min > bounds[1])
+            return false;
+         break;
+      }
+
+   // passing depths are written; less only lowers and greater only raises the stored depth
+   switch (func) {
+   case GL_LESS:
+   case GL_LEQUAL:
+      bounds[0] = MIN2(bounds[0], min);
+      break;
+   case GL_GREATER:
+   case GL_GEQUAL:
+      bounds[1] = MAX2(bounds[1], max);
+      break;
+   case GL_NOTEQUAL:
+   case GL_ALWAYS:
+      bounds[0] = MIN2(bounds[0], min);
+      bounds[1] = MAX2(bounds[1], max);
+      break;
+   }
+   return true;
+}
 
-   // TODO DXL scissor test
-   if (GL_COLOR_BUFFER_BIT & buf && ctx->frameSurface.data) {
-      if (GGL_PIXEL_FORMAT_RGBA_8888 == ctx->frameSurface.format) {
-         unsigned * const end = (unsigned *)ctx->frameSurface.data +
-                                ctx->frameSurface.width * ctx->frameSurface.height;
-         const unsigned color = ctx->clearState.color;
-         for (unsigned * start = (unsigned *)ctx->frameSurface.data; start < end; start++)
-            *start = color;
-      } else if (GGL_PIXEL_FORMAT_RGB_565 == ctx->frameSurface.format) {
-         short * const end = (short *)ctx->frameSurface.data +
-                             ctx->frameSurface.width * ctx->frameSurface.height;
-         unsigned r = ctx->clearState.color & 0xf8, g = ctx->clearState.color & 0xfc00,
-                      b = ctx->clearState.color & 0xf80000;
+void HiZCovered(const GGLContext * ctx, unsigned block, VectorComp_t zMin, VectorComp_t zMax)
+{
+   assert(block < ctx->hiZ.blocksX * ctx->hiZ.blocksY);
+   if (ctx->state.bufferState.stencilTest || ctx->CurrentProgram->UsesDiscard)
+      return; // pixels failing stencil test or discarded keep their depth
+   int * const bounds = ctx->hiZ.bounds + block * 2;
+   int min, max;
+   DepthRange(ctx->depthSurface.format, zMin, zMax, &min, &max);
+   // every pixel either passed and was written, or failed against a depth beyond the new one
+   switch (0x200 | ctx->state.bufferState.depthFunc) {
+   case GL_LESS:
+   case GL_LEQUAL:
+      bounds[1] = MIN2(bounds[1], max);
+      break;
+   case GL_GREATER:
+   case GL_GEQUAL:
+      bounds[0] = MAX2(bounds[0], min);
+      break;
+   case GL_ALWAYS:
+      bounds[0] = min;
+      bounds[1] = max;
+      break;
+   }
+}
+
+// bounds of blocks of depthSurface, unknown until cleared
+static void ResizeHiZ(GGLContext * ctx)
+{
+   ctx->hiZ.blocksX = (ctx->depthSurface.width + GGL_RASTER_BLOCK_SIZE - 1) / GGL_RASTER_BLOCK_SIZE;
+   ctx->hiZ.blocksY = (ctx->depthSurface.height + GGL_RASTER_BLOCK_SIZE - 1) / GGL_RASTER_BLOCK_SIZE;
+   const unsigned count = ctx->hiZ.blocksX * ctx->hiZ.blocksY;
+   free(ctx->hiZ.bounds);
+   ctx->hiZ.bounds = NULL;
+   if (!ctx->depthSurface.data || !count)
+      return;
+   ctx->hiZ.bounds = (int *)malloc(count * 2 * sizeof(*ctx->hiZ.bounds));
+   assert(ctx->hiZ.bounds);
+   for (unsigned i = 0; i < count; i++) {
+      ctx->hiZ.bounds[i * 2] = INT_MIN;
+      ctx->hiZ.bounds[i * 2 + 1] = INT_MAX;
+   }
+}
+
+#endif // #if USE_HIERARCHICAL_Z
+
+// rect within surface
+static GGLRect SurfaceRect(const GGLSurface & surface, const GGLRect & rect)
+{
+   GGLRect clipped;
+   clipped.left = MAX2(rect.left, 0);
+   clipped.top = MAX2(rect.top, 0);
+   clipped.right = MIN2(rect.right, (int)surface.width);
+   clipped.bottom = MIN2(rect.bottom, (int)surface.height);
+   return clipped;
+}
+
+// fills rows of rect with value; non-temporal stores keep large fills from evicting the cache
+template <typename T>
+static void FillRect(const GGLSurface & surface, const GGLRect & rect, const T value, const bool stream)
+{
+   if (rect.left >= rect.right)
+      return;
+#ifdef __SSE2__
+   __m128i vector;
+   if (4 == sizeof(T))
+      vector = _mm_set1_epi32(value);
+   else if (2 == sizeof(T))
+      vector = _mm_set1_epi16(value);
+   else
+      vector = _mm_set1_epi8(value);
+#endif
+   for (int y = rect.top; y < rect.bottom; y++) {
+      T * start = (T *)surface.data + y * surface.stride + rect.left;
+      T * const end = start + rect.right - rect.left;
+#ifdef __SSE2__
+      if (stream) {
+         for (; start < end && ((unsigned long)start & 15); start++)
+            *start = value;
+         for (; start + 16 / sizeof(T) <= end; start += 16 / sizeof(T))
+            _mm_stream_si128((__m128i *)start, vector);
+      }
+#endif
+      if (1 == sizeof(T))
+         memset(start, value, end - start);
+      else
+         for (; start < end; start++)
+            *start = value;
+   }
+#ifdef __SSE2__
+   if (stream)
+      _mm_sfence();
+#endif
+}
+
+// sets bits of mask in each pixel of rect to value, keeping the others
+template <typename T>
+static void MaskRect(const GGLSurface & surface, const GGLRect & rect, const T value, const T mask)
+{
+   for (int y = rect.top; y < rect.bottom; y++) {
+      T * start = (T *)surface.data + y * surface.stride + rect.left;
+      T * const end = start + MAX2(rect.right - rect.left, 0);
+      for (; start < end; start++)
+         *start = (*start & ~mask) | value;
+   }
+}
+
+// Z_32 clear value as unsigned normalized depth of bits
+static unsigned DepthUnorm(int depth, const unsigned bits)
+{
+   if (0x80000000 & depth)
+      depth ^= 0x7fffffff;
+   float z = 0;
+   memcpy(&z, &depth, sizeof(z)); // bit reinterpretation, reverse of ClearDepthf
+   z = MIN2(MAX2(z, 0.0f), 1.0f);
+   const unsigned max = (1u << bits) - 1;
+   // float can't hold 0xffffff + 0.5, so scale in double and clamp
+   return MIN2((unsigned)(z * (double)max + 0.5), max);
+}
+
+// fills rect of surfaces of buffers with values
+static void FillBuffers(const GGLContext * ctx, unsigned buffers,
+                        const GGLContext::ClearState & values, const GGLRect & rect, bool stream)
+{
+   if (GGL_CLEAR_COLOR & buffers) {
+      const GGLRect clipped = SurfaceRect(ctx->frameSurface, rect);
+      if (GGL_PIXEL_FORMAT_RGBA_8888 == ctx->frameSurface.format)
+         FillRect<unsigned>(ctx->frameSurface, clipped, values.color, stream);
+      else if (GGL_PIXEL_FORMAT_RGB_565 == ctx->frameSurface.format) {
+         unsigned r = values.color & 0xf8, g = values.color & 0xfc00, b = values.color & 0xf80000;
          const short color = (b >> 19) | (g >> 5) | (r >> 3);
-         for (short * start = (short *)ctx->frameSurface.data; start < end; start++)
-            *start = color;
+         FillRect<short>(ctx->frameSurface, clipped, color, stream);
       } else
          assert(0);
    }
-   if (GL_DEPTH_BUFFER_BIT & buf && ctx->depthSurface.data) {
-      assert(GGL_PIXEL_FORMAT_Z_32 == ctx->depthSurface.format);
-      unsigned * const end = (unsigned *)ctx->depthSurface.data +
-                             ctx->depthSurface.width * ctx->depthSurface.height;
-      const unsigned depth = ctx->clearState.depth;
-      for (unsigned * start = (unsigned *)ctx->depthSurface.data; start < end; start++)
-         *start = depth;
+   const unsigned char stencil = values.stencil & 0xff;
+   if (GGL_CLEAR_DEPTH & buffers) {
+      const GGLRect clipped = SurfaceRect(ctx->depthSurface, rect);
+      if (GGL_PIXEL_FORMAT_Z_32 == ctx->depthSurface.format)
+         FillRect<int>(ctx->depthSurface, clipped, values.depth, stream);
+      else if (GGL_PIXEL_FORMAT_Z_16 == ctx->depthSurface.format)
+         FillRect<unsigned short>(ctx->depthSurface, clipped, DepthUnorm(values.depth, 16), stream);
+      else if (GGL_PIXEL_FORMAT_SZ_24 == ctx->depthSurface.format) {
+         const unsigned depth = DepthUnorm(values.depth, 24) << 8;
+         if ((GGL_CLEAR_STENCIL & buffers) && ctx->stencilSurface.data == ctx->depthSurface.data) {
+            FillRect<unsigned>(ctx->depthSurface, clipped, depth | stencil, stream);
+            buffers &= ~GGL_CLEAR_STENCIL; // packed stencil was filled with depth
+         } else
+            MaskRect<unsigned>(ctx->depthSurface, clipped, depth, 0xffffff00);
+      } else
+         assert(0);
+   }
+   if (GGL_CLEAR_STENCIL & buffers) {
+      const GGLRect clipped = SurfaceRect(ctx->stencilSurface, rect);
+      if (GGL_PIXEL_FORMAT_S_8 == ctx->stencilSurface.format)
+         FillRect<unsigned char>(ctx->stencilSurface, clipped, stencil, stream);
+      else if (GGL_PIXEL_FORMAT_SZ_8 == ctx->stencilSurface.format)
+         MaskRect<unsigned>(ctx->stencilSurface, clipped, stencil, 0xff);
+      else
+         assert(0);
    }
-   if (GL_STENCIL_BUFFER_BIT & buf && ctx->stencilSurface.data) {
-      assert(GGL_PIXEL_FORMAT_S_8 == ctx->stencilSurface.format);
-      unsigned * const end = (unsigned *)((unsigned char *)ctx->stencilSurface.data +
-                                          ctx->stencilSurface.width * ctx->stencilSurface.height);
-      unsigned * start = (unsigned *)ctx->stencilSurface.data;
-      const unsigned stencil = ctx->clearState.stencil;
-      for (start; start < end; start++)
-         *start = stencil;
-      start--;
-      for (unsigned char * i = (unsigned char *)start; i < (unsigned char *)end; i++)
-         *i = stencil & 0xff;
+}
+
+void * SurfaceAddress(const GGLSurface & surface, unsigned x, unsigned y)
+{
+   if (!surface.data)
+      return NULL;
+   unsigned bytes = 4;
+   if (GGL_PIXEL_FORMAT_RGB_565 == surface.format || GGL_PIXEL_FORMAT_Z_16 == surface.format)
+      bytes = 2;
+   else if (GGL_PIXEL_FORMAT_S_8 == surface.format)
+      bytes = 1;
+   const unsigned stride = surface.stride ? surface.stride : surface.width;
+   return (char *)surface.data + (y * stride + x) * bytes;
+}
+
+static GGLRect TileRect(const GGLContext::FastClear & fastClear, const unsigned tile)
+{
+   GGLRect rect;
+   rect.left = (tile % fastClear.tilesX) << GGL_TILE_SIZE_SHIFT;
+   rect.top = (tile / fastClear.tilesX) << GGL_TILE_SIZE_SHIFT;
+   rect.right = rect.left + GGL_TILE_SIZE;
+   rect.bottom = rect.top + GGL_TILE_SIZE;
+   return rect;
+}
+
+void ResolveTile(const GGLContext * ctx, const unsigned tile)
+{
+   GGLContext::FastClear & fastClear = ctx->fastClear;
+   if (!fastClear.pending || !fastClear.tiles[tile])
+      return;
+   // about to be rastered, so fill through the cache
+   FillBuffers(ctx, fastClear.tiles[tile], fastClear.values, TileRect(fastClear, tile), false);
+   fastClear.tiles[tile] = 0;
+}
+
+void ResolveRect(const GGLContext * ctx, const GGLRect & rect)
+{
+   const GGLContext::FastClear & fastClear = ctx->fastClear;
+   if (!fastClear.pending)
+      return;
+   const GGLRect clipped = SurfaceRect(ctx->frameSurface, rect);
+   for (int y = clipped.top >> GGL_TILE_SIZE_SHIFT; y <= (clipped.bottom - 1) >> GGL_TILE_SIZE_SHIFT; y++)
+      for (int x = clipped.left >> GGL_TILE_SIZE_SHIFT; x <= (clipped.right - 1) >> GGL_TILE_SIZE_SHIFT; x++)
+         ResolveTile(ctx, y * fastClear.tilesX + x);
+}
+
+// fills all flagged tiles, before surfaces are read or changed
+static void ResolveAll(const GGLContext * ctx)
+{
+   GGLContext::FastClear & fastClear = ctx->fastClear;
+   if (!fastClear.pending)
+      return;
+   for (unsigned tile = 0; tile < fastClear.tilesX * fastClear.tilesY; tile++)
+      if (fastClear.tiles[tile]) {
+         FillBuffers(ctx, fastClear.tiles[tile], fastClear.values, TileRect(fastClear, tile), true);
+         fastClear.tiles[tile] = 0;
+      }
+   fastClear.pending = 0;
+}
+
+#if USE_HIERARCHICAL_Z
+// blocks inside rect now hold only depth, blocks partly inside may also hold it
+static void ClearHiZ(const GGLContext * ctx, const GGLRect & rect, const int depth)
+{
+   if (rect.left >= rect.right || rect.top >= rect.bottom)
+      return;
+   const int mask = GGL_RASTER_BLOCK_SIZE - 1;
+   for (int by = rect.top & ~mask; by < rect.bottom; by += GGL_RASTER_BLOCK_SIZE)
+      for (int bx = rect.left & ~mask; bx < rect.right; bx += GGL_RASTER_BLOCK_SIZE) {
+         int * const bounds = ctx->hiZ.bounds + ((by / GGL_RASTER_BLOCK_SIZE) * ctx->hiZ.blocksX +
+                                                 bx / GGL_RASTER_BLOCK_SIZE) * 2;
+         const bool inside = bx >= rect.left && by >= rect.top &&
+                             (bx + mask < rect.right || rect.right == (int)ctx->depthSurface.width) &&
+                             (by + mask < rect.bottom || rect.bottom == (int)ctx->depthSurface.height);
+         bounds[0] = inside ? depth : MIN2(bounds[0], depth);
+         bounds[1] = inside ? depth : MAX2(bounds[1], depth);
+      }
+}
+#endif
+
+// flags tiles of frameSurface inside rect to be filled with clearState later,
+// and fills the parts of rect in other tiles now
+static void FastClear(const GGLContext * ctx, const unsigned buffers, const GGLRect & rect)
+{
+   GGLContext::FastClear & fastClear = ctx->fastClear;
+   // flagged tiles of a buffer share one value
+   const GGLContext::ClearState & values = ctx->clearState;
+   if (((GGL_CLEAR_COLOR & buffers & fastClear.pending) && values.color != fastClear.values.color) ||
+         ((GGL_CLEAR_DEPTH & buffers & fastClear.pending) && values.depth != fastClear.values.depth) ||
+         ((GGL_CLEAR_STENCIL & buffers & fastClear.pending) && values.stencil != fastClear.values.stencil))
+      ResolveAll(ctx);
+
+   if (!fastClear.pending) {
+      fastClear.tilesX = (ctx->frameSurface.width + GGL_TILE_SIZE - 1) >> GGL_TILE_SIZE_SHIFT;
+      fastClear.tilesY = (ctx->frameSurface.height + GGL_TILE_SIZE - 1) >> GGL_TILE_SIZE_SHIFT;
+      const unsigned tileCount = fastClear.tilesX * fastClear.tilesY;
+      if (tileCount > fastClear.tileCapacity) {
+         free(fastClear.tiles);
+         fastClear.tiles = (unsigned char *)malloc(tileCount);
+         assert(fastClear.tiles);
+         fastClear.tileCapacity = tileCount;
+      }
+      memset(fastClear.tiles, 0, tileCount);
    }
+   if (GGL_CLEAR_COLOR & buffers)
+      fastClear.values.color = values.color;
+   if (GGL_CLEAR_DEPTH & buffers)
+      fastClear.values.depth = values.depth;
+   if (GGL_CLEAR_STENCIL & buffers)
+      fastClear.values.stencil = values.stencil;
+
+   const GGLRect clipped = SurfaceRect(ctx->frameSurface, rect);
+   if (clipped.left >= clipped.right || clipped.top >= clipped.bottom)
+      return;
+   for (int y = clipped.top >> GGL_TILE_SIZE_SHIFT; y <= (clipped.bottom - 1) >> GGL_TILE_SIZE_SHIFT; y++)
+      for (int x = clipped.left >> GGL_TILE_SIZE_SHIFT; x <= (clipped.right - 1) >> GGL_TILE_SIZE_SHIFT; x++) {
+         const unsigned tile = y * fastClear.tilesX + x;
+         const GGLRect tileRect = SurfaceRect(ctx->frameSurface, TileRect(fastClear, tile));
+         if (tileRect.left >= clipped.left && tileRect.top >= clipped.top &&
+               tileRect.right <= clipped.right && tileRect.bottom <= clipped.bottom) {
+            fastClear.tiles[tile] |= buffers;
+            continue;
+         }
+         ResolveTile(ctx, tile);
+         GGLRect part;
+         part.left = MAX2(tileRect.left, clipped.left);
+         part.top = MAX2(tileRect.top, clipped.top);
+         part.right = MIN2(tileRect.right, clipped.right);
+         part.bottom = MIN2(tileRect.bottom, clipped.bottom);
+         FillBuffers(ctx, buffers, values, part, false);
+      }
+   fastClear.pending |= buffers;
+}
+
+static void Clear(const GGLInterface * iface, GLbitfield buf)
+{
+   GGL_GET_CONST_CONTEXT(ctx, iface);
+   FlushBinned(ctx);
+
+   unsigned buffers = 0;
+   if (GL_COLOR_BUFFER_BIT & buf && ctx->frameSurface.data)
+      buffers |= GGL_CLEAR_COLOR;
+   if (GL_DEPTH_BUFFER_BIT & buf && ctx->depthSurface.data)
+      buffers |= GGL_CLEAR_DEPTH;
+   if (GL_STENCIL_BUFFER_BIT & buf && ctx->stencilSurface.data)
+      buffers |= GGL_CLEAR_STENCIL;
+   if (!buffers)
+      return;
+
+   GGLRect rect; // within scissor box if enabled, clipped to each surface when filled
+   rect.left = rect.top = 0;
+   rect.right = rect.bottom = INT_MAX;
+   if (ctx->scissorState.enable)
+      rect = ctx->scissorState.box;
+
+#if USE_HIERARCHICAL_Z
+   if (GGL_CLEAR_DEPTH & buffers)
+      ClearHiZ(ctx, SurfaceRect(ctx->depthSurface, rect), ctx->clearState.depth);
+#endif
+
+   // tiles are of frameSurface, so other surfaces must match it
+   bool fast = ctx->fastClear.enable && ctx->frameSurface.data;
+   if (GGL_CLEAR_DEPTH & buffers)
+      fast &= ctx->depthSurface.width == ctx->frameSurface.width &&
+              ctx->depthSurface.height == ctx->frameSurface.height;
+   if (GGL_CLEAR_STENCIL & buffers)
+      fast &= ctx->stencilSurface.width == ctx->frameSurface.width &&
+              ctx->stencilSurface.height == ctx->frameSurface.height;
+   if (fast)
+      return FastClear(ctx, buffers, rect);
+
+   ResolveAll(ctx); // flagged tiles would overwrite this clear later
+   const GGLRect clipped = SurfaceRect(ctx->frameSurface, rect);
+   const bool stream = (unsigned)MAX2(clipped.right - clipped.left, 0) *
+                       MAX2(clipped.bottom - clipped.top, 0) * 4 > GGL_STREAM_FILL_SIZE;
+   FillBuffers(ctx, buffers, ctx->clearState, rect, stream);
+}
+
+static void SetFastClear(GGLInterface * iface, GLboolean enable)
+{
+   GGL_GET_CONTEXT(ctx, iface);
+   FlushBinned(ctx);
+   if (!enable)
+      ResolveAll(ctx);
+   ctx->fastClear.enable = enable;
+}
+
+static void Flush(const GGLInterface * iface)
+{
+#if USE_TILED_RASTER
+   GGL_GET_CONST_CONTEXT(ctx, iface);
+   FlushTiles(ctx);
+#endif
+}
+
+static void Finish(const GGLInterface * iface)
+{
+   GGL_GET_CONST_CONTEXT(ctx, iface);
+#if USE_TILED_RASTER
+   FlushTiles(ctx);
+#endif
+   ResolveAll(ctx);
+}
+
+// surfaces in GGLContext always have stride set
+static void DefaultStride(GGLSurface & surface)
+{
+   if (!surface.stride)
+      surface.stride = surface.width;
+   assert(surface.stride >= surface.width);
 }
 
 static void SetBuffer(GGLInterface * iface, const GLenum type, GGLSurface * surface)
 {
    GGL_GET_CONTEXT(ctx, iface);
+   FlushBinned(ctx);
+   ResolveAll(ctx); // tiles are filled into the surfaces they were cleared in
    bool changed = false;
    if (GL_COLOR_BUFFER_BIT == type) {
       if (surface) {
          ctx->frameSurface = *surface;
+         DefaultStride(ctx->frameSurface);
          changed |= ctx->frameSurface.format ^ surface->format;
          switch (surface->format) {
          case GGL_PIXEL_FORMAT_RGBA_8888:
@@ -203,21 +618,30 @@ static void SetBuffer(GGLInterface * iface, const GLenum type, GGLSurface * surf
          changed = true;
       }
       ctx->state.bufferState.colorFormat = ctx->frameSurface.format;
+      UpdateClipRect(ctx);
    } else if (GL_DEPTH_BUFFER_BIT == type) {
       if (surface) {
          ctx->depthSurface = *surface;
+         DefaultStride(ctx->depthSurface);
          changed |= ctx->depthSurface.format ^ surface->format;
-         assert(GGL_PIXEL_FORMAT_Z_32 == ctx->depthSurface.format);
+         assert(GGL_PIXEL_FORMAT_Z_32 == ctx->depthSurface.format ||
+                GGL_PIXEL_FORMAT_Z_16 == ctx->depthSurface.format ||
+                GGL_PIXEL_FORMAT_SZ_24 == ctx->depthSurface.format);
       } else {
          memset(&ctx->depthSurface, 0, sizeof(ctx->depthSurface));
          changed = true;
       }
       ctx->state.bufferState.depthFormat = ctx->depthSurface.format;
+#if USE_HIERARCHICAL_Z
+      ResizeHiZ(ctx);
+#endif
    } else if (GL_STENCIL_BUFFER_BIT == type) {
       if (surface) {
          ctx->stencilSurface = *surface;
+         DefaultStride(ctx->stencilSurface);
          changed |= ctx->stencilSurface.format ^ surface->format;
-         assert(GGL_PIXEL_FORMAT_S_8 == ctx->stencilSurface.format);
+         assert(GGL_PIXEL_FORMAT_S_8 == ctx->stencilSurface.format ||
+                GGL_PIXEL_FORMAT_SZ_8 == ctx->stencilSurface.format);
       } else {
          memset(&ctx->stencilSurface, 0, sizeof(ctx->stencilSurface));
          changed = true;
@@ -240,5 +664,8 @@ void InitializeBufferFunctions(GGLInterface * iface)
    iface->ClearColor = ClearColor;
    iface->ClearDepthf = ClearDepthf;
    iface->Clear = Clear;
+   iface->SetFastClear = SetFastClear;
+   iface->Flush = Flush;
+   iface->Finish = Finish;
    iface->SetBuffer = SetBuffer;
 }
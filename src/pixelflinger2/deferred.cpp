@@ -0,0 +1,912 @@
+/**
+ **
+ ** Copyright 2011, The Android Open Source Project
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <pthread.h>
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "pixelflinger2.h"
+#include "src/mesa/main/mtypes.h"
+#include "src/mesa/program/prog_uniform.h"
+#include "src/glsl/glsl_types.h"
+
+// Deferred interface records state changes and draws into command buffers executed in order
+// by a render thread against the wrapped interface. Arguments are copied at record time,
+// including vertex and uniform data; texture and surface data are referenced as by SetSampler
+// and SetBuffer. Calls returning results, and shader object calls other than ShaderUse,
+// ShaderUniform* and ShaderProgramDelete, first wait for the render thread to go idle and then
+// run on the calling thread, so the compiler and shader objects are only used by one thread.
+
+enum CommandOp {
+   CMD_CULL_FACE, CMD_FRONT_FACE, CMD_DEPTH_RANGE, CMD_VIEWPORT, CMD_BLEND_COLOR,
+   CMD_BLEND_EQUATION, CMD_BLEND_FUNC, CMD_ENABLE_DISABLE, CMD_SCISSOR, CMD_DEPTH_FUNC,
+   CMD_STENCIL_FUNC, CMD_STENCIL_OP, CMD_STENCIL_SELECT, CMD_CLEAR_STENCIL, CMD_CLEAR_COLOR,
+   CMD_CLEAR_DEPTH, CMD_CLEAR, CMD_SET_FAST_CLEAR, CMD_FLUSH, CMD_FINISH, CMD_SET_SAMPLER,
+   CMD_SET_BUFFER, CMD_DRAW_TRIANGLE, CMD_DRAW_ARRAYS, CMD_DRAW_ELEMENTS, CMD_RASTER_TRIANGLE,
+   CMD_RASTER_TRAPEZOID, CMD_SCAN_LINE, CMD_SET_RASTER_THREADS, CMD_RESET_STATISTICS,
+   CMD_ENABLE_STATISTICS, CMD_SHADER_USE, CMD_PROGRAM_DELETE, CMD_UNIFORM, CMD_UNIFORM_MATRIX,
+   CMD_SET_SAMPLER_SURFACE
+};
+
+struct Command {
+   unsigned op;
+   unsigned size; // bytes including payload, multiple of 16
+   union {
+      GLenum e[4];
+      GLint i[4];
+      GLfloat f[4];
+      struct {
+         unsigned sampler;
+         bool set;
+         GGLTexture texture;
+      } sampler;
+      struct {
+         GLenum type;
+         bool set;
+         GGLSurface surface;
+      } buffer;
+      struct {
+         unsigned sampler;
+         bool set, hasParameters;
+         GGLSurface surface;
+         GGLTexture parameters;
+      } samplerSurface;
+      struct {
+         GLenum mode, type;
+         GLsizei count;
+         unsigned vertexCount; // for DrawElements, indices follow vertices
+      } draw;
+      struct {
+         gl_shader_program * program;
+         GLint location;
+         GLsizei count;
+         GLenum type;
+      } uniform;
+      struct {
+         gl_shader_program * program;
+         GLint cols, rows, location;
+         GLsizei count;
+         GLboolean transpose;
+      } matrix;
+      gl_shader_program * program;
+   };
+} __attribute__ ((aligned (16))); // payload follows, aligned for vertex data
+
+struct CommandBuffer {
+   char * data;
+   unsigned size, capacity;
+};
+
+struct Deferred {
+   GGLInterface interface; // must be first, deferred functions cast iface to Deferred
+   GGLInterface * iface; // wrapped, only used by render thread unless idle
+
+   CommandBuffer recording; // only used by calling thread
+   std::vector<CommandBuffer> submitted, spare; // guarded by lock
+   bool busy, quit; // render thread executing a buffer, or asked to exit
+   pthread_mutex_t lock;
+   pthread_cond_t submitCond, idleCond;
+   pthread_t thread;
+   std::set<const void *> owned; // shaders and programs created through this interface
+};
+
+// shader functions that do not take iface go through the interface that created the object
+static std::map<const void *, Deferred *> owners;
+static pthread_mutex_t ownersLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void SetOwner(Deferred * deferred, const void * object)
+{
+   pthread_mutex_lock(&ownersLock);
+   owners[object] = deferred;
+   deferred->owned.insert(object);
+   pthread_mutex_unlock(&ownersLock);
+}
+
+static void ClearOwner(Deferred * deferred, const void * object)
+{
+   pthread_mutex_lock(&ownersLock);
+   owners.erase(object);
+   deferred->owned.erase(object);
+   pthread_mutex_unlock(&ownersLock);
+}
+
+static Deferred * GetOwner(const void * object)
+{
+   pthread_mutex_lock(&ownersLock);
+   std::map<const void *, Deferred *>::const_iterator it = owners.find(object);
+   Deferred * const deferred = owners.end() != it ? it->second : NULL;
+   pthread_mutex_unlock(&ownersLock);
+   assert(deferred);
+   return deferred;
+}
+
+#define GGL_GET_DEFERRED(deferred, interface) Deferred * deferred = (Deferred *)interface;
+
+static inline unsigned Align16(const unsigned size)
+{
+   return (size + 15) & ~15;
+}
+
+static void Execute(GGLInterface * iface, const Command * cmd)
+{
+   const char * payload = (const char *)(cmd + 1);
+   switch (cmd->op) {
+   case CMD_CULL_FACE:
+      return iface->CullFace(iface, cmd->e[0]);
+   case CMD_FRONT_FACE:
+      return iface->FrontFace(iface, cmd->e[0]);
+   case CMD_DEPTH_RANGE:
+      return iface->DepthRangef(iface, cmd->f[0], cmd->f[1]);
+   case CMD_VIEWPORT:
+      return iface->Viewport(iface, cmd->i[0], cmd->i[1], cmd->i[2], cmd->i[3]);
+   case CMD_BLEND_COLOR:
+      return iface->BlendColor(iface, cmd->f[0], cmd->f[1], cmd->f[2], cmd->f[3]);
+   case CMD_BLEND_EQUATION:
+      return iface->BlendEquationSeparate(iface, cmd->e[0], cmd->e[1]);
+   case CMD_BLEND_FUNC:
+      return iface->BlendFuncSeparate(iface, cmd->e[0], cmd->e[1], cmd->e[2], cmd->e[3]);
+   case CMD_ENABLE_DISABLE:
+      return iface->EnableDisable(iface, cmd->e[0], cmd->e[1]);
+   case CMD_SCISSOR:
+      return iface->Scissor(iface, cmd->i[0], cmd->i[1], cmd->i[2], cmd->i[3]);
+   case CMD_DEPTH_FUNC:
+      return iface->DepthFunc(iface, cmd->e[0]);
+   case CMD_STENCIL_FUNC:
+      return iface->StencilFuncSeparate(iface, cmd->e[0], cmd->e[1], cmd->i[2], cmd->e[3]);
+   case CMD_STENCIL_OP:
+      return iface->StencilOpSeparate(iface, cmd->e[0], cmd->e[1], cmd->e[2], cmd->e[3]);
+   case CMD_STENCIL_SELECT:
+      return iface->StencilSelect(iface, cmd->e[0]);
+   case CMD_CLEAR_STENCIL:
+      return iface->ClearStencil(iface, cmd->i[0]);
+   case CMD_CLEAR_COLOR:
+      return iface->ClearColor(iface, cmd->f[0], cmd->f[1], cmd->f[2], cmd->f[3]);
+   case CMD_CLEAR_DEPTH:
+      return iface->ClearDepthf(iface, cmd->f[0]);
+   case CMD_CLEAR:
+      return iface->Clear(iface, cmd->e[0]);
+   case CMD_SET_FAST_CLEAR:
+      return iface->SetFastClear(iface, cmd->e[0]);
+   case CMD_FLUSH:
+      return iface->Flush(iface);
+   case CMD_FINISH:
+      return iface->Finish(iface);
+   case CMD_SET_SAMPLER: {
+      GGLTexture texture = cmd->sampler.texture;
+      return iface->SetSampler(iface, cmd->sampler.sampler, cmd->sampler.set ? &texture : NULL);
+   }
+   case CMD_SET_SAMPLER_SURFACE: {
+      GGLSurface surface = cmd->samplerSurface.surface;
+      GGLTexture parameters = cmd->samplerSurface.parameters;
+      return iface->SetSamplerSurface(iface, cmd->samplerSurface.sampler,
+                                      cmd->samplerSurface.set ? &surface : NULL,
+                                      cmd->samplerSurface.hasParameters ? &parameters : NULL);
+   }
+   case CMD_SET_BUFFER: {
+      GGLSurface surface = cmd->buffer.surface;
+      return iface->SetBuffer(iface, cmd->buffer.type, cmd->buffer.set ? &surface : NULL);
+   }
+   case CMD_DRAW_TRIANGLE: {
+      const VertexInput * v = (const VertexInput *)payload;
+      return iface->DrawTriangle(iface, v, v + 1, v + 2);
+   }
+   case CMD_DRAW_ARRAYS:
+      return iface->DrawArrays(iface, cmd->draw.mode, (const VertexInput *)payload, 0, cmd->draw.count);
+   case CMD_DRAW_ELEMENTS:
+      return iface->DrawElements(iface, cmd->draw.mode, (const VertexInput *)payload, cmd->draw.count,
+                                 cmd->draw.type, payload + cmd->draw.vertexCount * sizeof(VertexInput));
+   case CMD_RASTER_TRIANGLE: {
+      const VertexOutput * v = (const VertexOutput *)payload;
+      return iface->RasterTriangle(iface, v, v + 1, v + 2);
+   }
+   case CMD_RASTER_TRAPEZOID: {
+      const VertexOutput * v = (const VertexOutput *)payload;
+      return iface->RasterTrapezoid(iface, v, v + 1, v + 2, v + 3);
+   }
+   case CMD_SCAN_LINE: {
+      const VertexOutput * v = (const VertexOutput *)payload;
+      return iface->ScanLine(iface, v, v + 1);
+   }
+   case CMD_SET_RASTER_THREADS:
+      return iface->SetRasterThreads(iface, cmd->e[0]);
+   case CMD_RESET_STATISTICS:
+      return iface->ResetStatistics(iface);
+   case CMD_ENABLE_STATISTICS:
+      return iface->EnableStatistics(iface, cmd->e[0]);
+   case CMD_SHADER_USE:
+      return iface->ShaderUse(iface, cmd->program);
+   case CMD_PROGRAM_DELETE:
+      return iface->ShaderProgramDelete(iface, cmd->program);
+   case CMD_UNIFORM:
+      iface->ShaderUniform(cmd->uniform.program, cmd->uniform.location, cmd->uniform.count,
+                           payload, cmd->uniform.type);
+      return;
+   case CMD_UNIFORM_MATRIX:
+      return iface->ShaderUniformMatrix(cmd->matrix.program, cmd->matrix.cols, cmd->matrix.rows,
+                                        cmd->matrix.location, cmd->matrix.count,
+                                        cmd->matrix.transpose, (const GLfloat *)payload);
+   default:
+      assert(0);
+   }
+}
+
+static void * RenderThread(void * args)
+{
+   Deferred * deferred = (Deferred *)args;
+   pthread_mutex_lock(&deferred->lock);
+   while (true) {
+      while (deferred->submitted.empty() && !deferred->quit)
+         pthread_cond_wait(&deferred->submitCond, &deferred->lock);
+      if (deferred->submitted.empty())
+         break; // quit after executing all submitted
+      CommandBuffer buffer = deferred->submitted.front();
+      deferred->submitted.erase(deferred->submitted.begin());
+      deferred->busy = true;
+      pthread_mutex_unlock(&deferred->lock);
+
+      for (unsigned offset = 0; offset < buffer.size; ) {
+         const Command * cmd = (const Command *)(buffer.data + offset);
+         Execute(deferred->iface, cmd);
+         offset += cmd->size;
+      }
+
+      pthread_mutex_lock(&deferred->lock);
+      buffer.size = 0;
+      if (GGL_COMMAND_BUFFER_SIZE == buffer.capacity)
+         deferred->spare.push_back(buffer);
+      else
+         free(buffer.data); // oversized for a single large draw
+      deferred->busy = false;
+      if (deferred->submitted.empty())
+         pthread_cond_broadcast(&deferred->idleCond);
+   }
+   pthread_mutex_unlock(&deferred->lock);
+   return NULL;
+}
+
+// queues recorded commands to render thread
+static void Submit(Deferred * deferred)
+{
+   if (!deferred->recording.size)
+      return;
+   pthread_mutex_lock(&deferred->lock);
+   deferred->submitted.push_back(deferred->recording);
+   deferred->recording.data = NULL;
+   deferred->recording.size = deferred->recording.capacity = 0;
+   pthread_cond_signal(&deferred->submitCond);
+   pthread_mutex_unlock(&deferred->lock);
+}
+
+// submits and waits for render thread to execute everything recorded
+static void Sync(Deferred * deferred)
+{
+   Submit(deferred);
+   pthread_mutex_lock(&deferred->lock);
+   while (!deferred->submitted.empty() || deferred->busy)
+      pthread_cond_wait(&deferred->idleCond, &deferred->lock);
+   pthread_mutex_unlock(&deferred->lock);
+}
+
+// returns command with payload bytes after it, submitting full buffers
+static Command * Record(Deferred * deferred, const CommandOp op, const unsigned payload = 0)
+{
+   const unsigned size = sizeof(Command) + Align16(payload);
+   CommandBuffer & recording = deferred->recording;
+   if (recording.size + size > recording.capacity) {
+      Submit(deferred);
+      if (size > GGL_COMMAND_BUFFER_SIZE) {
+         recording.data = (char *)memalign(16, size);
+         recording.capacity = size;
+      } else {
+         pthread_mutex_lock(&deferred->lock);
+         if (!deferred->spare.empty()) {
+            recording = deferred->spare.back();
+            deferred->spare.pop_back();
+         }
+         pthread_mutex_unlock(&deferred->lock);
+         if (!recording.data) {
+            recording.data = (char *)memalign(16, GGL_COMMAND_BUFFER_SIZE);
+            recording.capacity = GGL_COMMAND_BUFFER_SIZE;
+         }
+      }
+      assert(recording.data);
+   }
+   Command * cmd = (Command *)(recording.data + recording.size);
+   recording.size += size;
+   cmd->op = op;
+   cmd->size = size;
+   return cmd;
+}
+
+static void RecordEnums(GGLInterface * iface, const CommandOp op, const GLenum e0,
+                        const GLenum e1 = 0, const GLenum e2 = 0, const GLenum e3 = 0)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   Command * cmd = Record(deferred, op);
+   cmd->e[0] = e0;
+   cmd->e[1] = e1;
+   cmd->e[2] = e2;
+   cmd->e[3] = e3;
+}
+
+static void RecordFloats(GGLInterface * iface, const CommandOp op, const GLfloat f0,
+                         const GLfloat f1 = 0, const GLfloat f2 = 0, const GLfloat f3 = 0)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   Command * cmd = Record(deferred, op);
+   cmd->f[0] = f0;
+   cmd->f[1] = f1;
+   cmd->f[2] = f2;
+   cmd->f[3] = f3;
+}
+
+static void CullFace(GGLInterface * iface, GLenum mode)
+{
+   RecordEnums(iface, CMD_CULL_FACE, mode);
+}
+
+static void FrontFace(GGLInterface * iface, GLenum mode)
+{
+   RecordEnums(iface, CMD_FRONT_FACE, mode);
+}
+
+static void DepthRangef(GGLInterface * iface, GLclampf zNear, GLclampf zFar)
+{
+   RecordFloats(iface, CMD_DEPTH_RANGE, zNear, zFar);
+}
+
+static void Viewport(GGLInterface * iface, GLint x, GLint y, GLsizei width, GLsizei height)
+{
+   RecordEnums(iface, CMD_VIEWPORT, x, y, width, height);
+}
+
+static void ViewportTransform(const GGLInterface * iface, Vector4 * v)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   Sync(deferred);
+   deferred->iface->ViewportTransform(deferred->iface, v);
+}
+
+static void BlendColor(GGLInterface * iface, GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha)
+{
+   RecordFloats(iface, CMD_BLEND_COLOR, red, green, blue, alpha);
+}
+
+static void BlendEquationSeparate(GGLInterface * iface, GLenum modeRGB, GLenum modeAlpha)
+{
+   RecordEnums(iface, CMD_BLEND_EQUATION, modeRGB, modeAlpha);
+}
+
+static void BlendFuncSeparate(GGLInterface * iface, GLenum srcRGB, GLenum dstRGB,
+                              GLenum srcAlpha, GLenum dstAlpha)
+{
+   RecordEnums(iface, CMD_BLEND_FUNC, srcRGB, dstRGB, srcAlpha, dstAlpha);
+}
+
+static void EnableDisable(GGLInterface * iface, GLenum cap, GLboolean enable)
+{
+   RecordEnums(iface, CMD_ENABLE_DISABLE, cap, enable);
+}
+
+static void Scissor(GGLInterface * iface, GLint x, GLint y, GLsizei width, GLsizei height)
+{
+   RecordEnums(iface, CMD_SCISSOR, x, y, width, height);
+}
+
+static void DepthFunc(GGLInterface * iface, GLenum func)
+{
+   RecordEnums(iface, CMD_DEPTH_FUNC, func);
+}
+
+static void StencilFuncSeparate(GGLInterface * iface, GLenum face, GLenum func, GLint ref, GLuint mask)
+{
+   RecordEnums(iface, CMD_STENCIL_FUNC, face, func, ref, mask);
+}
+
+static void StencilOpSeparate(GGLInterface * iface, GLenum face, GLenum sfail,
+                              GLenum dpfail, GLenum dppass)
+{
+   RecordEnums(iface, CMD_STENCIL_OP, face, sfail, dpfail, dppass);
+}
+
+static void StencilSelect(const GGLInterface * iface, GLenum face)
+{
+   RecordEnums(const_cast<GGLInterface *>(iface), CMD_STENCIL_SELECT, face);
+}
+
+static void ClearStencil(GGLInterface * iface, GLint s)
+{
+   RecordEnums(iface, CMD_CLEAR_STENCIL, s);
+}
+
+static void ClearColor(GGLInterface * iface, GLclampf r, GLclampf g, GLclampf b, GLclampf a)
+{
+   RecordFloats(iface, CMD_CLEAR_COLOR, r, g, b, a);
+}
+
+static void ClearDepthf(GGLInterface * iface, GLclampf d)
+{
+   RecordFloats(iface, CMD_CLEAR_DEPTH, d);
+}
+
+static void Clear(const GGLInterface * iface, GLbitfield buf)
+{
+   RecordEnums(const_cast<GGLInterface *>(iface), CMD_CLEAR, buf);
+}
+
+static void SetFastClear(GGLInterface * iface, GLboolean enable)
+{
+   RecordEnums(iface, CMD_SET_FAST_CLEAR, enable);
+}
+
+static void Flush(const GGLInterface * iface)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   Record(deferred, CMD_FLUSH);
+   Submit(deferred);
+}
+
+static void Finish(const GGLInterface * iface)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   Record(deferred, CMD_FINISH);
+   Sync(deferred);
+}
+
+static void SetSampler(GGLInterface * iface, const unsigned sampler, GGLTexture * texture)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   Command * cmd = Record(deferred, CMD_SET_SAMPLER);
+   cmd->sampler.sampler = sampler;
+   cmd->sampler.set = texture;
+   if (texture)
+      cmd->sampler.texture = *texture;
+}
+
+static void SetSamplerSurface(GGLInterface * iface, const unsigned sampler, const GGLSurface * surface,
+                              const GGLTexture * parameters)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   Command * cmd = Record(deferred, CMD_SET_SAMPLER_SURFACE);
+   cmd->samplerSurface.sampler = sampler;
+   cmd->samplerSurface.set = surface;
+   if (surface)
+      cmd->samplerSurface.surface = *surface;
+   cmd->samplerSurface.hasParameters = parameters;
+   if (parameters)
+      cmd->samplerSurface.parameters = *parameters;
+}
+
+static void SetBuffer(GGLInterface * iface, const GLenum type, GGLSurface * surface)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   Command * cmd = Record(deferred, CMD_SET_BUFFER);
+   cmd->buffer.type = type;
+   cmd->buffer.set = surface;
+   if (surface)
+      cmd->buffer.surface = *surface;
+}
+
+static void ProcessVertex(const GGLInterface * iface, const VertexInput * input, VertexOutput * output)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   Sync(deferred);
+   deferred->iface->ProcessVertex(deferred->iface, input, output);
+}
+
+static void DrawTriangle(const GGLInterface * iface, const VertexInput * v0,
+                         const VertexInput * v1, const VertexInput * v2)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   Command * cmd = Record(deferred, CMD_DRAW_TRIANGLE, 3 * sizeof(VertexInput));
+   VertexInput * v = (VertexInput *)(cmd + 1);
+   v[0] = *v0;
+   v[1] = *v1;
+   v[2] = *v2;
+}
+
+// only the vertices drawn are copied, and executed from first 0
+static void DrawArrays(const GGLInterface * iface, GLenum mode, const VertexInput * vertices,
+                       GLint first, GLsizei count)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   count = MAX2(count, 0);
+   Command * cmd = Record(deferred, CMD_DRAW_ARRAYS, count * sizeof(*vertices));
+   cmd->draw.mode = mode;
+   cmd->draw.count = count;
+   memcpy(cmd + 1, vertices + first, count * sizeof(*vertices));
+}
+
+static void DrawElements(const GGLInterface * iface, GLenum mode, const VertexInput * vertices,
+                         GLsizei count, GLenum type, const GLvoid * indices)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   count = MAX2(count, 0);
+   unsigned vertexCount = 0, indexBytes = 4;
+   if (GL_UNSIGNED_BYTE == type) {
+      indexBytes = 1;
+      for (GLsizei i = 0; i < count; i++)
+         vertexCount = MAX2(vertexCount, ((const GLubyte *)indices)[i] + 1u);
+   } else if (GL_UNSIGNED_SHORT == type) {
+      indexBytes = 2;
+      for (GLsizei i = 0; i < count; i++)
+         vertexCount = MAX2(vertexCount, ((const GLushort *)indices)[i] + 1u);
+   } else
+      for (GLsizei i = 0; i < count; i++)
+         vertexCount = MAX2(vertexCount, ((const GLuint *)indices)[i] + 1u);
+   Command * cmd = Record(deferred, CMD_DRAW_ELEMENTS,
+                          vertexCount * sizeof(*vertices) + count * indexBytes);
+   cmd->draw.mode = mode;
+   cmd->draw.type = type;
+   cmd->draw.count = count;
+   cmd->draw.vertexCount = vertexCount;
+   memcpy(cmd + 1, vertices, vertexCount * sizeof(*vertices));
+   memcpy((char *)(cmd + 1) + vertexCount * sizeof(*vertices), indices, count * indexBytes);
+}
+
+static void RasterTriangle(const GGLInterface * iface, const VertexOutput * v1,
+                           const VertexOutput * v2, const VertexOutput * v3)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   Command * cmd = Record(deferred, CMD_RASTER_TRIANGLE, 3 * sizeof(VertexOutput));
+   VertexOutput * v = (VertexOutput *)(cmd + 1);
+   v[0] = *v1;
+   v[1] = *v2;
+   v[2] = *v3;
+}
+
+static void RasterTrapezoid(const GGLInterface * iface, const VertexOutput * tl,
+                            const VertexOutput * tr, const VertexOutput * bl, const VertexOutput * br)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   Command * cmd = Record(deferred, CMD_RASTER_TRAPEZOID, 4 * sizeof(VertexOutput));
+   VertexOutput * v = (VertexOutput *)(cmd + 1);
+   v[0] = *tl;
+   v[1] = *tr;
+   v[2] = *bl;
+   v[3] = *br;
+}
+
+static void ScanLine(const GGLInterface * iface, const VertexOutput * v1, const VertexOutput * v2)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   Command * cmd = Record(deferred, CMD_SCAN_LINE, 2 * sizeof(VertexOutput));
+   VertexOutput * v = (VertexOutput *)(cmd + 1);
+   v[0] = *v1;
+   v[1] = *v2;
+}
+
+static void SetRasterThreads(GGLInterface * iface, unsigned count)
+{
+   RecordEnums(iface, CMD_SET_RASTER_THREADS, count);
+}
+
+static void GetStatistics(const GGLInterface * iface, GGLStatistics * stats)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   Sync(deferred);
+   deferred->iface->GetStatistics(deferred->iface, stats);
+}
+
+static void ResetStatistics(GGLInterface * iface)
+{
+   RecordEnums(iface, CMD_RESET_STATISTICS, 0);
+}
+
+static void EnableStatistics(GGLInterface * iface, GLboolean enable)
+{
+   RecordEnums(iface, CMD_ENABLE_STATISTICS, enable);
+}
+
+static gl_shader * ShaderCreate(const GGLInterface * iface, GLenum type)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   Sync(deferred);
+   gl_shader * shader = deferred->iface->ShaderCreate(deferred->iface, type);
+   SetOwner(deferred, shader);
+   return shader;
+}
+
+static void ShaderSource(gl_shader * shader, GLsizei count, const char ** string, const int * length)
+{
+   Deferred * deferred = GetOwner(shader);
+   Sync(deferred);
+   deferred->iface->ShaderSource(shader, count, string, length);
+}
+
+static GLboolean ShaderCompile(const GGLInterface * iface, gl_shader * shader,
+                               const char * glsl, const char ** infoLog)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   Sync(deferred);
+   return deferred->iface->ShaderCompile(deferred->iface, shader, glsl, infoLog);
+}
+
+static void ShaderDelete(const GGLInterface * iface, gl_shader * shader)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   Sync(deferred);
+   ClearOwner(deferred, shader);
+   deferred->iface->ShaderDelete(deferred->iface, shader);
+}
+
+static gl_shader_program * ShaderProgramCreate(const GGLInterface * iface)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   Sync(deferred);
+   gl_shader_program * program = deferred->iface->ShaderProgramCreate(deferred->iface);
+   SetOwner(deferred, program);
+   return program;
+}
+
+static void ShaderAttach(const GGLInterface * iface, gl_shader_program * program, gl_shader * shader)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   Sync(deferred);
+   deferred->iface->ShaderAttach(deferred->iface, program, shader);
+}
+
+static void ShaderDetach(const GGLInterface * iface, gl_shader_program * program, gl_shader * shader)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   Sync(deferred);
+   deferred->iface->ShaderDetach(deferred->iface, program, shader);
+}
+
+static GLboolean ShaderProgramLink(gl_shader_program * program, const char ** infoLog)
+{
+   Deferred * deferred = GetOwner(program);
+   Sync(deferred);
+   return deferred->iface->ShaderProgramLink(program, infoLog);
+}
+
+static void ShaderProgramDelete(GGLInterface * iface, gl_shader_program * program)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   ClearOwner(deferred, program);
+   Record(deferred, CMD_PROGRAM_DELETE)->program = program;
+}
+
+static void ShaderUse(GGLInterface * iface, gl_shader_program * program)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   Record(deferred, CMD_SHADER_USE)->program = program;
+}
+
+static void ShaderGetiv(const gl_shader * shader, const GLenum pname, GLint * params)
+{
+   Deferred * deferred = GetOwner(shader);
+   Sync(deferred);
+   deferred->iface->ShaderGetiv(shader, pname, params);
+}
+
+static void ShaderGetInfoLog(const gl_shader * shader, GLsizei bufsize, GLsizei * length, GLchar * infolog)
+{
+   Deferred * deferred = GetOwner(shader);
+   Sync(deferred);
+   deferred->iface->ShaderGetInfoLog(shader, bufsize, length, infolog);
+}
+
+static void ShaderProgramGetiv(const gl_shader_program * program, const GLenum pname, GLint * params)
+{
+   Deferred * deferred = GetOwner(program);
+   Sync(deferred);
+   deferred->iface->ShaderProgramGetiv(program, pname, params);
+}
+
+static void ShaderProgramGetInfoLog(const gl_shader_program * program, GLsizei bufsize,
+                                    GLsizei * length, GLchar * infolog)
+{
+   Deferred * deferred = GetOwner(program);
+   Sync(deferred);
+   deferred->iface->ShaderProgramGetInfoLog(program, bufsize, length, infolog);
+}
+
+static void ShaderAttributeBind(const gl_shader_program * program, GLuint index, const GLchar * name)
+{
+   Deferred * deferred = GetOwner(program);
+   Sync(deferred);
+   deferred->iface->ShaderAttributeBind(program, index, name);
+}
+
+static void ShaderUniformGetfv(gl_shader_program * program, GLint location, GLfloat * params)
+{
+   Deferred * deferred = GetOwner(program);
+   Sync(deferred);
+   deferred->iface->ShaderUniformGetfv(program, location, params);
+}
+
+static void ShaderUniformGetiv(gl_shader_program * program, GLint location, GLint * params)
+{
+   Deferred * deferred = GetOwner(program);
+   Sync(deferred);
+   deferred->iface->ShaderUniformGetiv(program, location, params);
+}
+
+static void ShaderUniformGetSamplers(const gl_shader_program * program,
+                                     int sampler2tmu[GGL_MAXCOMBINEDTEXTUREIMAGEUNITS])
+{
+   Deferred * deferred = GetOwner(program);
+   Sync(deferred);
+   deferred->iface->ShaderUniformGetSamplers(program, sampler2tmu);
+}
+
+static unsigned UniformBytes(const GLenum type, const GLsizei count)
+{
+   switch (type) {
+   case GL_FLOAT_VEC2:
+   case GL_INT_VEC2:
+   case GL_BOOL_VEC2:
+      return count * 2 * 4;
+   case GL_FLOAT_VEC3:
+   case GL_INT_VEC3:
+   case GL_BOOL_VEC3:
+      return count * 3 * 4;
+   case GL_FLOAT_VEC4:
+   case GL_INT_VEC4:
+   case GL_BOOL_VEC4:
+      return count * 4 * 4;
+   default:
+      return count * 4;
+   }
+}
+
+// values are copied, the return value matches GGLShaderUniform without waiting; uniform
+// declarations of a linked program do not change until it is relinked, which synchronizes
+static GLint ShaderUniform(gl_shader_program * program, GLint location, GLsizei count,
+                           const GLvoid * values, GLenum type)
+{
+   if (!program)
+      return -2;
+   if (-1 == location)
+      return -1;
+   assert(0 <= location && program->Uniforms->NumUniforms > location);
+   const unsigned bytes = UniformBytes(type, count);
+   Command * cmd = Record(GetOwner(program), CMD_UNIFORM, bytes);
+   cmd->uniform.program = program;
+   cmd->uniform.location = location;
+   cmd->uniform.count = count;
+   cmd->uniform.type = type;
+   memcpy(cmd + 1, values, bytes);
+   const gl_uniform & uniform = program->Uniforms->Uniforms[location];
+   return uniform.Type->is_sampler() ? uniform.Pos : -2;
+}
+
+static void ShaderUniformMatrix(gl_shader_program * program, GLint cols, GLint rows, GLint location,
+                                GLsizei count, GLboolean transpose, const GLfloat * values)
+{
+   if (-1 == location)
+      return;
+   // GGLShaderUniformMatrix reads columns 4 floats apart
+   const unsigned floats = count ? (cols * count - 1) * 4 + rows : 0;
+   Command * cmd = Record(GetOwner(program), CMD_UNIFORM_MATRIX, floats * sizeof(*values));
+   cmd->matrix.program = program;
+   cmd->matrix.cols = cols;
+   cmd->matrix.rows = rows;
+   cmd->matrix.location = location;
+   cmd->matrix.count = count;
+   cmd->matrix.transpose = transpose;
+   memcpy(cmd + 1, values, floats * sizeof(*values));
+}
+
+GGLInterface * CreateGGLDeferredInterface(GGLInterface * iface)
+{
+   Deferred * const deferred = new Deferred();
+   deferred->iface = iface;
+   deferred->recording.data = NULL;
+   deferred->recording.size = deferred->recording.capacity = 0;
+   deferred->busy = deferred->quit = false;
+   pthread_mutex_init(&deferred->lock, NULL);
+   pthread_cond_init(&deferred->submitCond, NULL);
+   pthread_cond_init(&deferred->idleCond, NULL);
+
+   // location queries only read linked program declarations, so are forwarded
+   GGLInterface & wrapper = deferred->interface;
+   wrapper = *iface;
+   wrapper.CullFace = CullFace;
+   wrapper.FrontFace = FrontFace;
+   wrapper.DepthRangef = DepthRangef;
+   wrapper.Viewport = Viewport;
+   wrapper.ViewportTransform = ViewportTransform;
+   wrapper.BlendColor = BlendColor;
+   wrapper.BlendEquationSeparate = BlendEquationSeparate;
+   wrapper.BlendFuncSeparate = BlendFuncSeparate;
+   wrapper.EnableDisable = EnableDisable;
+   wrapper.Scissor = Scissor;
+   wrapper.DepthFunc = DepthFunc;
+   wrapper.StencilFuncSeparate = StencilFuncSeparate;
+   wrapper.StencilOpSeparate = StencilOpSeparate;
+   wrapper.StencilSelect = StencilSelect;
+   wrapper.ClearStencil = ClearStencil;
+   wrapper.ClearColor = ClearColor;
+   wrapper.ClearDepthf = ClearDepthf;
+   wrapper.Clear = Clear;
+   wrapper.SetFastClear = SetFastClear;
+   wrapper.Flush = Flush;
+   wrapper.Finish = Finish;
+   wrapper.SetSampler = SetSampler;
+   wrapper.SetBuffer = SetBuffer;
+   wrapper.SetSamplerSurface = SetSamplerSurface;
+   wrapper.ProcessVertex = ProcessVertex;
+   wrapper.DrawTriangle = DrawTriangle;
+   wrapper.DrawArrays = DrawArrays;
+   wrapper.DrawElements = DrawElements;
+   wrapper.RasterTriangle = RasterTriangle;
+   wrapper.RasterTrapezoid = RasterTrapezoid;
+   wrapper.ScanLine = ScanLine;
+   wrapper.SetRasterThreads = SetRasterThreads;
+   wrapper.GetStatistics = GetStatistics;
+   wrapper.ResetStatistics = ResetStatistics;
+   wrapper.EnableStatistics = EnableStatistics;
+   wrapper.ShaderCreate = ShaderCreate;
+   wrapper.ShaderSource = ShaderSource;
+   wrapper.ShaderCompile = ShaderCompile;
+   wrapper.ShaderDelete = ShaderDelete;
+   wrapper.ShaderProgramCreate = ShaderProgramCreate;
+   wrapper.ShaderAttach = ShaderAttach;
+   wrapper.ShaderDetach = ShaderDetach;
+   wrapper.ShaderProgramLink = ShaderProgramLink;
+   wrapper.ShaderProgramDelete = ShaderProgramDelete;
+   wrapper.ShaderUse = ShaderUse;
+   wrapper.ShaderGetiv = ShaderGetiv;
+   wrapper.ShaderGetInfoLog = ShaderGetInfoLog;
+   wrapper.ShaderProgramGetiv = ShaderProgramGetiv;
+   wrapper.ShaderProgramGetInfoLog = ShaderProgramGetInfoLog;
+   wrapper.ShaderAttributeBind = ShaderAttributeBind;
+   wrapper.ShaderUniformGetfv = ShaderUniformGetfv;
+   wrapper.ShaderUniformGetiv = ShaderUniformGetiv;
+   wrapper.ShaderUniformGetSamplers = ShaderUniformGetSamplers;
+   wrapper.ShaderUniform = ShaderUniform;
+   wrapper.ShaderUniformMatrix = ShaderUniformMatrix;
+
+   if (pthread_create(&deferred->thread, NULL, RenderThread, deferred)) {
+      pthread_cond_destroy(&deferred->idleCond);
+      pthread_cond_destroy(&deferred->submitCond);
+      pthread_mutex_destroy(&deferred->lock);
+      delete deferred;
+      return NULL;
+   }
+   return &deferred->interface;
+}
+
+void DestroyGGLDeferredInterface(GGLInterface * iface)
+{
+   GGL_GET_DEFERRED(deferred, iface);
+   Submit(deferred);
+   pthread_mutex_lock(&deferred->lock);
+   deferred->quit = true;
+   pthread_cond_signal(&deferred->submitCond);
+   pthread_mutex_unlock(&deferred->lock);
+   pthread_join(deferred->thread, NULL);
+   pthread_mutex_lock(&ownersLock);
+   for (std::set<const void *>::const_iterator it = deferred->owned.begin(); it != deferred->owned.end(); ++it)
+      owners.erase(*it);
+   pthread_mutex_unlock(&ownersLock);
+
+   free(deferred->recording.data);
+   for (unsigned i = 0; i < deferred->spare.size(); i++)
+      free(deferred->spare[i].data);
+   pthread_cond_destroy(&deferred->idleCond);
+   pthread_cond_destroy(&deferred->submitCond);
+   pthread_mutex_destroy(&deferred->lock);
+   delete deferred;
+}
@@ -434,6 +434,7 @@ static FunctionType * ScanLineFunctionType(IRBuilder<> & builder)
    funcArgs.push_back(bytePointerType); // stencil
    funcArgs.push_back(bytePointerType); // stencil state
    funcArgs.push_back(intType); // count
+   funcArgs.push_back(intPointerType); // GGLStatistics
 
    FunctionType *functionType = FunctionType::get(/*Result=*/builder.getVoidTy(),
                                                   llvm::ArrayRef<Type*>(funcArgs),
@@ -442,11 +443,28 @@ static FunctionType * ScanLineFunctionType(IRBuilder<> & builder)
    return functionType;
 }
 
+// adds the fragment counter in counterPtr to field of GGLStatistics at stats
+static void AddStatistic(IRBuilder<> & builder, Value * stats, const unsigned field, Value * counterPtr)
+{
+   Value * counter = builder.CreateLoad(counterPtr);
+   Value * statPtr = builder.CreateConstInBoundsGEP1_32(stats, field / sizeof(unsigned));
+   // raster threads share stats, so add once per scanline
+   builder.CreateAtomicRMW(AtomicRMWInst::Add, statPtr, counter, SequentiallyConsistent);
+}
+
+static void Increment(IRBuilder<> & builder, Value * counterPtr)
+{
+   if (counterPtr)
+      builder.CreateStore(builder.CreateAdd(builder.CreateLoad(counterPtr), builder.getInt32(1)),
+                          counterPtr);
+}
+
 // generated scanline function parameters are VertexOutput * start, VertexOutput * step,
 // unsigned * frame, int * depth, unsigned char * stencil,
-// GGLActiveStencilState * stencilState, unsigned count
+// GGLActiveStencilState * stencilState, unsigned count, GGLStatistics * stats;
+// preShaded scanline does not count the shader it calls as shading
 void GenerateScanLine(const GGLState * gglCtx, const gl_shader_program * program, Module * mod,
-                      const char * shaderName, const char * scanlineName)
+                      const char * shaderName, const char * scanlineName, const bool preShaded)
 {
    IRBuilder<> builder(mod->getContext());
 //   debug_printf("GenerateScanLine %s \n", scanlineName);
@@ -486,6 +504,21 @@ void GenerateScanLine(const GGLState * gglCtx, const gl_shader_program * program
    stencilState->setName("stencilState");
    Value * countPtr = builder.CreateAlloca(intType);
    builder.CreateStore(args++, countPtr);
+   Value * stats = args++;
+   stats->setName("stats");
+
+   // fragment counters, only generated with statistics enabled
+   Value * shadedPtr = NULL, * discardedPtr = NULL, * sFailedPtr = NULL, * zFailedPtr = NULL;
+   Value * writtenPtr = NULL;
+   if (gglCtx->statistics) {
+      Value ** const counters[] = {&shadedPtr, &discardedPtr, &sFailedPtr, &zFailedPtr, &writtenPtr};
+      for (unsigned i = 0; i < sizeof(counters) / sizeof(*counters); i++) {
+         *counters[i] = builder.CreateAlloca(intType);
+         builder.CreateStore(builder.getInt32(0), *counters[i]);
+      }
+      if (preShaded)
+         shadedPtr = NULL;
+   }
 
    Value * sFace = NULL, * sRef = NULL, *sMask = NULL, * sFunc = NULL;
    if (gglCtx->bufferState.stencilTest) {
@@ -521,9 +554,13 @@ void GenerateScanLine(const GGLState * gglCtx, const gl_shader_program * program
 
    frame->setName("frame");
    Value * depth = NULL, * stencil = NULL;
+   const GGLPixelFormat depthFormat = gglCtx->bufferState.depthFormat;
    if (gglCtx->bufferState.depthTest) {
-      assert(GGL_PIXEL_FORMAT_Z_32 == gglCtx->bufferState.depthFormat);
       depth = builder.CreateLoad(depthPtr);
+      if (GGL_PIXEL_FORMAT_Z_16 == depthFormat)
+         depth = builder.CreateBitCast(depth, PointerType::get(builder.getInt16Ty(), 0));
+      else
+         assert(GGL_PIXEL_FORMAT_Z_32 == depthFormat || GGL_PIXEL_FORMAT_SZ_24 == depthFormat);
       depth->setName("depth");
    }
 
@@ -569,26 +606,51 @@ void GenerateScanLine(const GGLState * gglCtx, const gl_shader_program * program
    Value * depthZ = NULL, * zPtr = NULL, * z = NULL, * zCmp = NULL;
    if (gglCtx->bufferState.depthTest) {
       depthZ  = builder.CreateLoad(depth, "depthZ"); // z stored in buffer
-      zPtr = builder.CreateAlloca(intType); // temp store for modifying incoming z
-      zPtr->setName("zPtr");
+      if (GGL_PIXEL_FORMAT_Z_16 == depthFormat)
+         depthZ = builder.CreateZExt(depthZ, intType);
+      else if (GGL_PIXEL_FORMAT_SZ_24 == depthFormat)
+         depthZ = builder.CreateLShr(depthZ, builder.getInt32(8)); // stencil in low byte
 
-      // modified incoming z
-      z = builder.CreateBitCast(start, intPointerType);
-      z = builder.CreateConstInBoundsGEP1_32(z, (GGL_FS_INPUT_OFFSET +
-                                             GGL_FS_INPUT_FRAGCOORD_INDEX) * 4 + 2);
-      z = builder.CreateLoad(z, "z");
+      if (GGL_PIXEL_FORMAT_Z_32 == depthFormat) {
+         zPtr = builder.CreateAlloca(intType); // temp store for modifying incoming z
+         zPtr->setName("zPtr");
 
-      builder.CreateStore(z, zPtr);
+         // modified incoming z
+         z = builder.CreateBitCast(start, intPointerType);
+         z = builder.CreateConstInBoundsGEP1_32(z, (GGL_FS_INPUT_OFFSET +
+                                                GGL_FS_INPUT_FRAGCOORD_INDEX) * 4 + 2);
+         z = builder.CreateLoad(z, "z");
 
-      Value * zNegative = builder.CreateICmpSLT(z, builder.getInt32(0));
-      condBranch.ifCond(zNegative);
-      // if (0x80000000 & z) z ^= 0x7fffffff since smaller -ve float means bigger -ve int
-      z = builder.CreateXor(z, builder.getInt32(0x7fffffff));
-      builder.CreateStore(z, zPtr);
+         builder.CreateStore(z, zPtr);
 
-      condBranch.endif();
+         Value * zNegative = builder.CreateICmpSLT(z, builder.getInt32(0));
+         condBranch.ifCond(zNegative);
+         // if (0x80000000 & z) z ^= 0x7fffffff since smaller -ve float means bigger -ve int
+         z = builder.CreateXor(z, builder.getInt32(0x7fffffff));
+         builder.CreateStore(z, zPtr);
+
+         condBranch.endif();
 
-      z = builder.CreateLoad(zPtr, "z");
+         z = builder.CreateLoad(zPtr, "z");
+      } else { // unsigned normalized z = clamp(z, 0, 1) * max + 0.5, compares same signed
+         Type * floatType = builder.getFloatTy();
+         z = builder.CreateBitCast(start, PointerType::get(floatType, 0));
+         z = builder.CreateConstInBoundsGEP1_32(z, (GGL_FS_INPUT_OFFSET +
+                                                GGL_FS_INPUT_FRAGCOORD_INDEX) * 4 + 2);
+         z = builder.CreateLoad(z, "z");
+         Value * zero = ConstantFP::get(floatType, 0.0), * one = ConstantFP::get(floatType, 1.0);
+         z = builder.CreateSelect(builder.CreateFCmpOLT(z, zero), zero, z);
+         z = builder.CreateSelect(builder.CreateFCmpOGT(z, one), one, z);
+         // float can't hold 0xffffff + 0.5, so scale in double and clamp
+         const unsigned max = GGL_PIXEL_FORMAT_Z_16 == depthFormat ? 0xffff : 0xffffff;
+         Type * doubleType = builder.getDoubleTy();
+         z = builder.CreateFPExt(z, doubleType);
+         z = builder.CreateFMul(z, ConstantFP::get(doubleType, max));
+         z = builder.CreateFAdd(z, ConstantFP::get(doubleType, 0.5));
+         z = builder.CreateFPToUI(z, intType);
+         Value * zMax = builder.getInt32(max);
+         z = builder.CreateSelect(builder.CreateICmpUGT(z, zMax), zMax, z, "z");
+      }
 
       switch (0x200 | gglCtx->bufferState.depthFunc) {
       case GL_NEVER:
@@ -623,9 +685,6 @@ void GenerateScanLine(const GGLState * gglCtx, const gl_shader_program * program
       zCmp = ConstantInt::getTrue(mod->getContext());
    zCmp->setName("zCmp");
 
-   condBranch.ifCond(sCmp, "if_sCmp", "sCmp_fail");
-   condBranch.ifCond(zCmp, "if_zCmp", "zCmp_fail");
-
    Value * inputs = start;
    Value * outputs = start;
 
@@ -634,9 +693,33 @@ void GenerateScanLine(const GGLState * gglCtx, const gl_shader_program * program
 
    Function * fsFunction = mod->getFunction(shaderName);
    assert(fsFunction);
-   CallInst *call = builder.CreateCall3(fsFunction,inputs, outputs, constants);
-   call->setCallingConv(CallingConv::C);
-   call->setTailCall(false);
+   CallInst *call = NULL;
+
+   // early z: shader only runs for fragments passing stencil and depth tests;
+   // otherwise shader runs first, and discarded fragments change no buffer
+   const bool earlyZ = !program->UsesDiscard;
+   if (!earlyZ) {
+      Value * discardPtr = builder.CreateConstInBoundsGEP1_32(start, GGL_FS_OUTPUT_DISCARD_INDEX);
+      discardPtr = builder.CreateBitCast(discardPtr, PointerType::get(builder.getFloatTy(), 0));
+      builder.CreateStore(ConstantFP::get(builder.getFloatTy(), 0.0), discardPtr);
+      call = builder.CreateCall3(fsFunction, inputs, outputs, constants);
+      call->setCallingConv(CallingConv::C);
+      call->setTailCall(false);
+      Increment(builder, shadedPtr);
+      Value * discarded = builder.CreateLoad(discardPtr, "discard");
+      condBranch.ifCond(builder.CreateFCmpOEQ(discarded, ConstantFP::get(builder.getFloatTy(), 0.0)),
+                        "if_not_discard", "discarded");
+   }
+
+   condBranch.ifCond(sCmp, "if_sCmp", "sCmp_fail");
+   condBranch.ifCond(zCmp, "if_zCmp", "zCmp_fail");
+
+   if (earlyZ) {
+      call = builder.CreateCall3(fsFunction,inputs, outputs, constants);
+      call->setCallingConv(CallingConv::C);
+      call->setTailCall(false);
+      Increment(builder, shadedPtr);
+   }
 
    Value * dst = Constant::getNullValue(intVecType(builder));
    if (gglCtx->blendState.enable && (0 != gglCtx->blendState.dcf || 0 != gglCtx->blendState.daf)) {
@@ -649,9 +732,16 @@ void GenerateScanLine(const GGLState * gglCtx, const gl_shader_program * program
 
    Value * color = GenerateFSBlend(gglCtx, gglCtx->bufferState.colorFormat,/*&prog->outputRegDesc,*/ builder, src, dst);
    builder.CreateStore(color, frame);
+   Increment(builder, writtenPtr);
    // TODO DXL depthmask check
    if (gglCtx->bufferState.depthTest) {
       z = builder.CreateBitCast(z, intType);
+      if (GGL_PIXEL_FORMAT_Z_16 == depthFormat)
+         z = builder.CreateTrunc(z, builder.getInt16Ty());
+      else if (GGL_PIXEL_FORMAT_SZ_24 == depthFormat) { // keep stencil, stored after depth
+         Value * s8 = builder.CreateAnd(builder.CreateLoad(depth), builder.getInt32(0xff));
+         z = builder.CreateOr(builder.CreateShl(z, builder.getInt32(8)), s8);
+      }
       builder.CreateStore(z, depth); // store z
    }
 
@@ -660,18 +750,27 @@ void GenerateScanLine(const GGLState * gglCtx, const gl_shader_program * program
                                     gglCtx->backStencil.dPass, sPtr, sRef), stencil);
 
    condBranch.elseop(); // failed z test
+   Increment(builder, zFailedPtr);
 
    if (gglCtx->bufferState.stencilTest)
       builder.CreateStore(StencilOp(builder, sFace, gglCtx->frontStencil.dFail,
                                     gglCtx->backStencil.dFail, sPtr, sRef), stencil);
    condBranch.endif();
    condBranch.elseop(); // failed s test
+   Increment(builder, sFailedPtr);
 
    if (gglCtx->bufferState.stencilTest)
       builder.CreateStore(StencilOp(builder, sFace, gglCtx->frontStencil.sFail,
                                     gglCtx->backStencil.sFail, sPtr, sRef), stencil);
 
    condBranch.endif();
+   if (!earlyZ) {
+      if (discardedPtr) {
+         condBranch.elseop(); // discarded
+         Increment(builder, discardedPtr);
+      }
+      condBranch.endif(); // discarded
+   }
    assert(frame);
    frame = builder.CreateConstInBoundsGEP1_32(frame, 1); // frame++
    // frame may have been casted to short* from int*, so cast back
@@ -679,10 +778,14 @@ void GenerateScanLine(const GGLState * gglCtx, const gl_shader_program * program
    builder.CreateStore(frame, framePtr);
    if (gglCtx->bufferState.depthTest) {
       depth = builder.CreateConstInBoundsGEP1_32(depth, 1); // depth++
+      // depth may have been casted to short* from int*, so cast back
+      depth = builder.CreateBitCast(depth, intPointerType);
       builder.CreateStore(depth, depthPtr);
    }
    if (gglCtx->bufferState.stencilTest) {
-      stencil = builder.CreateConstInBoundsGEP1_32(stencil, 1); // stencil++
+      // SZ_8 stencil is the low byte of each packed depth stencil word
+      const unsigned stencilStep = GGL_PIXEL_FORMAT_SZ_8 == gglCtx->bufferState.stencilFormat ? 4 : 1;
+      stencil = builder.CreateConstInBoundsGEP1_32(stencil, stencilStep); // stencil++
       builder.CreateStore(stencil, stencilPtr);
    }
    Value * vPtr = NULL, * v = NULL, * dx = NULL;
@@ -736,5 +839,33 @@ void GenerateScanLine(const GGLState * gglCtx, const gl_shader_program * program
 
    condBranch.endLoop();
 
+   if (gglCtx->statistics) {
+      if (shadedPtr)
+         AddStatistic(builder, stats, offsetof(GGLStatistics, fragmentsShaded), shadedPtr);
+      AddStatistic(builder, stats, offsetof(GGLStatistics, fragmentsDiscarded), discardedPtr);
+      AddStatistic(builder, stats, offsetof(GGLStatistics, stencilFailed), sFailedPtr);
+      AddStatistic(builder, stats, offsetof(GGLStatistics, depthFailed), zFailedPtr);
+      AddStatistic(builder, stats, offsetof(GGLStatistics, pixelsWritten), writtenPtr);
+   }
+
    builder.CreateRetVoid();
 }
+
+// scanline for fragments already shaded by the SoA quad shader, fragColor is in start;
+// the shader it calls only returns, so it does the stencil and depth tests, blend and write
+void GenerateQuadScanLine(const GGLState * gglCtx, const gl_shader_program * program, Module * mod,
+                          const char * scanlineName)
+{
+   IRBuilder<> builder(mod->getContext());
+   std::string shaderName(scanlineName);
+   shaderName += "shaded";
+   if (!mod->getFunction(shaderName)) {
+      PointerType * vecPtrTy = PointerType::get(floatVecType(builder), 0);
+      std::vector<Type*> params(3, vecPtrTy); // inputs, outputs, constants
+      FunctionType * type = FunctionType::get(builder.getVoidTy(), params, false);
+      Function * shader = Function::Create(type, GlobalValue::InternalLinkage, shaderName, mod);
+      builder.SetInsertPoint(BasicBlock::Create(builder.getContext(), "entry", shader));
+      builder.CreateRetVoid();
+   }
+   GenerateScanLine(gglCtx, program, mod, shaderName.c_str(), scanlineName, true);
+}
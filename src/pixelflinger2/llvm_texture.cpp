@@ -28,7 +28,9 @@ using namespace llvm;
 
 // texture data is int pointer to surface (will cast to short for 16bpp), index is linear texel index,
 // format is GGLPixelFormat for surface, return type is <4 x i32> rgba
-static Value * pointSample(IRBuilder<> & builder, Value * textureData, Value * index, const GGLPixelFormat format)
+// texel at index as i32 0xAABBGGRR
+static Value * packedTexel(IRBuilder<> & builder, Value * textureData, Value * index,
+                           const GGLPixelFormat format)
 {
    Value * texel = NULL;
    switch (format) {
@@ -65,6 +67,34 @@ static Value * pointSample(IRBuilder<> & builder, Value * textureData, Value * i
       texel = builder.CreateOr(texel, builder.getInt32(0xff000000), name("texel"));
       break;
    }
+   case GGL_PIXEL_FORMAT_RGBA_4444: { // r in the top nibble, a in the bottom one
+      textureData = builder.CreateBitCast(textureData, PointerType::get(builder.getInt16Ty(), 0));
+      textureData = builder.CreateGEP(textureData, index);
+      texel = builder.CreateLoad(textureData, "texel4444");
+      texel = builder.CreateZExt(texel, builder.getInt32Ty());
+      Value * r = builder.CreateAnd(builder.CreateLShr(texel, 12), builder.getInt32(0xf));
+      Value * g = builder.CreateAnd(texel, builder.getInt32(0xf00));
+      Value * b = builder.CreateAnd(builder.CreateShl(texel, 12), builder.getInt32(0xf0000));
+      Value * a = builder.CreateShl(builder.CreateAnd(texel, builder.getInt32(0xf)), 24);
+      texel = builder.CreateOr(builder.CreateOr(r, g), builder.CreateOr(b, a));
+      texel = builder.CreateOr(texel, builder.CreateShl(texel, 4), name("texel")); // n * 17 in each byte
+      break;
+   }
+   case GGL_PIXEL_FORMAT_RGBA_5551: { // r in the top 5 bits, a in bit 0
+      textureData = builder.CreateBitCast(textureData, PointerType::get(builder.getInt16Ty(), 0));
+      textureData = builder.CreateGEP(textureData, index);
+      texel = builder.CreateLoad(textureData, "texel5551");
+      texel = builder.CreateZExt(texel, builder.getInt32Ty());
+      Value * r = builder.CreateAnd(builder.CreateLShr(texel, 11), builder.getInt32(0x1f));
+      Value * g = builder.CreateAnd(builder.CreateShl(texel, 2), builder.getInt32(0x1f00));
+      Value * b = builder.CreateAnd(builder.CreateShl(texel, 15), builder.getInt32(0x1f0000));
+      Value * rgb = builder.CreateOr(r, builder.CreateOr(g, b));
+      rgb = builder.CreateOr(builder.CreateShl(rgb, 3),
+                             builder.CreateAnd(builder.CreateLShr(rgb, 2), builder.getInt32(0x070707)));
+      Value * a = builder.CreateShl(builder.CreateNeg(builder.CreateAnd(texel, builder.getInt32(1))), 24);
+      texel = builder.CreateOr(rgb, a, name("texel"));
+      break;
+   }
    case GGL_PIXEL_FORMAT_A_8: {
       textureData = builder.CreateBitCast(textureData, PointerType::get(builder.getInt8Ty(),0));
       textureData = builder.CreateGEP(textureData, index);
@@ -95,6 +125,22 @@ static Value * pointSample(IRBuilder<> & builder, Value * textureData, Value * i
       texel = builder.CreateOr(texel, builder.CreateShl(alpha, 16));
       break;
    }
+   case GGL_PIXEL_FORMAT_ETC1: { // blocks are decoded and cached by texture.cpp
+      llvm::Module * module = builder.GetInsertBlock()->getParent()->getParent();
+      Type * bytePointerType = PointerType::get(builder.getInt8Ty(), 0);
+      Function * function = module->getFunction("GGLSampleETC1");
+      if (!function) {
+         std::vector<Type *> args;
+         args.push_back(bytePointerType);
+         args.push_back(builder.getInt32Ty());
+         FunctionType * type = FunctionType::get(builder.getInt32Ty(), ArrayRef<Type *>(args), false);
+         function = Function::Create(type, GlobalValue::ExternalLinkage, "GGLSampleETC1", module);
+         function->setCallingConv(CallingConv::C);
+      }
+      textureData = builder.CreateBitCast(textureData, bytePointerType);
+      texel = builder.CreateCall2(function, textureData, index, "texel_etc1");
+      break;
+   }
    case GGL_PIXEL_FORMAT_UNKNOWN: // usually means texture not set yet
       ALOGD("pf2: pointSample: unknown format, default to 0xffff00ff \n");
       texel = builder.getInt32(0xffff00ff);
@@ -103,6 +149,13 @@ static Value * pointSample(IRBuilder<> & builder, Value * textureData, Value * i
       assert(0);
       break;
    }
+   return texel;
+}
+
+// returns <4 x i32> rgba
+static Value * pointSample(IRBuilder<> & builder, Value * textureData, Value * index, const GGLPixelFormat format)
+{
+   Value * texel = packedTexel(builder, textureData, index, format);
    Value * channels = Constant::getNullValue(intVecType(builder));
 
 //   if (dstDesc && dstDesc->IsInt32Color()) {
@@ -139,87 +192,120 @@ static Value * pointSample(IRBuilder<> & builder, Value * textureData, Value * i
 
 static const unsigned SHIFT = 16;
 
-// w  = width - 1, h = height - 1; similar to pointSample; returns <4 x i32> rgba
+// rounds up to whole 4x4 tiles of GGL_TILED_LAYOUT
+static Value * tilePadded(IRBuilder<> & builder, Value * size)
+{
+   return builder.CreateAnd(builder.CreateAdd(size, builder.getInt32(3)), builder.getInt32(~3));
+}
+
+// linear texel index of x, y for texture layout, see GGLTexture::GGLTextureLayout;
+// widthShift is log2 of a power-of-2 width, or NULL
+static Value * texelIndex(IRBuilder<> & builder, const unsigned layout, Value * x, Value * y,
+                          Value * width, Value * widthShift)
+{
+   if (GGLTexture::GGL_LINEAR_LAYOUT == layout)
+      return builder.CreateAdd(widthShift ? builder.CreateShl(y, widthShift) : builder.CreateMul(y, width), x);
+   assert(GGLTexture::GGL_TILED_LAYOUT == layout);
+   // (y / 4) * tilesPerRow * 16 + (x / 4) * 16 + (y % 4) * 4 + x % 4
+   Value * index = builder.CreateAnd(y, builder.getInt32(~3));
+   if (widthShift) // widths below 4 are padded to a tile
+      index = builder.CreateShl(index, maxIntScalar(builder, widthShift, builder.getInt32(2)));
+   else
+      index = builder.CreateMul(index, tilePadded(builder, width));
+   index = builder.CreateAdd(index, builder.CreateShl(builder.CreateAnd(x, builder.getInt32(~3)),
+                             builder.getInt32(2)));
+   index = builder.CreateAdd(index, builder.CreateShl(builder.CreateAnd(y, builder.getInt32(3)),
+                             builder.getInt32(2)));
+   return builder.CreateAdd(index, builder.CreateAnd(x, builder.getInt32(3)), name("texelIndex"));
+}
+
+// <count x i16> of scalar in every lane
+static Value * splat16(IRBuilder<> & builder, Value * scalar, const unsigned count)
+{
+   VectorType * type = VectorType::get(builder.getInt16Ty(), count);
+   Value * vec = builder.CreateInsertElement(UndefValue::get(type), scalar, builder.getInt32(0));
+   return builder.CreateShuffleVector(vec, UndefValue::get(type),
+                                      Constant::getNullValue(VectorType::get(builder.getInt32Ty(), count)));
+}
+
+// (a * (256 - weight) + b * weight + 128) >> 8 in i16 lanes, at most 255 * 256 + 128 before the shift
+static Value * lerp16(IRBuilder<> & builder, Value * a, Value * b, Value * weight)
+{
+   const unsigned count = ((VectorType *)a->getType())->getNumElements();
+   Value * sum = builder.CreateMul(a, builder.CreateSub(splat16(builder, builder.getInt16(256), count), weight));
+   sum = builder.CreateAdd(sum, builder.CreateMul(b, weight));
+   sum = builder.CreateAdd(sum, splat16(builder, builder.getInt16(128), count));
+   return builder.CreateLShr(sum, splat16(builder, builder.getInt16(8), count));
+}
+
+// SHIFT fraction bits rounded to an 8 bit weight in [0, 256], as i16
+static Value * weight16(IRBuilder<> & builder, Value * lerp)
+{
+   lerp = builder.CreateAdd(lerp, builder.getInt32(1 << (SHIFT - 9)));
+   return builder.CreateTrunc(builder.CreateLShr(lerp, builder.getInt32(SHIFT - 8)), builder.getInt16Ty());
+}
+
+// blends packed texels s0 s1 (top row) and s3 s2 (bottom row); both rows are lerped together in
+// <8 x i16> with one broadcast weight, then the two halves; returns <4 x i32> rgba
+static Value * bilinear16(IRBuilder<> & builder, Value * s0, Value * s1, Value * s2, Value * s3,
+                          Value * xLerp, Value * yLerp)
+{
+   VectorType * pairType = VectorType::get(builder.getInt32Ty(), 2);
+   VectorType * bytesType = VectorType::get(builder.getInt8Ty(), 8);
+   VectorType * wordsType = VectorType::get(builder.getInt16Ty(), 8);
+
+   Value * left = builder.CreateInsertElement(UndefValue::get(pairType), s0, builder.getInt32(0));
+   left = builder.CreateInsertElement(left, s3, builder.getInt32(1));
+   left = builder.CreateZExt(builder.CreateBitCast(left, bytesType), wordsType);
+   Value * right = builder.CreateInsertElement(UndefValue::get(pairType), s1, builder.getInt32(0));
+   right = builder.CreateInsertElement(right, s2, builder.getInt32(1));
+   right = builder.CreateZExt(builder.CreateBitCast(right, bytesType), wordsType);
+
+   Value * rows = lerp16(builder, left, right, splat16(builder, weight16(builder, xLerp), 8));
+
+   std::vector<Constant *> lanes(4);
+   for (unsigned i = 0; i < 4; i++)
+      lanes[i] = builder.getInt32(i);
+   Value * top = builder.CreateShuffleVector(rows, UndefValue::get(wordsType), ConstantVector::get(lanes));
+   for (unsigned i = 0; i < 4; i++)
+      lanes[i] = builder.getInt32(i + 4);
+   Value * bottom = builder.CreateShuffleVector(rows, UndefValue::get(wordsType), ConstantVector::get(lanes));
+
+   Value * sample = lerp16(builder, top, bottom, splat16(builder, weight16(builder, yLerp), 4));
+   return builder.CreateZExt(sample, intVecType(builder), name("bilinear"));
+}
+
+// w  = width - 1, h = height - 1; similar to pointSample; returns <4 x i32> rgba;
+// widthShift is log2 of a power-of-2 width, or NULL
 static Value * linearSample(IRBuilder<> & builder, Value * textureData, Value * indexOffset,
                             Value * x0, Value * y0, Value * xLerp, Value * yLerp,
-                            Value * w, Value * h,  Value * width, Value * height,
-                            const GGLPixelFormat format/*, const RegDesc * dstDesc*/)
+                            Value * w, Value * h,  Value * width, Value * widthShift,
+                            const GGLTexture & texture/*, const RegDesc * dstDesc*/)
 {
    // TODO: linear filtering needs to be fixed for texcoord outside of [0,1]
    Value * x1 = builder.CreateAdd(x0, builder.getInt32(1));
    x1 = minIntScalar(builder, x1, w);
    Value * y1 = builder.CreateAdd(y0, builder.getInt32(1));
    y1 = minIntScalar(builder, y1, h);
-
-//   RegDesc regDesc;
-//   regDesc.SetVectorType(Fixed8);
-
-   Value * index = builder.CreateMul(y0, width);
-   index = builder.CreateAdd(index, x0);
-   index = builder.CreateAdd(index, indexOffset);
-   Value * s0 = pointSample(builder, textureData, index, format/*, &regDesc*/);
-//   s0 = builder.CreateBitCast(s0, intVecType(builder));
-
-   index = builder.CreateMul(y0, width);
-   index = builder.CreateAdd(index, x1);
-   index = builder.CreateAdd(index, indexOffset);
-   Value * s1 = pointSample(builder, textureData, index, format/*, &regDesc*/);
-//   s1 = builder.CreateBitCast(s1, intVecType(builder));
-
-   index = builder.CreateMul(y1, width);
-   index = builder.CreateAdd(index, x1);
-   index = builder.CreateAdd(index, indexOffset);
-   Value * s2 = pointSample(builder, textureData, index, format/*, &regDesc*/);
-//   s2 = builder.CreateBitCast(s2, intVecType(builder));
-
-   index = builder.CreateMul(y1, width);
-   index = builder.CreateAdd(index, x0);
-   index = builder.CreateAdd(index, indexOffset);
-   Value * s3 = pointSample(builder, textureData, index, format/*, &regDesc*/);
-//   s3 = builder.CreateBitCast(s3, intVecType(builder));
-
-   Value * xLerpVec = intVec(builder, xLerp, xLerp, xLerp, xLerp);
-
-   Value * h0 = builder.CreateMul(builder.CreateSub(s1, s0), xLerpVec);
-   // arithmetic shift right, since it's the result of subtraction, which could be negative
-   h0 = builder.CreateAShr(h0, constIntVec(builder, SHIFT, SHIFT, SHIFT, SHIFT));
-   h0 = builder.CreateAdd(h0, s0);
-
-   Value * h1 = builder.CreateMul(builder.CreateSub(s2, s3), xLerpVec);
-   h1 = builder.CreateAShr(h1, constIntVec(builder, SHIFT, SHIFT, SHIFT, SHIFT));
-   h1 = builder.CreateAdd(h1, s3);
-
-   Value * sample = builder.CreateMul(builder.CreateSub(h1, h0),
-                                      intVec(builder, yLerp, yLerp, yLerp, yLerp));
-   sample = builder.CreateAShr(sample, constIntVec(builder, SHIFT, SHIFT, SHIFT, SHIFT));
-   sample = builder.CreateAdd(sample, h0);
-
-   return sample;
-//   if (!dstDesc || dstDesc->IsVectorType(Float)) {
-//      sample = builder.CreateUIToFP(sample, floatVecType(builder));
-//      return builder.CreateFMul(sample, constFloatVec(builder, 1 / 255.0f,  1 / 255.0f,
-//                                1 / 255.0f, 1 / 255.0f));
-//   } else if (dstDesc && dstDesc->IsVectorType(Fixed16)) {
-//      sample = builder.CreateShl(sample, constIntVec(builder, 8, 8, 8, 8));
-//      return builder.CreateBitCast(sample, floatVecType(builder));
-//   } else if (dstDesc && dstDesc->IsVectorType(Fixed8))
-//      return builder.CreateBitCast(sample, floatVecType(builder));
-//   else if (dstDesc && dstDesc->IsInt32Color()) {
-//      sample = builder.CreateShl(sample, constIntVec(builder, 0, 8, 16, 24));
-//      std::vector<llvm::Value*> samples = extractVector(sample);
-//      samples[0] = builder.CreateOr(samples[0], samples[1]);
-//      samples[0] = builder.CreateOr(samples[0], samples[2]);
-//      samples[0] = builder.CreateOr(samples[0], samples[3]);
-//      sample = builder.CreateInsertElement(sample, samples[0], builder.getInt32(0));
-//      return builder.CreateBitCast(sample, floatVecType(builder));
-//   } else
-//      assert(0);
+   const GGLPixelFormat format = texture.format;
+   const unsigned layout = texture.layout;
+
+   Value * index = texelIndex(builder, layout, x0, y0, width, widthShift);
+   Value * s0 = packedTexel(builder, textureData, builder.CreateAdd(index, indexOffset), format);
+   index = texelIndex(builder, layout, x1, y0, width, widthShift);
+   Value * s1 = packedTexel(builder, textureData, builder.CreateAdd(index, indexOffset), format);
+   index = texelIndex(builder, layout, x1, y1, width, widthShift);
+   Value * s2 = packedTexel(builder, textureData, builder.CreateAdd(index, indexOffset), format);
+   index = texelIndex(builder, layout, x0, y1, width, widthShift);
+   Value * s3 = packedTexel(builder, textureData, builder.CreateAdd(index, indexOffset), format);
+
+   return bilinear16(builder, s0, s1, s2, s3, xLerp, yLerp);
 }
 
-// dim is size - 1, since [0.0f,1.0f]->[0, size - 1]
+// dim is size - 1, since [0.0f,1.0f]->[0, size - 1]; shift is log2 of a power-of-2 size, or NULL
 static Value * texcoordWrap(IRBuilder<> & builder, const unsigned wrap,
                             /*const ChannelType type,*/ Value * r, Value * size, Value * dim,
-                            Value ** texelLerp)
+                            Value * shift, Value ** texelLerp)
 {
    Type * intType = Type::getInt32Ty(builder.getContext());
    Value * tc = NULL;
@@ -241,7 +327,10 @@ static Value * texcoordWrap(IRBuilder<> & builder, const unsigned wrap,
    if (0 == wrap || 2 == wrap) // just the mantissa for wrap and mirrored
       tc = builder.CreateAnd(tc, builder.getInt32((1 << SHIFT) - 1));
 
-   tc = builder.CreateMul(tc, dim);
+   if (shift) // tc * (size - 1)
+      tc = builder.CreateSub(builder.CreateShl(tc, shift), tc);
+   else
+      tc = builder.CreateMul(tc, dim);
 
    *texelLerp = builder.CreateAnd(tc, builder.getInt32((1 << SHIFT) - 1));
 
@@ -271,9 +360,111 @@ static Value * texcoordWrap(IRBuilder<> & builder, const unsigned wrap,
    return tc;
 }
 
+// width, height and for power-of-2 textures their log2, otherwise NULL
+struct LevelSize {
+   Value * width, * height, * widthShift, * heightShift;
+};
+
+// samples a level of size texels at indexOffset, filter is GGL_NEAREST or GGL_LINEAR;
+// returns <4 x i32> rgba
+static Value * sampleLevel(IRBuilder<> & builder, Value * textureData, Value * indexOffset,
+                           Value * s, Value * t, const LevelSize & size,
+                           const GGLTexture & texture, const unsigned filter)
+{
+   Value * w = builder.CreateSub(size.width, builder.getInt32(1));
+   Value * h = builder.CreateSub(size.height, builder.getInt32(1));
+   Value * xLerp = NULL, * yLerp = NULL;
+   Value * x = texcoordWrap(builder, texture.wrapS, s, size.width, w, size.widthShift, &xLerp);
+   Value * y = texcoordWrap(builder, texture.wrapT, t, size.height, h, size.heightShift, &yLerp);
+   if (GGLTexture::GGL_NEAREST == filter) {
+      Value * index = texelIndex(builder, texture.layout, x, y, size.width, size.widthShift);
+      index = builder.CreateAdd(index, indexOffset);
+      return pointSample(builder, textureData, index, texture.format);
+   }
+   assert(GGLTexture::GGL_LINEAR == filter);
+   return linearSample(builder, textureData, indexOffset, x, y, xLerp, yLerp, w, h, size.width,
+                       size.widthShift, texture);
+}
+
+static Value * textureStateGlobal(IRBuilder<> & builder, const char * name)
+{
+   llvm::Module * module = builder.GetInsertBlock()->getParent()->getParent();
+   Value * global = module->getGlobalVariable(name);
+   if (!global)
+      global = new GlobalVariable(*module, builder.getInt32Ty(), true,
+                                  GlobalValue::ExternalLinkage, NULL, name);
+   return global;
+}
+
+// samples mipmap level, its dimensions are those of level 0 shifted, but at least 1
+static Value * sampleMipmap(IRBuilder<> & builder, Value * textureData, const unsigned sampler,
+                            Value * level, Value * s, Value * t, const LevelSize & size0,
+                            const GGLTexture & texture, const unsigned filter)
+{
+   Value * offset = textureStateGlobal(builder, _PF2_TEXTURE_LEVELS_NAME_);
+   offset = builder.CreateGEP(offset, builder.CreateAdd(level, builder.getInt32(sampler * GGL_MAXTEXTURELEVELS)));
+   offset = builder.CreateLoad(offset, name("levelOffset"));
+   LevelSize size = size0;
+   size.width = maxIntScalar(builder, builder.CreateLShr(size0.width, level), builder.getInt32(1));
+   size.height = maxIntScalar(builder, builder.CreateLShr(size0.height, level), builder.getInt32(1));
+   if (size0.widthShift) {
+      size.widthShift = maxIntScalar(builder, builder.CreateSub(size0.widthShift, level), builder.getInt32(0));
+      size.heightShift = maxIntScalar(builder, builder.CreateSub(size0.heightShift, level), builder.getInt32(0));
+   }
+   return sampleLevel(builder, textureData, offset, s, t, size, texture, filter);
+}
+
+// level 0 size of sampler; power-of-2 textures with GGLTexture::constantSize have it in the
+// shader key, so it is jitted as constants
+static LevelSize textureSize(IRBuilder<> & builder, const unsigned sampler, const GGLState * gglCtx)
+{
+   const GGLTexture & texture = gglCtx->textureState.textures[sampler];
+   LevelSize size = {NULL, NULL, NULL, NULL};
+   if (IsPowerOf2Texture(texture) && texture.constantSize) {
+      size.width = builder.getInt32(texture.width);
+      size.height = builder.getInt32(texture.height);
+      size.widthShift = builder.getInt32(gglCtx->textureState.textureShifts[sampler * 2]);
+      size.heightShift = builder.getInt32(gglCtx->textureState.textureShifts[sampler * 2 + 1]);
+      return size;
+   }
+   Value * textureDimensions = textureStateGlobal(builder, _PF2_TEXTURE_DIMENSIONS_NAME_);
+   size.width = builder.CreateConstInBoundsGEP1_32(textureDimensions, sampler * 2);
+   size.width = builder.CreateLoad(size.width, name("textureWidth"));
+   size.height = builder.CreateConstInBoundsGEP1_32(textureDimensions, sampler * 2 + 1);
+   size.height = builder.CreateLoad(size.height, name("textureHeight"));
+   if (IsPowerOf2Texture(texture)) {
+      Value * textureShifts = textureStateGlobal(builder, _PF2_TEXTURE_SHIFTS_NAME_);
+      size.widthShift = builder.CreateConstInBoundsGEP1_32(textureShifts, sampler * 2);
+      size.widthShift = builder.CreateLoad(size.widthShift, name("textureWidthShift"));
+      size.heightShift = builder.CreateConstInBoundsGEP1_32(textureShifts, sampler * 2 + 1);
+      size.heightShift = builder.CreateLoad(size.heightShift, name("textureHeightShift"));
+   }
+   return size;
+}
+
+// lambda from texcoord derivatives <dsdx, dtdx, dsdy, dtdy> in level 0 texels;
+// log2 is approximated by the float bits, exact at powers of 2 and off by at most 0.05
+static Value * levelOfDetail(IRBuilder<> & builder, Value * derivatives, Value * width, Value * height)
+{
+   std::vector<Value * > d = extractVector(builder, derivatives);
+   Value * fw = builder.CreateUIToFP(width, builder.getFloatTy());
+   Value * fh = builder.CreateUIToFP(height, builder.getFloatTy());
+   Value * dsdx = builder.CreateFMul(d[0], fw), * dtdx = builder.CreateFMul(d[1], fh);
+   Value * dsdy = builder.CreateFMul(d[2], fw), * dtdy = builder.CreateFMul(d[3], fh);
+   Value * rx = builder.CreateFAdd(builder.CreateFMul(dsdx, dsdx), builder.CreateFMul(dtdx, dtdx));
+   Value * ry = builder.CreateFAdd(builder.CreateFMul(dsdy, dsdy), builder.CreateFMul(dtdy, dtdy));
+   Value * rho2 = builder.CreateSelect(builder.CreateFCmpOGT(rx, ry), rx, ry);
+   // log2(rho) = log2(rho^2) / 2 ~ (bits(rho^2) / 2^23 - 127) / 2
+   Value * lod = builder.CreateBitCast(rho2, builder.getInt32Ty());
+   lod = builder.CreateSIToFP(lod, builder.getFloatTy());
+   lod = builder.CreateFMul(lod, constFloat(builder, 0.5f / (1 << 23)));
+   return builder.CreateFSub(lod, constFloat(builder, 127 * 0.5f), name("lod"));
+}
+
+// derivatives are <dsdx, dtdx, dsdy, dtdy> of in1 for choosing mipmap levels, NULL if unknown
 Value * tex2D(IRBuilder<> & builder, Value * in1, const unsigned sampler,
               /*const RegDesc * in1Desc, const RegDesc * dstDesc,*/
-              const GGLState * gglCtx)
+              const GGLState * gglCtx, Value * derivatives)
 {
    Type * intType = builder.getInt32Ty();
    PointerType * intPointerType = PointerType::get(intType, 0);
@@ -281,33 +472,7 @@ Value * tex2D(IRBuilder<> & builder, Value * in1, const unsigned sampler,
    llvm::Module * module = builder.GetInsertBlock()->getParent()->getParent();
    std::vector<Value * > texcoords = extractVector(builder, in1);
 
-   Value * textureDimensions = module->getGlobalVariable(_PF2_TEXTURE_DIMENSIONS_NAME_);
-   if (!textureDimensions)
-      textureDimensions = new GlobalVariable(*module, intType, true,
-                                             GlobalValue::ExternalLinkage,
-                                             NULL, _PF2_TEXTURE_DIMENSIONS_NAME_);
-   Value * textureWidth = builder.CreateConstInBoundsGEP1_32(textureDimensions,
-                          sampler * 2);
-   textureWidth = builder.CreateLoad(textureWidth, name("textureWidth"));
-   Value * textureHeight = builder.CreateConstInBoundsGEP1_32(textureDimensions,
-                           sampler * 2 + 1);
-   textureHeight = builder.CreateLoad(textureHeight, name("textureHeight"));
-   Value * textureW = builder.CreateSub(textureWidth, builder.getInt32(1));
-   Value * textureH = builder.CreateSub(textureHeight, builder.getInt32(1));
-//   ChannelType sType = Float, tType = Float;
-//   if (in1Desc) {
-//      sType = in1Desc->channels[0];
-//      tType = in1Desc->channels[1];
-//   }
-
-   Value * xLerp = NULL, * yLerp = NULL;
-   Value * x = texcoordWrap(builder, gglCtx->textureState.textures[sampler].wrapS,
-                            /*sType, */texcoords[0], textureWidth, textureW, &xLerp);
-   Value * y = texcoordWrap(builder, gglCtx->textureState.textures[sampler].wrapT,
-                            /*tType, */texcoords[1], textureHeight, textureH, &yLerp);
-
-   Value * index = builder.CreateMul(y, textureWidth);
-   index = builder.CreateAdd(index, x);
+   const LevelSize size = textureSize(builder, sampler, gglCtx);
 
    Value * textureData = module->getGlobalVariable(_PF2_TEXTURE_DATA_NAME_);
    if (!textureData)
@@ -318,20 +483,58 @@ Value * tex2D(IRBuilder<> & builder, Value * in1, const unsigned sampler,
    textureData = builder.CreateConstInBoundsGEP1_32(textureData, sampler);
    textureData = builder.CreateLoad(textureData);
 
-   if (0 == gglCtx->textureState.textures[sampler].minFilter &&
-         0 == gglCtx->textureState.textures[sampler].magFilter) { // GL_NEAREST
-      Value * ret = pointSample(builder, textureData, index,
-                                gglCtx->textureState.textures[sampler].format/*, dstDesc*/);
-      return intColorVecToFloatColorVec(builder, ret);
-   } else if (1 == gglCtx->textureState.textures[sampler].minFilter &&
-              1 == gglCtx->textureState.textures[sampler].magFilter) { // GL_LINEAR
-      Value * ret = linearSample(builder, textureData, builder.getInt32(0), x, y, xLerp, yLerp,
-                                 textureW, textureH,  textureWidth, textureHeight,
-                                 gglCtx->textureState.textures[sampler].format/*, dstDesc*/);
+   const GGLTexture & texture = gglCtx->textureState.textures[sampler];
+   const unsigned minFilter = texture.minFilter, magFilter = texture.magFilter;
+   if (!derivatives || minFilter == magFilter) { // level 0 only
+      Value * ret = sampleLevel(builder, textureData, builder.getInt32(0), texcoords[0], texcoords[1],
+                                size, texture, magFilter);
       return intColorVecToFloatColorVec(builder, ret);
-   } else
-      assert(!"unsupported texture filter");
-   return NULL;
+   }
+
+   Value * lod = levelOfDetail(builder, derivatives, size.width, size.height);
+   Value * samplePtr = builder.CreateAlloca(intVecType(builder));
+   CondBranch condBranch(builder);
+   condBranch.ifCond(builder.CreateFCmpOGT(lod, constFloat(builder, 0)), "minify", "magnify");
+   {
+      const unsigned filter = minFilter & 1; // GGL_NEAREST or GGL_LINEAR within a level
+      Value * sample = NULL;
+      if (GGLTexture::GGL_NEAREST_MIPMAP_NEAREST > minFilter)
+         sample = sampleLevel(builder, textureData, builder.getInt32(0), texcoords[0], texcoords[1],
+                              size, texture, filter);
+      else {
+         Value * maxLevel = textureStateGlobal(builder, _PF2_TEXTURE_MAX_LEVEL_NAME_);
+         maxLevel = builder.CreateConstInBoundsGEP1_32(maxLevel, sampler);
+         maxLevel = builder.CreateLoad(maxLevel, name("maxLevel"));
+         Value * maxLod = builder.CreateUIToFP(maxLevel, builder.getFloatTy());
+         lod = builder.CreateSelect(builder.CreateFCmpOLT(lod, maxLod), lod, maxLod);
+         if (GGLTexture::GGL_NEAREST_MIPMAP_LINEAR > minFilter) { // nearest level
+            Value * level = builder.CreateFPToSI(builder.CreateFAdd(lod, constFloat(builder, 0.5f)), intType);
+            sample = sampleMipmap(builder, textureData, sampler, level, texcoords[0], texcoords[1],
+                                  size, texture, filter);
+         } else { // linear between the two nearest levels
+            Value * level = builder.CreateFPToSI(lod, intType);
+            Value * next = minIntScalar(builder, builder.CreateAdd(level, builder.getInt32(1)), maxLevel);
+            Value * lerp = builder.CreateFSub(lod, builder.CreateSIToFP(level, builder.getFloatTy()));
+            lerp = builder.CreateFPToSI(builder.CreateFMul(lerp, constFloat(builder, 1 << SHIFT)), intType);
+            Value * s0 = sampleMipmap(builder, textureData, sampler, level, texcoords[0], texcoords[1],
+                                      size, texture, filter);
+            Value * s1 = sampleMipmap(builder, textureData, sampler, next, texcoords[0], texcoords[1],
+                                      size, texture, filter);
+            sample = builder.CreateMul(builder.CreateSub(s1, s0), intVec(builder, lerp, lerp, lerp, lerp));
+            sample = builder.CreateAShr(sample, constIntVec(builder, SHIFT, SHIFT, SHIFT, SHIFT));
+            sample = builder.CreateAdd(sample, s0);
+         }
+      }
+      builder.CreateStore(sample, samplePtr);
+   }
+   condBranch.elseop();
+   {
+      Value * sample = sampleLevel(builder, textureData, builder.getInt32(0), texcoords[0], texcoords[1],
+                                   size, texture, magFilter);
+      builder.CreateStore(sample, samplePtr);
+   }
+   condBranch.endif();
+   return intColorVecToFloatColorVec(builder, builder.CreateLoad(samplePtr));
 }
 
 // only positive float; used in cube map since major axis is positive
@@ -378,17 +581,8 @@ Value * texCube(IRBuilder<> & builder, Value * in1, const unsigned sampler,
    Module * module = builder.GetInsertBlock()->getParent()->getParent();
    std::vector<Value * > texcoords = extractVector(builder, in1);
 
-   Value * textureDimensions = module->getGlobalVariable(_PF2_TEXTURE_DIMENSIONS_NAME_);
-   if (!textureDimensions)
-      textureDimensions = new GlobalVariable(*module, intType, true,
-                                             GlobalValue::ExternalLinkage,
-                                             NULL, _PF2_TEXTURE_DIMENSIONS_NAME_);
-   Value * textureWidth = builder.CreateConstInBoundsGEP1_32(textureDimensions,
-                          sampler * 2);
-   textureWidth = builder.CreateLoad(textureWidth, name("textureWidth"));
-   Value * textureHeight = builder.CreateConstInBoundsGEP1_32(textureDimensions,
-                           sampler * 2 + 1);
-   textureHeight = builder.CreateLoad(textureHeight, name("textureHeight"));
+   const LevelSize size = textureSize(builder, sampler, gglCtx);
+   Value * textureWidth = size.width, * textureHeight = size.height;
    Value * textureW = builder.CreateSub(textureWidth, builder.getInt32(1));
    Value * textureH = builder.CreateSub(textureHeight, builder.getInt32(1));
 
@@ -498,11 +692,15 @@ Value * texCube(IRBuilder<> & builder, Value * in1, const unsigned sampler,
 //   ChannelType sType = Float, tType = Float;
    Value * xLerp = NULL, * yLerp = NULL;
    Value * x = texcoordWrap(builder, gglCtx->textureState.textures[sampler].wrapS,
-                            /*sType, */s, textureWidth, textureW, &xLerp);
+                            /*sType, */s, textureWidth, textureW, size.widthShift, &xLerp);
    Value * y = texcoordWrap(builder, gglCtx->textureState.textures[sampler].wrapT,
-                            /*tType, */t, textureHeight, textureH, &yLerp);
-   Value * indexOffset = builder.CreateMul(builder.CreateMul(textureHeight, textureWidth), face);
-   Value * index = builder.CreateAdd(builder.CreateMul(y, textureWidth), x);
+                            /*tType, */t, textureHeight, textureH, size.heightShift, &yLerp);
+   const unsigned layout = gglCtx->textureState.textures[sampler].layout;
+   Value * faceTexels = builder.CreateMul(textureHeight, textureWidth);
+   if (GGLTexture::GGL_TILED_LAYOUT == layout)
+      faceTexels = builder.CreateMul(tilePadded(builder, textureHeight), tilePadded(builder, textureWidth));
+   Value * indexOffset = builder.CreateMul(faceTexels, face);
+   Value * index = texelIndex(builder, layout, x, y, textureWidth, size.widthShift);
 
    Value * textureData = module->getGlobalVariable(_PF2_TEXTURE_DATA_NAME_);
    if (!textureData)
@@ -513,17 +711,16 @@ Value * texCube(IRBuilder<> & builder, Value * in1, const unsigned sampler,
    textureData = builder.CreateConstInBoundsGEP1_32(textureData, sampler);
    textureData = builder.CreateLoad(textureData);
 
-   if (0 == gglCtx->textureState.textures[sampler].minFilter &&
-         0 == gglCtx->textureState.textures[sampler].magFilter) { // GL_NEAREST
+   // level 0 with magFilter, cube maps are not mipmapped
+   if (0 == gglCtx->textureState.textures[sampler].magFilter) { // GL_NEAREST
       textureData = pointSample(builder, textureData, builder.CreateAdd(indexOffset, index),
                                 gglCtx->textureState.textures[sampler].format/*, dstDesc*/);
       return intColorVecToFloatColorVec(builder, textureData);
 
-   } else if (1 == gglCtx->textureState.textures[sampler].minFilter &&
-              1 == gglCtx->textureState.textures[sampler].magFilter) { // GL_LINEAR
+   } else if (1 == gglCtx->textureState.textures[sampler].magFilter) { // GL_LINEAR
       textureData = linearSample(builder, textureData, indexOffset, x, y, xLerp, yLerp,
-                                 textureW, textureH,  textureWidth, textureHeight,
-                                 gglCtx->textureState.textures[sampler].format/*, dstDesc*/);
+                                 textureW, textureH,  textureWidth, size.widthShift,
+                                 gglCtx->textureState.textures[sampler]/*, dstDesc*/);
       return intColorVecToFloatColorVec(builder, textureData);
    } else
       assert(!"unsupported texture filter");
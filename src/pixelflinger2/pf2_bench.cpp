@@ -0,0 +1,646 @@
+/**
+ **
+ ** Copyright 2011, The Android Open Source Project
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+// headless throughput benchmark, prints one "suite,config,value,unit" csv line per result
+//  usage: pf2_bench [width height [rasterThreads]]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <malloc.h>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "pixelflinger2/pixelflinger2_interface.h"
+
+static const char * vertexShader =
+   "attribute vec4 aPosition; \n"
+   "attribute vec4 aTexCoord; \n"
+   "varying vec4 vTexCoord; \n"
+   "void main() { \n"
+   "   gl_Position = aPosition; \n"
+   "   vTexCoord = aTexCoord; \n"
+   "} \n";
+
+static const char * colorShader =
+   "uniform vec4 uColor; \n"
+   "void main() { \n"
+   "   gl_FragColor = uColor; \n"
+   "} \n";
+
+static const char * textureShader =
+   "uniform sampler2D sampler; \n"
+   "varying vec4 vTexCoord; \n"
+   "void main() { \n"
+   "   gl_FragColor = texture2D(sampler, vTexCoord.xy); \n"
+   "} \n";
+
+static const double minSeconds = 0.25; // each measurement repeats until at least this long
+
+static unsigned width = 512, height = 512;
+static unsigned rasterThreads = 0; // interface default, one per cpu
+static GGLInterface_t * iface;
+
+static double Seconds()
+{
+   timespec time;
+   clock_gettime(CLOCK_MONOTONIC, &time);
+   return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static void Report(const char * suite, const char * config, const double value, const char * unit)
+{
+   printf("%s,%s,%.3f,%s\n", suite, config, value, unit);
+   fflush(stdout);
+}
+
+static gl_shader_program_t * CreateProgram(const char * fragmentShader)
+{
+   const char * infoLog = NULL;
+   gl_shader_t * vs = iface->ShaderCreate(iface, GL_VERTEX_SHADER);
+   if (!iface->ShaderCompile(iface, vs, vertexShader, &infoLog)) {
+      fprintf(stderr, "pf2_bench: vertex shader compile failed: %s\n", infoLog);
+      exit(EXIT_FAILURE);
+   }
+   gl_shader_t * fs = iface->ShaderCreate(iface, GL_FRAGMENT_SHADER);
+   if (!iface->ShaderCompile(iface, fs, fragmentShader, &infoLog)) {
+      fprintf(stderr, "pf2_bench: fragment shader compile failed: %s\n", infoLog);
+      exit(EXIT_FAILURE);
+   }
+   gl_shader_program_t * program = iface->ShaderProgramCreate(iface);
+   iface->ShaderAttach(iface, program, vs);
+   iface->ShaderAttach(iface, program, fs);
+   iface->ShaderAttributeBind(program, 0, "aPosition");
+   iface->ShaderAttributeBind(program, 1, "aTexCoord");
+   if (!iface->ShaderProgramLink(program, &infoLog)) {
+      fprintf(stderr, "pf2_bench: link failed: %s\n", infoLog);
+      exit(EXIT_FAILURE);
+   }
+   // program keeps its linked copies
+   iface->ShaderDetach(iface, program, vs);
+   iface->ShaderDetach(iface, program, fs);
+   iface->ShaderDelete(iface, vs);
+   iface->ShaderDelete(iface, fs);
+   return program;
+}
+
+static void SetVertex(VertexInput_t * v, const float x, const float y, const float s, const float t)
+{
+   memset(v, 0, sizeof(*v));
+   v->attributes[0] = Vector4_CTR(x, y, 0.5f, 1);
+   v->attributes[1] = Vector4_CTR(s, t, 0, 1);
+}
+
+// full screen strip with texcoords repeating the texture 4 times
+static VertexInput_t quad[4] __attribute__ ((aligned (16)));
+
+static void InitQuad()
+{
+   SetVertex(quad + 0, -1, -1, -1.5f, -1.5f);
+   SetVertex(quad + 1, 1, -1, 2.5f, -1.5f);
+   SetVertex(quad + 2, -1, 1, -1.5f, 2.5f);
+   SetVertex(quad + 3, 1, 1, 2.5f, 2.5f);
+}
+
+// returns full screen quads drawn per second; first draw jits and is not timed
+static double FillQuads(const VertexInput_t * vertices = quad)
+{
+   iface->DrawArrays(iface, GL_TRIANGLE_STRIP, vertices, 0, 4);
+   iface->Finish(iface);
+   unsigned count = 0;
+   const double start = Seconds();
+   double elapsed = 0;
+   do {
+      for (unsigned i = 0; i < 8; i++)
+         iface->DrawArrays(iface, GL_TRIANGLE_STRIP, vertices, 0, 4);
+      iface->Finish(iface);
+      count += 8;
+      elapsed = Seconds() - start;
+   } while (elapsed < minSeconds);
+   return count / elapsed;
+}
+
+// hardware cache misses of the calling thread, -1 where not available
+static int OpenCacheMissCounter()
+{
+#if defined(__linux__)
+   perf_event_attr attr;
+   memset(&attr, 0, sizeof(attr));
+   attr.size = sizeof(attr);
+   attr.type = PERF_TYPE_HARDWARE;
+   attr.config = PERF_COUNT_HW_CACHE_MISSES;
+   attr.exclude_kernel = 1;
+   attr.exclude_hv = 1;
+   return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+   return -1;
+#endif
+}
+
+static unsigned long long ReadCounter(const int counter)
+{
+   unsigned long long value = 0;
+#if defined(__linux__)
+   if (counter < 0 || sizeof(value) != read(counter, &value, sizeof(value)))
+      value = 0;
+#endif
+   return value;
+}
+
+static void * frameData, * depthData, * stencilData;
+
+static void SetSurface(const GLenum type, void * data, const GGLPixelFormat format)
+{
+   GGLSurface_t surface = {width, height, format, data, 0, 0};
+   iface->SetBuffer(iface, type, data ? &surface : NULL);
+}
+
+// count random 32 bit words, also random texels of the other formats
+static unsigned * RandomTexels(const unsigned count, const unsigned seed)
+{
+   unsigned * texels = (unsigned *)memalign(16, count * 4);
+   srand(seed);
+   for (unsigned i = 0; i < count; i++)
+      texels[i] = rand();
+   return texels;
+}
+
+// square texture of one level with same wrap for s and t, and filter for min and mag
+static void InitTexture(GGLTexture_t * texture, const GGLPixelFormat format, const unsigned size,
+                        void * levels, const GGLTexture::GGLTextureWrap wrap,
+                        const GGLTexture::GGLTextureMinFilter filter)
+{
+   memset(texture, 0, sizeof(*texture));
+   texture->type = GL_TEXTURE_2D;
+   texture->format = format;
+   texture->width = texture->height = size;
+   texture->levelCount = 1;
+   texture->levels = levels;
+   texture->wrapS = texture->wrapT = wrap;
+   texture->magFilter = texture->minFilter = filter;
+}
+
+// draws program sampling texture from unit 0 into the RGBA_8888 color buffer; NULL unbinds
+static void BindTexture(gl_shader_program_t * program, GGLTexture_t * texture)
+{
+   const GLint unit = 0;
+   SetSurface(GL_COLOR_BUFFER_BIT, frameData, GGL_PIXEL_FORMAT_RGBA_8888);
+   iface->ShaderUse(iface, program);
+   iface->ShaderUniform(program, iface->ShaderUniformLocation(program, "sampler"), 1, &unit, GL_INT);
+   iface->SetSampler(iface, unit, texture);
+}
+
+static void TriangleSetup(gl_shader_program_t * program)
+{
+   SetSurface(GL_COLOR_BUFFER_BIT, frameData, GGL_PIXEL_FORMAT_RGBA_8888);
+   iface->ShaderUse(iface, program);
+
+   // small triangles scattered over the screen, about 8 pixels each
+   const unsigned count = 4096;
+   VertexInput_t * vertices = (VertexInput_t *)memalign(16, count * 3 * sizeof(*vertices));
+   const float dx = 4.0f / width, dy = 4.0f / height;
+   srand(1);
+   for (unsigned i = 0; i < count; i++) {
+      const float x = rand() * 2.0f / RAND_MAX - 1, y = rand() * 2.0f / RAND_MAX - 1;
+      SetVertex(vertices + i * 3 + 0, x, y, 0, 0);
+      SetVertex(vertices + i * 3 + 1, x + dx, y, 0, 0);
+      SetVertex(vertices + i * 3 + 2, x, y + dy, 0, 0);
+   }
+
+   const struct {
+      const char * config;
+      GLboolean cull;
+   } configs[] = { {"small", GL_FALSE}, {"culled", GL_TRUE} };
+   for (unsigned c = 0; c < sizeof(configs) / sizeof(*configs); c++) {
+      iface->EnableDisable(iface, GL_CULL_FACE, configs[c].cull);
+      iface->CullFace(iface, GL_FRONT_AND_BACK);
+      iface->DrawArrays(iface, GL_TRIANGLES, vertices, 0, count * 3);
+      iface->Finish(iface);
+      unsigned drawn = 0;
+      const double start = Seconds();
+      double elapsed = 0;
+      do {
+         iface->DrawArrays(iface, GL_TRIANGLES, vertices, 0, count * 3);
+         iface->Finish(iface);
+         drawn += count;
+         elapsed = Seconds() - start;
+      } while (elapsed < minSeconds);
+      Report("triangle_setup", configs[c].config, drawn / elapsed / 1e6, "MTris/s");
+   }
+   iface->EnableDisable(iface, GL_CULL_FACE, GL_FALSE);
+   free(vertices);
+}
+
+static void FillRate(gl_shader_program_t * program)
+{
+   const struct {
+      const char * name;
+      GGLPixelFormat format;
+   } colors[] = {
+      {"RGBA_8888", GGL_PIXEL_FORMAT_RGBA_8888}, {"RGB_565", GGL_PIXEL_FORMAT_RGB_565}
+   };
+   const struct {
+      const char * name;
+      GLboolean enable;
+      GLenum src, dst;
+   } blends[] = {
+      {"opaque", GL_FALSE, GL_ONE, GL_ZERO},
+      {"alpha", GL_TRUE, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA},
+      {"additive", GL_TRUE, GL_ONE, GL_ONE}
+   };
+   // SZ_24 and SZ_8 share the depth buffer
+   const struct {
+      const char * name;
+      GGLPixelFormat depth, stencil;
+   } depthStencils[] = {
+      {"none", GGL_PIXEL_FORMAT_NONE, GGL_PIXEL_FORMAT_NONE},
+      {"Z_32", GGL_PIXEL_FORMAT_Z_32, GGL_PIXEL_FORMAT_NONE},
+      {"Z_16", GGL_PIXEL_FORMAT_Z_16, GGL_PIXEL_FORMAT_NONE},
+      {"Z_32+S_8", GGL_PIXEL_FORMAT_Z_32, GGL_PIXEL_FORMAT_S_8},
+      {"SZ_24+SZ_8", GGL_PIXEL_FORMAT_SZ_24, GGL_PIXEL_FORMAT_SZ_8}
+   };
+
+   iface->ShaderUse(iface, program);
+   const GLfloat color[4] = {0.25f, 0.5f, 0.75f, 0.5f};
+   iface->ShaderUniform(program, iface->ShaderUniformLocation(program, "uColor"), 1, color, GL_FLOAT_VEC4);
+   iface->DepthFunc(iface, GL_LEQUAL);
+   iface->StencilFuncSeparate(iface, GL_FRONT_AND_BACK, GL_ALWAYS, 0, 0xff);
+   iface->StencilOpSeparate(iface, GL_FRONT_AND_BACK, GL_KEEP, GL_KEEP, GL_INCR_WRAP);
+
+   for (unsigned c = 0; c < sizeof(colors) / sizeof(*colors); c++)
+      for (unsigned b = 0; b < sizeof(blends) / sizeof(*blends); b++)
+         for (unsigned d = 0; d < sizeof(depthStencils) / sizeof(*depthStencils); d++) {
+            SetSurface(GL_COLOR_BUFFER_BIT, frameData, colors[c].format);
+            const GGLPixelFormat depth = depthStencils[d].depth, stencil = depthStencils[d].stencil;
+            SetSurface(GL_DEPTH_BUFFER_BIT, depth ? depthData : NULL, depth);
+            SetSurface(GL_STENCIL_BUFFER_BIT, GGL_PIXEL_FORMAT_SZ_8 == stencil ? depthData :
+                       stencil ? stencilData : NULL, stencil);
+            iface->EnableDisable(iface, GL_DEPTH_TEST, GGL_PIXEL_FORMAT_NONE != depth);
+            iface->EnableDisable(iface, GL_STENCIL_TEST, GGL_PIXEL_FORMAT_NONE != stencil);
+            iface->EnableDisable(iface, GL_BLEND, blends[b].enable);
+            iface->BlendFuncSeparate(iface, blends[b].src, blends[b].dst, blends[b].src, blends[b].dst);
+            iface->ClearDepthf(iface, 1);
+            iface->ClearStencil(iface, 0);
+            iface->Clear(iface, GL_COLOR_BUFFER_BIT | (depth ? GL_DEPTH_BUFFER_BIT : 0) |
+                         (stencil ? GL_STENCIL_BUFFER_BIT : 0));
+
+            char config[64];
+            snprintf(config, sizeof(config), "%s/%s/%s", colors[c].name, blends[b].name,
+                     depthStencils[d].name);
+            Report("fill", config, FillQuads() * width * height / 1e6, "MPixels/s");
+         }
+
+   iface->EnableDisable(iface, GL_DEPTH_TEST, GL_FALSE);
+   iface->EnableDisable(iface, GL_STENCIL_TEST, GL_FALSE);
+   iface->EnableDisable(iface, GL_BLEND, GL_FALSE);
+   SetSurface(GL_DEPTH_BUFFER_BIT, NULL, GGL_PIXEL_FORMAT_NONE);
+   SetSurface(GL_STENCIL_BUFFER_BIT, NULL, GGL_PIXEL_FORMAT_NONE);
+}
+
+static void TextureSampling(gl_shader_program_t * program)
+{
+   const struct {
+      const char * name;
+      GGLPixelFormat format;
+   } formats[] = {
+      {"RGBA_8888", GGL_PIXEL_FORMAT_RGBA_8888}, {"RGBX_8888", GGL_PIXEL_FORMAT_RGBX_8888},
+      {"RGB_565", GGL_PIXEL_FORMAT_RGB_565}, {"RGBA_4444", GGL_PIXEL_FORMAT_RGBA_4444},
+      {"RGBA_5551", GGL_PIXEL_FORMAT_RGBA_5551}, {"A_8", GGL_PIXEL_FORMAT_A_8},
+      {"L_8", GGL_PIXEL_FORMAT_L_8}, {"LA_88", GGL_PIXEL_FORMAT_LA_88},
+      {"ETC1", GGL_PIXEL_FORMAT_ETC1} // any 8 bytes are a valid block
+   };
+   const struct {
+      const char * name;
+      GGLTexture::GGLTextureWrap wrap;
+   } wraps[] = {
+      {"REPEAT", GGLTexture::GGL_REPEAT}, {"CLAMP_TO_EDGE", GGLTexture::GGL_CLAMP_TO_EDGE},
+      {"MIRRORED_REPEAT", GGLTexture::GGL_MIRRORED_REPEAT}
+   };
+   const struct {
+      const char * name;
+      GGLTexture::GGLTextureMinFilter filter;
+   } filters[] = { {"NEAREST", GGLTexture::GGL_NEAREST}, {"LINEAR", GGLTexture::GGL_LINEAR} };
+
+   const unsigned size = 256;
+   unsigned * texels = RandomTexels(size * size, 2);
+   for (unsigned f = 0; f < sizeof(formats) / sizeof(*formats); f++)
+      for (unsigned w = 0; w < sizeof(wraps) / sizeof(*wraps); w++)
+         for (unsigned m = 0; m < sizeof(filters) / sizeof(*filters); m++) {
+            GGLTexture_t texture;
+            InitTexture(&texture, formats[f].format, size, texels, wraps[w].wrap, filters[m].filter);
+            BindTexture(program, &texture);
+
+            char config[64];
+            snprintf(config, sizeof(config), "%s/%s/%s", formats[f].name, wraps[w].name,
+                     filters[m].name);
+            Report("texture", config, FillQuads() * width * height / 1e6, "MTexels/s");
+         }
+   BindTexture(program, NULL);
+   free(texels);
+}
+
+// quads covering the screen with the whole texture, upright and turned 90 degrees, so that
+//  neighbouring pixels either walk along texture rows or down texture columns
+static void TextureLayout(gl_shader_program_t * program)
+{
+   const struct {
+      const char * name;
+      GGLTexture::GGLTextureLayout layout;
+   } layouts[] = { {"linear", GGLTexture::GGL_LINEAR_LAYOUT}, {"tiled", GGLTexture::GGL_TILED_LAYOUT} };
+   static VertexInput_t quads[2][4] __attribute__ ((aligned (16)));
+   SetVertex(quads[0] + 0, -1, -1, 0, 0);
+   SetVertex(quads[0] + 1, 1, -1, 1, 0);
+   SetVertex(quads[0] + 2, -1, 1, 0, 1);
+   SetVertex(quads[0] + 3, 1, 1, 1, 1);
+   SetVertex(quads[1] + 0, -1, -1, 0, 0);
+   SetVertex(quads[1] + 1, 1, -1, 0, 1);
+   SetVertex(quads[1] + 2, -1, 1, 1, 0);
+   SetVertex(quads[1] + 3, 1, 1, 1, 1);
+   const char * const angles[] = {"0deg", "90deg"};
+
+   // larger than caches, so each texel fetch that leaves the cache line costs a miss
+   const unsigned size = 2048;
+   unsigned * pixels = RandomTexels(size * size, 3);
+   GGLTexture_t texture;
+   InitTexture(&texture, GGL_PIXEL_FORMAT_RGBA_8888, size, NULL, GGLTexture::GGL_CLAMP_TO_EDGE,
+               GGLTexture::GGL_LINEAR);
+   texture.layout = GGLTexture::GGL_TILED_LAYOUT; // largest of the layouts
+   texture.levels = memalign(16, GGLTextureDataSize(&texture));
+
+   // the counter only sees this thread, so misses are counted rastering on it alone
+   const int counter = OpenCacheMissCounter();
+   for (unsigned l = 0; l < sizeof(layouts) / sizeof(*layouts); l++) {
+      texture.layout = layouts[l].layout;
+      GGLTextureStore(&texture, 0, 0, pixels);
+      BindTexture(program, &texture);
+      for (unsigned a = 0; a < sizeof(angles) / sizeof(*angles); a++) {
+         char config[64];
+         snprintf(config, sizeof(config), "%s/%s", layouts[l].name, angles[a]);
+         Report("texture_layout", config, FillQuads(quads[a]) * width * height / 1e6, "MTexels/s");
+         if (counter < 0)
+            continue;
+         const unsigned count = 8;
+         iface->SetRasterThreads(iface, 1);
+         const unsigned long long start = ReadCounter(counter);
+         for (unsigned i = 0; i < count; i++)
+            iface->DrawArrays(iface, GL_TRIANGLE_STRIP, quads[a], 0, 4);
+         iface->Finish(iface);
+         const unsigned long long misses = ReadCounter(counter) - start;
+         iface->SetRasterThreads(iface, rasterThreads);
+         Report("texture_layout", config, misses * 1000.0 / count / width / height, "misses/kpixel");
+      }
+   }
+#if defined(__linux__)
+   if (counter >= 0)
+      close(counter);
+#endif
+   BindTexture(program, NULL);
+   free(texture.levels);
+   free(pixels);
+}
+
+// thumbnail style minification, the whole texture on a quad a quarter of the screen across
+static void TextureMipmap(gl_shader_program_t * program)
+{
+   const struct {
+      const char * name;
+      GGLTexture::GGLTextureMinFilter filter;
+   } filters[] = {
+      {"LINEAR", GGLTexture::GGL_LINEAR},
+      {"LINEAR_MIPMAP_NEAREST", GGLTexture::GGL_LINEAR_MIPMAP_NEAREST},
+      {"LINEAR_MIPMAP_LINEAR", GGLTexture::GGL_LINEAR_MIPMAP_LINEAR}
+   };
+   static VertexInput_t thumbnail[4] __attribute__ ((aligned (16)));
+   SetVertex(thumbnail + 0, -0.25f, -0.25f, 0, 0);
+   SetVertex(thumbnail + 1, 0.25f, -0.25f, 1, 0);
+   SetVertex(thumbnail + 2, -0.25f, 0.25f, 0, 1);
+   SetVertex(thumbnail + 3, 0.25f, 0.25f, 1, 1);
+
+   GGLTexture_t texture;
+   InitTexture(&texture, GGL_PIXEL_FORMAT_RGBA_8888, 2048, NULL, GGLTexture::GGL_CLAMP_TO_EDGE,
+               GGLTexture::GGL_LINEAR);
+   texture.levelCount = 12;
+   texture.levels = RandomTexels(GGLTextureDataSize(&texture) / 4, 4); // levels 1+ are generated
+
+   const double start = Seconds();
+   GGLTextureGenerateMipmaps(&texture);
+   Report("texture_mipmap", "generate", (Seconds() - start) * 1000, "ms");
+
+   for (unsigned f = 0; f < sizeof(filters) / sizeof(*filters); f++) {
+      texture.minFilter = filters[f].filter;
+      BindTexture(program, &texture);
+      Report("texture_mipmap", filters[f].name, FillQuads(thumbnail), "thumbnails/s");
+   }
+   BindTexture(program, NULL);
+   free(texture.levels);
+}
+
+// sampling cost of the texture size specializations; power-of-2 textures address with shifts,
+//  and with constantSize their dimensions are jitted as constants
+static void TextureSize(gl_shader_program_t * program)
+{
+   const struct {
+      const char * name;
+      unsigned size;
+      bool constantSize;
+   } sizes[] = { {"npot", 250, false}, {"pot", 256, false}, {"pot_constant", 256, true} };
+   unsigned * texels = RandomTexels(256 * 256, 6);
+   for (unsigned i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+      GGLTexture_t texture;
+      InitTexture(&texture, GGL_PIXEL_FORMAT_RGBA_8888, sizes[i].size, texels,
+                  GGLTexture::GGL_REPEAT, GGLTexture::GGL_LINEAR);
+      texture.constantSize = sizes[i].constantSize;
+      BindTexture(program, &texture);
+      Report("texture_size", sizes[i].name, FillQuads() * width * height / 1e6, "MTexels/s");
+   }
+   BindTexture(program, NULL);
+   free(texels);
+}
+
+// exact bilinear of channel c at 16.16 texcoord of a CLAMP_TO_EDGE texture, and the result of the
+//  previous per channel 16.16 lerps; texcoords map [0, 1] to [0, size - 1] like the sampler
+static void ReferenceBilinear(const unsigned * texels, const unsigned size, const float s, const float t,
+                              const unsigned c, double * exact, int * previous)
+{
+   const int u = (int)(s * 65536) * (int)(size - 1), v = (int)(t * 65536) * (int)(size - 1);
+   const int fx = u & 0xffff, fy = v & 0xffff;
+   const unsigned x0 = u >> 16, y0 = v >> 16;
+   const unsigned x1 = x0 + 1 < size ? x0 + 1 : x0, y1 = y0 + 1 < size ? y0 + 1 : y0;
+   const int a = (texels[y0 * size + x0] >> (c * 8)) & 0xff, b = (texels[y0 * size + x1] >> (c * 8)) & 0xff;
+   const int d = (texels[y1 * size + x0] >> (c * 8)) & 0xff, e = (texels[y1 * size + x1] >> (c * 8)) & 0xff;
+   const double top = a + (b - a) * (fx / 65536.0), bottom = d + (e - d) * (fx / 65536.0);
+   *exact = top + (bottom - top) * (fy / 65536.0);
+   const int h0 = ((b - a) * fx >> 16) + a, h1 = ((e - d) * fx >> 16) + d;
+   *previous = ((h1 - h0) * fy >> 16) + h0;
+   *previous = (int)(*previous * (1 / 255.0f) * 255.0f); // as written by the fragment shader
+}
+
+// accuracy of magnified bilinear filtering against exact filtering, and against the previous
+//  32 bit per channel kernel; then throughput of rotated and scaled blits of a large texture;
+//  returns false if the sampler is off by more than 2 levels
+static bool TextureBilinear(gl_shader_program_t * program)
+{
+   const unsigned small = 64;
+   unsigned * texels = RandomTexels(small * small, 5);
+   GGLTexture_t texture;
+   InitTexture(&texture, GGL_PIXEL_FORMAT_RGBA_8888, small, texels, GGLTexture::GGL_CLAMP_TO_EDGE,
+               GGLTexture::GGL_LINEAR);
+   BindTexture(program, &texture);
+
+   static VertexInput_t blit[4] __attribute__ ((aligned (16)));
+   SetVertex(blit + 0, -1, -1, 0, 0);
+   SetVertex(blit + 1, 1, -1, 1, 0);
+   SetVertex(blit + 2, -1, 1, 0, 1);
+   SetVertex(blit + 3, 1, 1, 1, 1);
+   iface->DrawArrays(iface, GL_TRIANGLE_STRIP, blit, 0, 4);
+   iface->Finish(iface);
+
+   // window y is flipped, row 0 is the top of the quad
+   double maxError = 0, totalError = 0, maxPrevious = 0, totalPrevious = 0;
+   for (unsigned y = 0; y < height; y++)
+      for (unsigned x = 0; x < width; x++)
+         for (unsigned c = 0; c < 4; c++) {
+            double exact = 0;
+            int previous = 0;
+            ReferenceBilinear(texels, small, (x + 0.5f) / width, 1 - (y + 0.5f) / height, c,
+                              &exact, &previous);
+            const double error = fabs((((unsigned *)frameData)[y * width + x] >> (c * 8) & 0xff) - exact);
+            maxError = error > maxError ? error : maxError;
+            totalError += error;
+            const double previousError = fabs(previous - exact);
+            maxPrevious = previousError > maxPrevious ? previousError : maxPrevious;
+            totalPrevious += previousError;
+         }
+   Report("texture_bilinear", "accuracy/max", maxError, "levels");
+   Report("texture_bilinear", "accuracy/mean", totalError / (width * height * 4), "levels");
+   Report("texture_bilinear", "accuracy/previous_max", maxPrevious, "levels");
+   Report("texture_bilinear", "accuracy/previous_mean", totalPrevious / (width * height * 4), "levels");
+   free(texels);
+
+   const struct {
+      const char * name;
+      float degrees, scale; // scale is texture widths across the screen
+   } blits[] = {
+      {"0deg/1x", 0, 1}, {"30deg/1x", 30, 1}, {"30deg/0.5x", 30, 0.5f}, {"30deg/1.5x", 30, 1.5f}
+   };
+   const unsigned size = 1024;
+   texture.width = texture.height = size;
+   texture.levels = RandomTexels(size * size, 7);
+   BindTexture(program, &texture);
+   for (unsigned b = 0; b < sizeof(blits) / sizeof(*blits); b++) {
+      const float radians = blits[b].degrees * 3.14159265f / 180;
+      const float c = cosf(radians) * blits[b].scale / 2, s = sinf(radians) * blits[b].scale / 2;
+      for (unsigned i = 0; i < 4; i++) {
+         const float x = i & 1 ? 1 : -1, y = i & 2 ? 1 : -1;
+         SetVertex(blit + i, x, y, 0.5f + c * x - s * y, 0.5f + s * x + c * y);
+      }
+      Report("texture_bilinear", blits[b].name, FillQuads(blit) * width * height / 1e6, "MTexels/s");
+   }
+   BindTexture(program, NULL);
+   free(texture.levels);
+   return maxError <= 2;
+}
+
+// times ShaderUse of newly linked programs, which jits vertex, fragment and scanline variants
+static void CompileLatency()
+{
+   const struct {
+      const char * name;
+      const char * fragmentShader;
+   } shaders[] = { {"color", colorShader}, {"texture", textureShader} };
+
+   SetSurface(GL_COLOR_BUFFER_BIT, frameData, GGL_PIXEL_FORMAT_RGBA_8888);
+   iface->EnableStatistics(iface, GL_TRUE);
+   for (unsigned s = 0; s < sizeof(shaders) / sizeof(*shaders); s++) {
+      const unsigned count = 8;
+      double total = 0;
+      unsigned variants = 0;
+      for (unsigned i = 0; i < count; i++) {
+         gl_shader_program_t * program = CreateProgram(shaders[s].fragmentShader);
+         GGLStatistics_t stats;
+         iface->ResetStatistics(iface);
+         const double start = Seconds();
+         iface->ShaderUse(iface, program);
+         total += Seconds() - start;
+         iface->GetStatistics(iface, &stats);
+         variants += stats.shaderCompiles;
+         iface->ShaderUse(iface, NULL);
+         iface->ShaderProgramDelete(iface, program);
+      }
+      Report("compile", shaders[s].name, total * 1000 / count, "ms/program");
+      if (variants)
+         Report("compile", shaders[s].name, total * 1000 / variants, "ms/variant");
+   }
+   iface->EnableStatistics(iface, GL_FALSE);
+}
+
+int main(int argc, char ** argv)
+{
+   if (argc > 2) {
+      width = atoi(argv[1]);
+      height = atoi(argv[2]);
+   }
+   if (!width || !height) {
+      fprintf(stderr, "usage: %s [width height [rasterThreads]]\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   iface = CreateGGLInterface();
+   if (argc > 3) {
+      rasterThreads = atoi(argv[3]);
+      iface->SetRasterThreads(iface, rasterThreads);
+   }
+
+   frameData = memalign(16, width * height * 4);
+   depthData = memalign(16, width * height * 4);
+   stencilData = memalign(16, width * height);
+   iface->Viewport(iface, 0, 0, width, height);
+   InitQuad();
+
+   gl_shader_program_t * color = CreateProgram(colorShader);
+   gl_shader_program_t * texture = CreateProgram(textureShader);
+
+   printf("suite,config,value,unit\n");
+   TriangleSetup(color);
+   FillRate(color);
+   TextureSampling(texture);
+   TextureLayout(texture);
+   TextureMipmap(texture);
+   const bool bilinearAccurate = TextureBilinear(texture);
+   TextureSize(texture);
+   CompileLatency();
+
+   iface->ShaderUse(iface, NULL);
+   iface->ShaderProgramDelete(iface, color);
+   iface->ShaderProgramDelete(iface, texture);
+   SetSurface(GL_COLOR_BUFFER_BIT, NULL, GGL_PIXEL_FORMAT_NONE);
+   DestroyGGLInterface(iface);
+   free(frameData);
+   free(depthData);
+   free(stencilData);
+   if (!bilinearAccurate) {
+      fprintf(stderr, "pf2_bench: bilinear filtering is off by more than 2 levels\n");
+      return EXIT_FAILURE;
+   }
+   return EXIT_SUCCESS;
+}
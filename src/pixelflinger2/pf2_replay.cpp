@@ -0,0 +1,76 @@
+/**
+ **
+ ** Copyright 2011, The Android Open Source Project
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+// replays a trace recorded by CreateGGLTraceInterface and reports per frame timings
+//  usage: pf2_replay trace [rasterThreads]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pixelflinger2/pixelflinger2_interface.h"
+
+static double Milliseconds()
+{
+   timespec time;
+   clock_gettime(CLOCK_MONOTONIC, &time);
+   return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+}
+
+int main(int argc, char ** argv)
+{
+   if (argc < 2) {
+      fprintf(stderr, "usage: %s trace [rasterThreads]\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   GGLInterface_t * iface = CreateGGLInterface();
+   if (argc > 2)
+      iface->SetRasterThreads(iface, atoi(argv[2]));
+
+   GGLTraceReplay_t * replay = GGLTraceReplayOpen(iface, argv[1]);
+   if (!replay) {
+      fprintf(stderr, "%s: failed to open trace '%s'\n", argv[0], argv[1]);
+      DestroyGGLInterface(iface);
+      return EXIT_FAILURE;
+   }
+
+   unsigned frames = 0;
+   double total = 0, min = 0, max = 0;
+   for (;;) {
+      const double start = Milliseconds();
+      const int more = GGLTraceReplayFrame(replay);
+      const double elapsed = Milliseconds() - start;
+      if (!more)
+         break; // calls after the last Finish are not a frame
+      printf("frame %u: %.3f ms\n", frames, elapsed);
+      if (!frames || elapsed < min)
+         min = elapsed;
+      if (elapsed > max)
+         max = elapsed;
+      total += elapsed;
+      frames++;
+   }
+   if (frames)
+      printf("%u frames: min %.3f ms, avg %.3f ms, max %.3f ms\n", frames, min, total / frames, max);
+   else
+      printf("no frames in trace\n");
+
+   GGLTraceReplayClose(replay);
+   DestroyGGLInterface(iface);
+   return EXIT_SUCCESS;
+}
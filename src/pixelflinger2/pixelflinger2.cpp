@@ -45,6 +45,33 @@ static void Viewport(GGLInterface * iface, GLint x, GLint y, GLsizei width, GLsi
    ctx->viewport.h = VectorComp_t_CTR(height / 2);
 }
 
+static void Scissor(GGLInterface * iface, GLint x, GLint y, GLsizei width, GLsizei height)
+{
+   GGL_GET_CONTEXT(ctx, iface);
+   FlushBinned(ctx);
+   if (0 > width || 0 > height)
+      return gglError(GL_INVALID_VALUE);
+   ctx->scissorState.box.left = x;
+   ctx->scissorState.box.top = y;
+   ctx->scissorState.box.right = x + width;
+   ctx->scissorState.box.bottom = y + height;
+   UpdateClipRect(ctx);
+}
+
+void UpdateClipRect(GGLContext * ctx)
+{
+   GGLRect & rect = ctx->clipRect;
+   rect.left = rect.top = 0;
+   rect.right = ctx->frameSurface.width;
+   rect.bottom = ctx->frameSurface.height;
+   if (!ctx->scissorState.enable)
+      return;
+   rect.left = MAX2(rect.left, ctx->scissorState.box.left);
+   rect.top = MAX2(rect.top, ctx->scissorState.box.top);
+   rect.right = MAX2(MIN2(rect.right, ctx->scissorState.box.right), rect.left);
+   rect.bottom = MAX2(MIN2(rect.bottom, ctx->scissorState.box.bottom), rect.top);
+}
+
 static void CullFace(GGLInterface * iface, GLenum mode)
 {
    GGL_GET_CONTEXT(ctx, iface);
@@ -66,6 +93,7 @@ static void FrontFace(GGLInterface * iface, GLenum mode)
 static void BlendColor(GGLInterface * iface, GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha)
 {
    GGL_GET_CONTEXT(ctx, iface);
+   FlushBinned(ctx);
    ctx->state.blendState.color[0] = MIN2(MAX2(red * 255, 0.0f), 255.0f);
    ctx->state.blendState.color[1] = MIN2(MAX2(green * 255, 0.0f), 255.0f);
    ctx->state.blendState.color[2] = MIN2(MAX2(blue * 255, 0.0f), 255.0f);
@@ -76,6 +104,7 @@ static void BlendColor(GGLInterface * iface, GLclampf red, GLclampf green, GLcla
 static void BlendEquationSeparate(GGLInterface * iface, GLenum modeRGB, GLenum modeAlpha)
 {
    GGL_GET_CONTEXT(ctx, iface);
+   FlushBinned(ctx);
    if (GL_FUNC_ADD != modeRGB && (GL_FUNC_SUBTRACT > modeRGB ||
                                   GL_FUNC_REVERSE_SUBTRACT < modeRGB))
       return gglError(GL_INVALID_ENUM);
@@ -115,6 +144,7 @@ static inline GGLBlendState::GGLBlendFactor GLBlendFactor(const GLenum factor)
 static void BlendFuncSeparate(GGLInterface * iface, GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha)
 {
    GGL_GET_CONTEXT(ctx, iface);
+   FlushBinned(ctx);
    if (GL_ZERO != srcRGB && GL_ONE != srcRGB &&
          (GL_SRC_COLOR > srcRGB || GL_SRC_ALPHA_SATURATE < srcRGB) &&
          (GL_CONSTANT_COLOR > srcRGB || GL_ONE_MINUS_CONSTANT_ALPHA < srcRGB))
@@ -146,6 +176,7 @@ static void BlendFuncSeparate(GGLInterface * iface, GLenum srcRGB, GLenum dstRGB
 static void EnableDisable(GGLInterface * iface, GLenum cap, GLboolean enable)
 {
    GGL_GET_CONTEXT(ctx, iface);
+   FlushBinned(ctx);
    bool changed = false;
    switch (cap) {
    case GL_BLEND:
@@ -168,7 +199,8 @@ static void EnableDisable(GGLInterface * iface, GLenum cap, GLboolean enable)
 //      ALOGD("pf2: EnableDisable GL_DITHER \n");
       break;
    case GL_SCISSOR_TEST:
-//      ALOGD("pf2: EnableDisable GL_SCISSOR_TEST \n");
+      ctx->scissorState.enable = enable;
+      UpdateClipRect(ctx);
       break;
    case GL_TEXTURE_2D:
 //      ALOGD("pf2: EnableDisable GL_SCISSOR_TEST %d", enable);
@@ -183,11 +215,32 @@ static void EnableDisable(GGLInterface * iface, GLenum cap, GLboolean enable)
       SetShaderVerifyFunctions(iface);
 }
 
+static void GetStatistics(const GGLInterface * iface, GGLStatistics * stats)
+{
+   GGL_GET_CONST_CONTEXT(ctx, iface);
+   FlushBinned(ctx); // binned fragments are counted when shaded
+   *stats = ctx->stats;
+}
+
+static void ResetStatistics(GGLInterface * iface)
+{
+   GGL_GET_CONTEXT(ctx, iface);
+   FlushBinned(ctx);
+   memset(&ctx->stats, 0, sizeof(ctx->stats));
+}
+
+static void EnableStatistics(GGLInterface * iface, GLboolean enable)
+{
+   GGL_GET_CONTEXT(ctx, iface);
+   FlushBinned(ctx);
+   if (ctx->state.statistics == enable)
+      return;
+   ctx->state.statistics = enable;
+   SetShaderVerifyFunctions(iface); // scanline counts fragments
+}
+
 void InitializeGGLState(GGLInterface * iface)
 {
-#if USE_DUAL_THREAD
-   reinterpret_cast<GGLContext *>(iface)->worker = GGLContext::Worker();
-#endif
    iface->DepthRangef = DepthRangef;
    iface->Viewport = Viewport;
    iface->CullFace = CullFace;
@@ -196,12 +249,17 @@ void InitializeGGLState(GGLInterface * iface)
    iface->BlendEquationSeparate = BlendEquationSeparate;
    iface->BlendFuncSeparate = BlendFuncSeparate;
    iface->EnableDisable = EnableDisable;
+   iface->Scissor = Scissor;
+   iface->GetStatistics = GetStatistics;
+   iface->ResetStatistics = ResetStatistics;
+   iface->EnableStatistics = EnableStatistics;
 
    InitializeBufferFunctions(iface);
    InitializeRasterFunctions(iface);
    InitializeScanLineFunctions(iface);
    InitializeShaderFunctions(iface);
    InitializeTextureFunctions(iface);
+   InitializeTileFunctions(iface);
 
    iface->EnableDisable(iface, GL_DEPTH_TEST, false);
    iface->DepthFunc(iface, GL_LESS);
@@ -216,6 +274,9 @@ void InitializeGGLState(GGLInterface * iface)
    iface->CullFace(iface, GL_BACK);
    iface->EnableDisable(iface, GL_CULL_FACE, false);
 
+   iface->Scissor(iface, 0, 0, 0, 0);
+   iface->EnableDisable(iface, GL_SCISSOR_TEST, false);
+
    iface->EnableDisable(iface, GL_BLEND, false);
    iface->BlendColor(iface, 0, 0, 0, 0);
    iface->BlendEquationSeparate(iface, GL_FUNC_ADD, GL_FUNC_ADD);
@@ -248,10 +309,15 @@ GGLInterface * CreateGGLInterface()
 
 void UninitializeGGLState(GGLInterface * iface)
 {
-#if USE_DUAL_THREAD
-   reinterpret_cast<GGLContext *>(iface)->worker.~Worker();
-#endif
+   DestroyTileFunctions(iface);
    DestroyShaderFunctions(iface);
+   GGL_GET_CONTEXT(ctx, iface);
+   free(ctx->fastClear.tiles);
+   ctx->fastClear.tiles = NULL;
+#if USE_HIERARCHICAL_Z
+   free(ctx->hiZ.bounds);
+   ctx->hiZ.bounds = NULL;
+#endif
 
 #if USE_LLVM_TEXTURE_SAMPLER
    puts("USE_LLVM_TEXTURE_SAMPLER");
@@ -262,8 +328,8 @@ void UninitializeGGLState(GGLInterface * iface)
 #if USE_LLVM_EXECUTIONENGINE
    puts("USE_LLVM_EXECUTIONENGINE");
 #endif
-#if USE_DUAL_THREAD
-   puts("USE_DUAL_THREAD");
+#if USE_TILED_RASTER
+   puts("USE_TILED_RASTER");
 #endif
    hieralloc_report_brief(NULL, stdout);
 }
@@ -23,7 +23,27 @@
 #ifndef USE_LLVM_EXECUTIONENGINE
 #define USE_LLVM_EXECUTIONENGINE 0 // 1 to use llvm::Execution, 0 to use libBCC, requires modifying makefile
 #endif
-#define USE_DUAL_THREAD 1
+#define USE_TILED_RASTER 1 // bin trapezoids into tiles shaded in parallel by GGLContext::rasterPool
+#define USE_SOA_VERTEX_SHADER 1 // also JIT vertex shaders shading GGL_VERTEX_SOA_WIDTH vertices at once
+#define USE_QUAD_RASTER 1 // edge function raster in 2x2 quads for fragment shaders with a SoA form
+#define USE_HIERARCHICAL_Z 1 // reject blocks of primitives against coarse depth bounds before shading
+
+#define GGL_TILE_SIZE_SHIFT 6 // tiles are 64x64 pixels of frameSurface
+#define GGL_TILE_SIZE (1 << GGL_TILE_SIZE_SHIFT)
+#define GGL_MAX_RASTER_THREADS 16 // including the calling thread
+#define GGL_MAX_BINNED_PRIMITIVES 256 // tiles are shaded when this many trapezoids are binned
+#define GGL_DRAW_BATCH_VERTICES 96 // DrawArrays/DrawElements shade this many vertices at a time
+#define GGL_VERTEX_CACHE_SIZE 32 // post-transform cache entries for DrawElements
+#ifdef __AVX__
+#define GGL_VERTEX_SOA_WIDTH 8 // vertices per SoA vertex shader call, one per float lane
+#else
+#define GGL_VERTEX_SOA_WIDTH 4
+#endif
+#define GGL_GUARD_BAND 4096 // triangles are clipped to this many pixels around viewport center
+#define GGL_STREAM_FILL_SIZE (256 * 1024) // Clear fills of more bytes use non-temporal stores
+#define GGL_COMMAND_BUFFER_SIZE (256 * 1024) // deferred interface submits commands in buffers of this size
+#define GGL_RASTER_SPIN_COUNT 4096 // raster threads poll this many times before blocking
+#define GGL_RASTER_BLOCK_SIZE 8 // quad raster and hi-Z reject blocks of this many pixels square
 
 #define debug_printf printf
 
@@ -71,11 +91,32 @@ class BCCContext;
 typedef int BlendComp_t;
 #endif
 
-#if USE_DUAL_THREAD
+#if USE_TILED_RASTER
 #include <pthread.h>
 #endif
 
 typedef void (*ShaderFunction_t)(const void*,void*,const void*);
+typedef void (* ScanLineFunction_t)(VertexOutput * start, VertexOutput * step,
+                                    const float (*constants)[4], void * frame,
+                                    int * depth, unsigned char * stencil,
+                                    GGLActiveStencil *, unsigned count,
+                                    GGLStatistics * stats); // only counted if statistics in key
+
+#if USE_TILED_RASTER
+struct GGLTrapezoid { // binned for tiled raster, tl-tr and bl-br are horizontal
+   VertexOutput tl, tr, bl, br;
+   GGLActiveStencil activeStencil; // selected during primitive assembly
+   bool triangle; // tl, tr, bl are a triangle for RasterTriangleRect
+};
+#endif
+
+struct GGLRect { // in frameSurface pixels; right and bottom are exclusive
+   int left, top, right, bottom;
+};
+
+enum { // buffers of GGLContext::FastClear::tiles
+   GGL_CLEAR_COLOR = 1, GGL_CLEAR_DEPTH = 2, GGL_CLEAR_STENCIL = 4
+};
 
 #define GGL_GET_CONTEXT(context, interface) GGLContext * context = (GGLContext *)interface;
 #define GGL_GET_CONST_CONTEXT(context, interface) const GGLContext * context = \
@@ -90,7 +131,7 @@ struct GGLContext {
 
    bcc::BCCContext * bccCtx;
 
-   struct {
+   struct ClearState {
       int depth; // assuming ieee 754 32 bit float and 32 bit 2's complement int; z_32
       unsigned color; // clear value; rgba_8888
       unsigned stencil; // s_8; repeated to clear 4 pixels at a time
@@ -98,52 +139,66 @@ struct GGLContext {
 
    gl_shader_program * CurrentProgram;
 
+   struct ShaderFunctions { // jit instances of CurrentProgram for state, set by ShaderUse
+      ShaderFunction_t vertex;
+      ShaderFunction_t vertexBatch; // SoA vertex shader, NULL if not supported
+      ScanLineFunction_t scanLine;
+      ShaderFunction_t fragmentBatch; // quad fragment shader, NULL if not supported
+      ScanLineFunction_t quadScanLine; // for fragments shaded by fragmentBatch
+      bool quadOnly; // scanLine can't compute derivatives, so trapezoids are rastered as triangles
+   } shaderFunctions; // programs may be shared by contexts, so functions are per context
+
    mutable GGLActiveStencil activeStencil; // after primitive assembly, call StencilSelect
 
    GGLState state; // states affecting jit
 
-#if USE_DUAL_THREAD
-   mutable struct Worker {
-      const GGLInterface * iface;
-      unsigned startY, endY, varyingCount;
-      VertexOutput bV, cV, bDx, cDx;
-      int width, height;
-      bool assignedWork; // only used by main; worker uses assignCond & quit
-      bool quit;
-
-      pthread_cond_t assignCond;
-      pthread_mutex_t assignLock; // held by worker execpt for during cond_wait assign
+   mutable GGLStatistics stats; // since last ResetStatistics
+
+   mutable struct FastClear { // tiles cleared by Clear but not filled yet, see SetFastClear
+      bool enable;
+      unsigned tilesX, tilesY, tileCapacity; // GGL_TILE_SIZE tiles of frameSurface
+      unsigned char * tiles; // [tile] buffers to fill, bits are GGL_CLEAR_*
+      unsigned pending; // buffers with tiles to fill
+      ClearState values; // to fill tiles with
+   } fastClear;
+
+#if USE_HIERARCHICAL_Z
+   mutable struct HiZ { // depth bounds of GGL_RASTER_BLOCK_SIZE square blocks of depthSurface
+      unsigned blocksX, blocksY;
+      int * bounds; // [block * 2] min and max, same representation as depthSurface
+   } hiZ;
+#endif
+
+#if USE_TILED_RASTER
+   mutable struct RasterPool {
+      unsigned threadCount; // including calling thread; 1 means raster immediately without binning
+      unsigned tilesX, tilesY, tileCapacity; // tile grid covering frameSurface, bins allocated
+      unsigned primitiveCount; // trapezoids and triangles binned since last FlushTiles
+      GGLTrapezoid * primitives; // [GGL_MAX_BINNED_PRIMITIVES]
+      unsigned short * bins; // [tile * GGL_MAX_BINNED_PRIMITIVES + i], index into primitives
+      unsigned * binSizes; // [tile]
+      unsigned * jobs; // [job] tiles with binned trapezoids, each claimed by one thread per flush
+      unsigned jobCount;
+
+      // lock free handoff; workers spin on generation, then park on startCond
+      volatile unsigned generation; // incremented by calling thread to start shading jobs
+      volatile unsigned nextJob; // next unclaimed index into jobs
+      volatile unsigned busyCount; // workers still shading current generation
+      volatile unsigned parkedCount; // workers waiting on startCond
+      volatile unsigned joinParked; // calling thread waiting on finishCond
+      volatile bool quit;
+
+      pthread_mutex_t lock; // only taken to park or wake parked threads
+      pthread_cond_t startCond;
       pthread_cond_t finishCond;
-      pthread_mutex_t finishLock; // held by main except for during cond_wait finish
-      pthread_t thread;
-
-      Worker() : assignedWork(false), quit(false), thread(0)
-      {
-         pthread_cond_init(&assignCond, NULL);
-         pthread_cond_init(&finishCond, NULL);
-         pthread_mutex_init(&assignLock, NULL);
-         pthread_mutex_init(&finishLock, NULL);
-         pthread_mutex_lock(&finishLock);
-         // actual thread is created later in raster.cpp
-      }
-      ~Worker()
-      {
-         if (0 != thread)
-         {
-            pthread_mutex_lock(&assignLock);
-            quit = true;
-            pthread_cond_signal(&assignCond); // signal thread to quit
-            pthread_mutex_unlock(&assignLock);
-            pthread_join(thread, NULL);
-         }
-         pthread_mutex_unlock(&finishLock);
-
-         pthread_cond_destroy(&assignCond);
-         pthread_cond_destroy(&finishCond);
-         pthread_mutex_destroy(&assignLock);
-         pthread_mutex_destroy(&finishLock);
-      }
-   } worker;
+
+      struct Thread {
+         const GGLContext * ctx;
+         unsigned index;
+         unsigned generation; // last generation shaded
+         pthread_t thread;
+      } threads[GGL_MAX_RASTER_THREADS]; // threads[0] is the calling thread
+   } rasterPool;
 #endif
 
    // called by ShaderUse to set to proper rendering functions
@@ -156,6 +211,12 @@ struct GGLContext {
       VectorComp_t x, y, w, h, n, f;
    } viewport; // should be moved into libAgl2
 
+   struct {
+      bool enable;
+      GGLRect box; // from Scissor
+   } scissorState;
+   GGLRect clipRect; // frameSurface, within scissorState.box if enabled; nothing is drawn outside
+
    struct { // should be moved into libAgl2
 unsigned enable :
       1;
@@ -168,9 +229,28 @@ unsigned cullFace :
 
 #define _PF2_TEXTURE_DATA_NAME_ "gl_PF2TEXTURE_DATA" /* sampler data pointers used by LLVM */
 #define _PF2_TEXTURE_DIMENSIONS_NAME_ "gl_PF2TEXTURE_DIMENSIONS" /* sampler dimensions used by LLVM */
+#define _PF2_TEXTURE_LEVELS_NAME_ "gl_PF2TEXTURE_LEVELS" /* sampler level offsets used by LLVM */
+#define _PF2_TEXTURE_MAX_LEVEL_NAME_ "gl_PF2TEXTURE_MAX_LEVEL" /* sampler highest levels used by LLVM */
+#define _PF2_TEXTURE_SHIFTS_NAME_ "gl_PF2TEXTURE_SHIFTS" /* sampler log2 dimensions used by LLVM */
+
+// power-of-2 textures are sampled with shifts and masks, and have their own shader key bit
+inline bool IsPowerOf2Texture(const GGLTexture & texture)
+{
+   return texture.width && !(texture.width & (texture.width - 1)) &&
+          texture.height && !(texture.height & (texture.height - 1));
+}
 
 void gglError(unsigned error); // not implmented, just an assert
 
+void UpdateClipRect(GGLContext * ctx); // called when frameSurface or scissorState change
+
+// of pixel x, y in frame, depth or stencil surface; SZ_8 stencil is the low byte of each word
+void * SurfaceAddress(const GGLSurface & surface, unsigned x, unsigned y);
+
+// fill buffers of tiles flagged by fast Clear, must be called before they are rastered
+void ResolveTile(const GGLContext * ctx, unsigned tile); // tile of GGL_TILE_SIZE grid of frameSurface
+void ResolveRect(const GGLContext * ctx, const GGLRect & rect); // tiles overlapping rect
+
 void InitializeGGLState(GGLInterface * iface); // should be private
 void UninitializeGGLState(GGLInterface * iface); // should be private
 
@@ -180,8 +260,50 @@ void InitializeRasterFunctions(GGLInterface * iface);
 void InitializeScanLineFunctions(GGLInterface * iface);
 void InitializeTextureFunctions(GGLInterface * iface);
 
+// rasters the part of a vertex processed trapezoid inside rect, which is within frameSurface
+void RasterTrapezoidRect(const GGLContext * ctx, const VertexOutput * tl, const VertexOutput * tr,
+                         const VertexOutput * bl, const VertexOutput * br,
+                         GGLActiveStencil * activeStencil, const GGLRect & rect);
+// GGLScanLine with ctx surfaces, uniforms, statistics and shaderFunctions.scanLine
+void ShadeScanLine(const GGLContext * ctx, GGLActiveStencil * activeStencil,
+                   const VertexOutput * start, const VertexOutput * end);
+#if USE_QUAD_RASTER
+// rasters the part of a vertex processed triangle inside rect in 2x2 quads, program must
+// have a quad fragment shader
+void RasterTriangleRect(const GGLContext * ctx, const VertexOutput * v1, const VertexOutput * v2,
+                        const VertexOutput * v3, GGLActiveStencil * activeStencil, const GGLRect & rect);
+#endif
+
+#if USE_HIERARCHICAL_Z
+// false if the depth test fails for every pixel of block with depth in [zMin, zMax], which then
+// must not be rastered; otherwise widens the block bounds for the depths that may be written
+bool HiZVisible(const GGLContext * ctx, unsigned block, VectorComp_t zMin, VectorComp_t zMax);
+// tightens block bounds after every pixel of it was rastered with depth in [zMin, zMax]
+void HiZCovered(const GGLContext * ctx, unsigned block, VectorComp_t zMin, VectorComp_t zMax);
+#endif
+
+void InitializeTileFunctions(GGLInterface * iface); // set function pointers and start raster threads
+void DestroyTileFunctions(GGLInterface * iface); // stop raster threads
+#if USE_TILED_RASTER
+void BinTrapezoid(const GGLContext * ctx, const VertexOutput * tl, const VertexOutput * tr,
+                  const VertexOutput * bl, const VertexOutput * br); // uses ctx->activeStencil
+void BinTriangle(const GGLContext * ctx, const VertexOutput * v1, const VertexOutput * v2,
+                 const VertexOutput * v3); // uses ctx->activeStencil
+void FlushTiles(const GGLContext * ctx); // shade and empty all bins, returns when done
+#endif
+
+// single primitive draws stay binned until a batch draw, Finish or state change, so
+//  functions changing state read by shading call this first
+inline void FlushBinned(const GGLContext * ctx)
+{
+#if USE_TILED_RASTER
+   FlushTiles(ctx);
+#endif
+}
+
 void InitializeShaderFunctions(GGLInterface * iface); // set function pointers and create needed objects
 void SetShaderVerifyFunctions(GGLInterface * iface); // called by state change functions
+void SetProgramBinned(const GGLContext * ctx); // CurrentProgram has primitives binned by ctx
 void DestroyShaderFunctions(GGLInterface * iface); // destroy needed objects
 // actual gl_shader and gl_shader_program is created and destroyed by Shader(Program)Create/Delete,
 
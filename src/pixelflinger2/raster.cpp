@@ -76,7 +76,9 @@ static void ProcessVertex(const GGLInterface * iface, const VertexInput * input,
 //   ctx->glCtx->CurrentProgram->_LinkedShaders[MESA_SHADER_VERTEX]->function();
 //   memcpy(output, ctx->glCtx->CurrentProgram->ValuesVertexOutput, sizeof(*output));
 
-   GGLProcessVertex(ctx->CurrentProgram, input, output, ctx->CurrentProgram->ValuesUniform);
+   ctx->shaderFunctions.vertex(input, output, ctx->CurrentProgram->ValuesUniform);
+   if (ctx->state.statistics)
+      ctx->stats.verticesShaded++;
 //   const Vector4 * constants = (Vector4 *)
 //    ctx->glCtx->Shader.CurrentProgram->VertexProgram->Parameters->ParameterValues;
 //	ctx->glCtx->Shader.CurrentProgram->GLVMVP->function(input, output, constants);
@@ -86,79 +88,75 @@ static void ProcessVertex(const GGLInterface * iface, const VertexInput * input,
 //#endif
 }
 
-#if USE_DUAL_THREAD
-static void * RasterTrapezoidWorker(void * threadArgs)
+// shades count consecutive vertices, GGL_VERTEX_SOA_WIDTH at a time if the vertex shader
+// has a SoA function, and the rest one at a time
+static void ProcessVertices(const GGLInterface * iface, const VertexInput * input,
+                            VertexOutput * output, const unsigned count)
 {
-   GGLContext::Worker * args = (GGLContext::Worker *)threadArgs;
-   VertexOutput clip0, clip1, * left, * right;
-
-   pthread_mutex_lock(&args->finishLock);
-   pthread_mutex_lock(&args->assignLock);
-   pthread_cond_signal(&args->finishCond);
-   pthread_mutex_unlock(&args->finishLock);
-
-   while (true) {
-      pthread_cond_wait(&args->assignCond, &args->assignLock);
-      if (args->quit)
-      {
-         pthread_mutex_unlock(&args->assignLock);
-         break;
+   GGL_GET_CONST_CONTEXT(ctx, iface);
+   unsigned i = 0;
+#if USE_SOA_VERTEX_SHADER
+   const ShaderFunction_t batch = ctx->shaderFunctions.vertexBatch;
+   if (batch)
+      for (; i + GGL_VERTEX_SOA_WIDTH <= count; i += GGL_VERTEX_SOA_WIDTH)
+         batch(input + i, output + i, ctx->CurrentProgram->ValuesUniform);
+   if (ctx->state.statistics)
+      ctx->stats.verticesShaded += i;
+#endif
+   for (; i < count; i++)
+      iface->ProcessVertex(iface, input + i, output + i);
+}
+
+#if USE_HIERARCHICAL_Z
+// rasters the blocks of span left-right that hi-Z does not reject
+static void HiZScanLine(const GGLContext * ctx, GGLActiveStencil * activeStencil,
+                        const VertexOutput * left, const VertexOutput * right)
+{
+   const int startX = left->position.x, endX = right->position.x, y = left->position.y;
+   const VectorComp_t zMin = MIN2(left->position.z, right->position.z);
+   const VectorComp_t zMax = MAX2(left->position.z, right->position.z);
+   const unsigned row = (y / GGL_RASTER_BLOCK_SIZE) * ctx->hiZ.blocksX;
+   const unsigned varyingCount = ctx->CurrentProgram->VaryingSlots;
+   const VectorComp_t width = right->position.x - left->position.x;
+
+   int runStart = startX; // first pixel of current run of visible blocks
+   for (int x = startX; ; ) {
+      const bool spanEnd = x > endX;
+      if (!spanEnd && HiZVisible(ctx, row + x / GGL_RASTER_BLOCK_SIZE, zMin, zMax)) {
+         x = (x | (GGL_RASTER_BLOCK_SIZE - 1)) + 1;
+         continue;
       }
-      else
-          assert(args->assignedWork);
-
-      for (unsigned y = args->startY; y <= args->endY; y += 2) {
-         do {
-            if (args->bV.position.x < 0) {
-               if (args->cV.position.x < 0)
-                  break;
-               InterpolateVertex(&args->bV, &args->cV, -args->bV.position.x /
-                                 (args->cV.position.x - args->bV.position.x),
-                                 &clip0, args->varyingCount);
-               left = &clip0;
-            } else
-               left = &args->bV;
-            if ((int)args->cV.position.x >= (int)args->width) {
-               if (args->bV.position.x >= (int)args->width)
-                  break;
-               InterpolateVertex(&args->bV, &args->cV, (args->width - 1 - args->bV.position.x) /
-                                 (args->cV.position.x - args->bV.position.x),
-                                 &clip1, args->varyingCount);
-               right = &clip1;
-            } else
-               right = &args->cV;
-            args->iface->ScanLine(args->iface, left, right);
-         } while (false);
-         for (unsigned i = 0; i < args->varyingCount; i++) {
-            args->bV.varyings[i] += args->bDx.varyings[i];
-            args->cV.varyings[i] += args->cDx.varyings[i];
+      if (runStart < x) { // raster run ending before rejected block or at end of span
+         const VertexOutput * start = left, * end = right;
+         VertexOutput clip0, clip1;
+         if (runStart > startX) {
+            InterpolateVertex(left, right, (runStart - left->position.x) / width, &clip0, varyingCount);
+            clip0.position.x = VectorComp_t_CTR(runStart);
+            start = &clip0;
          }
-         args->bV.position += args->bDx.position;
-         args->cV.position += args->cDx.position;
-         args->bV.frontFacingPointCoord += args->bDx.frontFacingPointCoord;
-         args->cV.frontFacingPointCoord += args->cDx.frontFacingPointCoord;
+         if (!spanEnd) {
+            InterpolateVertex(left, right, (x - 1 - left->position.x) / width, &clip1, varyingCount);
+            clip1.position.x = VectorComp_t_CTR(x - 1);
+            end = &clip1;
+         }
+         ShadeScanLine(ctx, activeStencil, start, end);
       }
-
-      pthread_mutex_lock(&args->finishLock);
-      pthread_cond_signal(&args->finishCond);
-      pthread_mutex_unlock(&args->finishLock);
+      if (spanEnd)
+         break;
+      x = runStart = (x | (GGL_RASTER_BLOCK_SIZE - 1)) + 1;
    }
-   pthread_exit(NULL);
-   return NULL;
 }
 #endif
 
-static void RasterTrapezoid(const GGLInterface * iface, const VertexOutput * tl,
-                            const VertexOutput * tr, const VertexOutput * bl,
-                            const VertexOutput * br)
+void RasterTrapezoidRect(const GGLContext * ctx, const VertexOutput * tl, const VertexOutput * tr,
+                         const VertexOutput * bl, const VertexOutput * br,
+                         GGLActiveStencil * activeStencil, const GGLRect & rect)
 {
-   GGL_GET_CONST_CONTEXT(ctx, iface);
-
    assert(tl->position.x <= tr->position.x && bl->position.x <= br->position.x);
    assert(tl->position.y <= bl->position.y && tr->position.y <= br->position.y);
    assert(fabs(tl->position.y - tr->position.y) < 1 && fabs(bl->position.y - br->position.y) < 1);
 
-   const unsigned width = ctx->frameSurface.width, height = ctx->frameSurface.height;
+   const unsigned height = ctx->frameSurface.height;
    const unsigned varyingCount = ctx->CurrentProgram->VaryingSlots;
 
 
@@ -166,7 +164,7 @@ static void RasterTrapezoid(const GGLInterface * iface, const VertexOutput * tl,
    VertexOutput tlv(*tl), trv(*tr), blv(*bl), brv(*br);
    VertexOutput tmp;
 
-   // vertically clip
+   // vertically clip to frame surface, so that rows are stepped the same for every rect
 
    if ((int)tlv.position.y < 0) {
       InterpolateVertex(&tlv, &blv, (0 - tlv.position.y) / (blv.position.y - tlv.position.y),
@@ -189,34 +187,18 @@ static void RasterTrapezoid(const GGLInterface * iface, const VertexOutput * tl,
       brv = tmp;
    }
 
-//   // horizontally clip
-//   if ((int)tlv.position.x < 0) {
-//      InterpolateVertex(&tlv, &trv, (0 - tlv.position.x) / (trv.position.x - tlv.position.x),
-//                        &tmp, varyingCount);
-//      tlv = tmp;
-//   }
-//   if ((int)blv.position.x < 0) {
-//      InterpolateVertex(&blv, &brv, (0 - blv.position.x) / (brv.position.x - blv.position.x),
-//                        &tmp, varyingCount);
-//      blv = tmp;
-//   }
-//   if ((int)trv.position.x >= (int)width) {
-//      InterpolateVertex(&tlv, &trv, (width - 1 - tlv.position.x) / (trv.position.x - tlv.position.x),
-//                        &tmp, varyingCount);
-//      trv = tmp;
-//   }
-//   if ((int)brv.position.x >= (int)width) {
-//      InterpolateVertex(&blv, &brv, (width - 1 - blv.position.x) / (brv.position.x - blv.position.x),
-//                        &tmp, varyingCount);
-//      brv = tmp;
-//   }
-
    const unsigned int startY = tlv.position.y;
    const unsigned int endY = blv.position.y;
 
    if (endY < startY)
       return;
 
+   // rows of the trapezoid inside rect
+   const unsigned int firstY = MAX2(startY, (unsigned)rect.top);
+   const unsigned int lastY = MIN2(endY, (unsigned)rect.bottom - 1);
+   if (lastY < firstY)
+      return;
+
    const VectorComp_t yDistInv = VectorComp_t_CTR(1.0f / (endY - startY));
 
    // bV and cV are left and right vertices on a horizontal line in quad
@@ -246,74 +228,83 @@ static void RasterTrapezoid(const GGLInterface * iface, const VertexOutput * tl,
    cDx.frontFacingPointCoord *= yDistInv;
    cDx.frontFacingPointCoord.y = VectorComp_t_Zero; // gl_FrontFacing not interpolated
 
-#if USE_DUAL_THREAD
-   GGLContext::Worker & args = ctx->worker;
-   if (!ctx->worker.thread) {
-      pthread_attr_t attr;
-      pthread_attr_init(&attr);
-      pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-      int rc = pthread_create(&ctx->worker.thread, &attr, RasterTrapezoidWorker, &args);
-      assert(!rc);
-      // wait for worker to start
-      pthread_cond_wait(&args.finishCond, &args.finishLock);
-   }
-   args.startY = startY + 1;
-   args.endY = endY;
-   if (args.startY <= args.endY) {
-      pthread_mutex_lock(&args.assignLock);
-
-      args.bV = bV;
-      args.cV = cV;
+   if (firstY > startY) { // skip rows above rect
+      const VectorComp_t skip = VectorComp_t_CTR(firstY - startY);
+      Vector4 step;
       for (unsigned i = 0; i < varyingCount; i++) {
-         args.bV.varyings[i] += bDx.varyings[i];
-         bDx.varyings[i] += bDx.varyings[i];
-         args.cV.varyings[i] += cDx.varyings[i];
-         cDx.varyings[i] += cDx.varyings[i];
+         (step = bDx.varyings[i]) *= skip;
+         bV.varyings[i] += step;
+         (step = cDx.varyings[i]) *= skip;
+         cV.varyings[i] += step;
       }
-      args.bV.position += bDx.position;
-      bDx.position += bDx.position;
-      args.cV.position += cDx.position;
-      cDx.position += cDx.position;
-      args.bV.frontFacingPointCoord += bDx.frontFacingPointCoord;
-      bDx.frontFacingPointCoord += bDx.frontFacingPointCoord;
-      args.cV.frontFacingPointCoord += cDx.frontFacingPointCoord;
-      cDx.frontFacingPointCoord += cDx.frontFacingPointCoord;
-      args.iface = iface;
-      args.bDx = bDx;
-      args.cDx = cDx;
-      args.varyingCount = varyingCount;
-      args.width = width;
-      args.height = height;
-      args.assignedWork = true;
-
-      pthread_cond_signal(&args.assignCond);
-      pthread_mutex_unlock(&args.assignLock);
+      (step = bDx.position) *= skip;
+      bV.position += step;
+      (step = cDx.position) *= skip;
+      cV.position += step;
+      (step = bDx.frontFacingPointCoord) *= skip;
+      bV.frontFacingPointCoord += step;
+      (step = cDx.frontFacingPointCoord) *= skip;
+      cV.frontFacingPointCoord += step;
    }
-#endif
 
    VertexOutput * left, * right;
    VertexOutput clip0, clip1;
 
-   for (unsigned y = startY; y <= endY; y += 1 + USE_DUAL_THREAD) {
+#if USE_HIERARCHICAL_Z
+   const bool hiZ = ctx->hiZ.bounds && ctx->state.bufferState.depthTest;
+   const VectorComp_t zMin = MIN2(MIN2(tl->position.z, tr->position.z), MIN2(bl->position.z, br->position.z));
+   const VectorComp_t zMax = MAX2(MAX2(tl->position.z, tr->position.z), MAX2(bl->position.z, br->position.z));
+   const int blockMask = GGL_RASTER_BLOCK_SIZE - 1;
+   int coveredLeft = 0, coveredRight = -1; // first pixels of blocks covered by current block row
+#endif
+
+   for (unsigned y = firstY; y <= lastY; y++) {
+#if USE_HIERARCHICAL_Z
+      if (hiZ && !(y & blockMask) && y + blockMask <= lastY) {
+         // edges are linear, so pixels inside both the first and last row are inside every row;
+         // one pixel of margin for rounding of the stepped edges
+         const VectorComp_t l = MAX2(bV.position.x, bV.position.x + bDx.position.x * blockMask);
+         const VectorComp_t r = MIN2(cV.position.x, cV.position.x + cDx.position.x * blockMask);
+         coveredLeft = (MAX2((int)l + 1, rect.left) + blockMask) & ~blockMask;
+         coveredRight = (MIN2((int)r - 1, rect.right - 1) + 1 - GGL_RASTER_BLOCK_SIZE) & ~blockMask;
+      }
+#endif
       do {
-         if (bV.position.x < 0) {
-            if (cV.position.x < 0)
+         // horizontally clip; clipped ends are snapped to the rect edge pixel
+         if (bV.position.x < rect.left) {
+            if (cV.position.x < rect.left)
                break;
-            InterpolateVertex(&bV, &cV, -bV.position.x / (cV.position.x - bV.position.x),
+            InterpolateVertex(&bV, &cV, (rect.left - bV.position.x) / (cV.position.x - bV.position.x),
                               &clip0, varyingCount);
+            clip0.position.x = VectorComp_t_CTR(rect.left);
             left = &clip0;
          } else
             left = &bV;
-         if ((int)cV.position.x >= (int)width) {
-            if (bV.position.x >= (int)width)
+         if ((int)cV.position.x >= rect.right) {
+            if (bV.position.x >= rect.right)
                break;
-            InterpolateVertex(&bV, &cV, (width - 1 - bV.position.x) / (cV.position.x - bV.position.x),
+            InterpolateVertex(&bV, &cV, (rect.right - 1 - bV.position.x) / (cV.position.x - bV.position.x),
                               &clip1, varyingCount);
+            clip1.position.x = VectorComp_t_CTR(rect.right - 1);
             right = &clip1;
          } else
             right = &cV;
-         iface->ScanLine(iface, left, right);
+#if USE_HIERARCHICAL_Z
+         if (hiZ) {
+            HiZScanLine(ctx, activeStencil, left, right);
+            break;
+         }
+#endif
+         ShadeScanLine(ctx, activeStencil, left, right);
       } while (false);
+#if USE_HIERARCHICAL_Z
+      if (hiZ && (y & blockMask) == (unsigned)blockMask) {
+         const unsigned row = (y / GGL_RASTER_BLOCK_SIZE) * ctx->hiZ.blocksX;
+         for (int x = coveredLeft; x <= coveredRight; x += GGL_RASTER_BLOCK_SIZE)
+            HiZCovered(ctx, row + x / GGL_RASTER_BLOCK_SIZE, zMin, zMax);
+         coveredRight = -1;
+      }
+#endif
       for (unsigned i = 0; i < varyingCount; i++) {
          bV.varyings[i] += bDx.varyings[i];
          cV.varyings[i] += cDx.varyings[i];
@@ -323,20 +314,264 @@ static void RasterTrapezoid(const GGLInterface * iface, const VertexOutput * tl,
       bV.frontFacingPointCoord += bDx.frontFacingPointCoord;
       cV.frontFacingPointCoord += cDx.frontFacingPointCoord;
    }
+}
+
+// fills fast cleared tiles under bounding box of a, b, c and d before rastering it immediately
+static void ResolveBounds(const GGLContext * ctx, const VertexOutput * a, const VertexOutput * b,
+                          const VertexOutput * c, const VertexOutput * d)
+{
+   if (!ctx->fastClear.pending)
+      return;
+   GGLRect rect;
+   rect.left = MAX2((int)MIN2(MIN2(a->position.x, b->position.x), MIN2(c->position.x, d->position.x)),
+                    ctx->clipRect.left);
+   rect.top = MAX2((int)MIN2(MIN2(a->position.y, b->position.y), MIN2(c->position.y, d->position.y)),
+                   ctx->clipRect.top);
+   rect.right = MIN2((int)MAX2(MAX2(a->position.x, b->position.x), MAX2(c->position.x, d->position.x)) + 1,
+                     ctx->clipRect.right);
+   rect.bottom = MIN2((int)MAX2(MAX2(a->position.y, b->position.y), MAX2(c->position.y, d->position.y)) + 1,
+                      ctx->clipRect.bottom);
+   if (rect.left < rect.right && rect.top < rect.bottom)
+      ResolveRect(ctx, rect);
+}
+
+static void SubmitTriangle(const GGLContext * ctx, const VertexOutput * v1,
+                           const VertexOutput * v2, const VertexOutput * v3);
 
-#if USE_DUAL_THREAD
-   if (args.assignedWork)
-   {
-      pthread_cond_wait(&args.finishCond, &args.finishLock);
-      args.assignedWork = false;
+// bins trapezoid when raster threads are used, otherwise rasters it immediately
+static void SubmitTrapezoid(const GGLContext * ctx, const VertexOutput * tl,
+                            const VertexOutput * tr, const VertexOutput * bl,
+                            const VertexOutput * br)
+{
+#if USE_QUAD_RASTER
+   if (ctx->shaderFunctions.quadOnly) { // only quads compute derivatives
+      SubmitTriangle(ctx, tl, tr, bl);
+      SubmitTriangle(ctx, tr, br, bl);
+      return;
    }
 #endif
+   if (ctx->state.statistics)
+      ctx->stats.trapezoids++;
+#if USE_TILED_RASTER
+   if (ctx->rasterPool.threadCount > 1)
+      return BinTrapezoid(ctx, tl, tr, bl, br);
+#endif
+   ResolveBounds(ctx, tl, tr, bl, br);
+   if (ctx->clipRect.left < ctx->clipRect.right && ctx->clipRect.top < ctx->clipRect.bottom)
+      RasterTrapezoidRect(ctx, tl, tr, bl, br, &ctx->activeStencil, ctx->clipRect);
 }
 
-static void RasterTriangle(const GGLInterface * iface, const VertexOutput * v1,
-                           const VertexOutput * v2, const VertexOutput * v3)
+static void RasterTrapezoid(const GGLInterface * iface, const VertexOutput * tl,
+                            const VertexOutput * tr, const VertexOutput * bl,
+                            const VertexOutput * br)
 {
    GGL_GET_CONST_CONTEXT(ctx, iface);
+   SubmitTrapezoid(ctx, tl, tr, bl, br);
+#if USE_TILED_RASTER
+   SetProgramBinned(ctx);
+#endif
+}
+
+#if USE_QUAD_RASTER
+
+// screen space gradients of f across triangle 123, d* are differences of vertex position
+static inline void Gradient(const Vector4 & f1, const Vector4 & f2, const Vector4 & f3,
+                            const VectorComp_t dx21, const VectorComp_t dy21,
+                            const VectorComp_t dx31, const VectorComp_t dy31,
+                            const VectorComp_t areaInv, Vector4 * ddx, Vector4 * ddy)
+{
+   Vector4 f21(f2), f31(f3), tmp;
+   f21 -= f1;
+   f31 -= f1;
+   (*ddx = f21) *= dy31;
+   (tmp = f31) *= dy21;
+   *ddx -= tmp;
+   *ddx *= areaInv;
+   (*ddy = f31) *= dx21;
+   (tmp = f21) *= dx31;
+   *ddy -= tmp;
+   *ddy *= areaInv;
+}
+
+static inline void StepVertex(VertexOutput * v, const VertexOutput & d, const VectorComp_t x,
+                              const unsigned varyingCount)
+{
+   Vector4 step;
+   (step = d.position) *= x;
+   v->position += step;
+   for (unsigned i = 0; i < varyingCount; i++) {
+      (step = d.varyings[i]) *= x;
+      v->varyings[i] += step;
+   }
+   (step = d.frontFacingPointCoord) *= x;
+   v->frontFacingPointCoord += step;
+}
+
+void RasterTriangleRect(const GGLContext * ctx, const VertexOutput * v1, const VertexOutput * v2,
+                        const VertexOutput * v3, GGLActiveStencil * activeStencil, const GGLRect & rect)
+{
+   const ShaderFunction_t quadShader = ctx->shaderFunctions.fragmentBatch;
+   const ScanLineFunction_t quadScanLine = ctx->shaderFunctions.quadScanLine;
+   const float (* const constants)[4] = ctx->CurrentProgram->ValuesUniform;
+   const unsigned varyingCount = ctx->CurrentProgram->VaryingSlots;
+   GGLStatistics * const stats = ctx->state.statistics ? &ctx->stats : NULL;
+   assert(quadShader && quadScanLine);
+
+   VectorComp_t area = (v2->position.x - v1->position.x) * (v3->position.y - v1->position.y) -
+                       (v3->position.x - v1->position.x) * (v2->position.y - v1->position.y);
+   if (!(area > 0 || area < 0)) // degenerate or NaN
+      return;
+   if (area < 0) { // make edge functions positive inside
+      const VertexOutput * tmp = v2;
+      v2 = v3;
+      v3 = tmp;
+      area = -area;
+   }
+
+   const VectorComp_t dx21 = v2->position.x - v1->position.x, dy21 = v2->position.y - v1->position.y;
+   const VectorComp_t dx31 = v3->position.x - v1->position.x, dy31 = v3->position.y - v1->position.y;
+   const VectorComp_t areaInv = VectorComp_t_One / area;
+
+   // plane equations, value at pixel center (x, y) is v1 + ddx * (x - x1) + ddy * (y - y1)
+   VertexOutput ddx, ddy;
+   Gradient(v1->position, v2->position, v3->position, dx21, dy21, dx31, dy31, areaInv,
+            &ddx.position, &ddy.position);
+   for (unsigned i = 0; i < varyingCount; i++)
+      Gradient(v1->varyings[i], v2->varyings[i], v3->varyings[i], dx21, dy21, dx31, dy31, areaInv,
+               ddx.varyings + i, ddy.varyings + i);
+   Gradient(v1->frontFacingPointCoord, v2->frontFacingPointCoord, v3->frontFacingPointCoord,
+            dx21, dy21, dx31, dy31, areaInv, &ddx.frontFacingPointCoord, &ddy.frontFacingPointCoord);
+   ddx.frontFacingPointCoord.y = ddy.frontFacingPointCoord.y = VectorComp_t_Zero; // gl_FrontFacing
+
+   // edge function i is a * x + b * y + c, positive inside, for edges 12, 23 and 31
+   const VertexOutput * const vertices[3] = {v1, v2, v3};
+   VectorComp_t a[3], b[3], c[3];
+   bool topLeft[3]; // pixel centers exactly on top and left edges are inside
+   for (unsigned i = 0; i < 3; i++) {
+      const Vector4 & p = vertices[i]->position, & q = vertices[(i + 1) % 3]->position;
+      a[i] = p.y - q.y;
+      b[i] = q.x - p.x;
+      c[i] = -(a[i] * p.x + b[i] * p.y);
+      topLeft[i] = a[i] > 0 || (0 == a[i] && b[i] > 0);
+   }
+
+   // pixel bounds inside rect
+   const VectorComp_t minX = MIN2(MIN2(v1->position.x, v2->position.x), v3->position.x);
+   const VectorComp_t maxX = MAX2(MAX2(v1->position.x, v2->position.x), v3->position.x);
+   const VectorComp_t minY = MIN2(MIN2(v1->position.y, v2->position.y), v3->position.y);
+   const VectorComp_t maxY = MAX2(MAX2(v1->position.y, v2->position.y), v3->position.y);
+   if (maxX < rect.left || minX >= rect.right || maxY < rect.top || minY >= rect.bottom)
+      return;
+   const int left = MAX2((int)minX, rect.left), right = MIN2((int)maxX, rect.right - 1);
+   const int top = MAX2((int)minY, rect.top), bottom = MIN2((int)maxY, rect.bottom - 1);
+
+   VertexOutput quad[4], step;
+   memset(&step, 0, sizeof(step)); // quad scanline shades 1 pixel, step is unused
+   const int blockMask = GGL_RASTER_BLOCK_SIZE - 1;
+#if USE_HIERARCHICAL_Z
+   const bool hiZ = ctx->hiZ.bounds && ctx->state.bufferState.depthTest;
+   const VectorComp_t triZMin = MIN2(MIN2(v1->position.z, v2->position.z), v3->position.z);
+   const VectorComp_t triZMax = MAX2(MAX2(v1->position.z, v2->position.z), v3->position.z);
+   const VectorComp_t blockZx = ddx.position.z * blockMask, blockZy = ddy.position.z * blockMask;
+#endif
+   for (int by = top & ~blockMask; by <= bottom; by += GGL_RASTER_BLOCK_SIZE)
+      for (int bx = left & ~blockMask; bx <= right; bx += GGL_RASTER_BLOCK_SIZE) {
+         // reject block if the pixel center maximizing an edge function is outside
+         bool outside = false;
+         for (unsigned i = 0; i < 3 && !outside; i++) {
+            const VectorComp_t x = bx + (a[i] > 0 ? blockMask : 0) + 0.5f;
+            const VectorComp_t y = by + (b[i] > 0 ? blockMask : 0) + 0.5f;
+            outside = a[i] * x + b[i] * y + c[i] < 0;
+         }
+         if (outside)
+            continue;
+
+#if USE_HIERARCHICAL_Z
+         // depth plane is extreme at block corners and bounded by the vertices
+         VectorComp_t zMin = 0, zMax = 0;
+         bool covered = false;
+         const unsigned block = (by / GGL_RASTER_BLOCK_SIZE) * ctx->hiZ.blocksX + bx / GGL_RASTER_BLOCK_SIZE;
+         if (hiZ) {
+            const VectorComp_t z = v1->position.z + ddx.position.z * (bx + 0.5f - v1->position.x) +
+                                   ddy.position.z * (by + 0.5f - v1->position.y);
+            zMin = MAX2(z + MIN2(blockZx, 0) + MIN2(blockZy, 0), triZMin);
+            zMax = MIN2(z + MAX2(blockZx, 0) + MAX2(blockZy, 0), triZMax);
+            if (!HiZVisible(ctx, block, zMin, zMax))
+               continue;
+            covered = bx >= left && bx + blockMask <= right && by >= top && by + blockMask <= bottom;
+            for (unsigned i = 0; i < 3 && covered; i++) // minimum of edge function at a corner
+               covered = a[i] * (bx + (a[i] > 0 ? 0 : blockMask) + 0.5f) +
+                         b[i] * (by + (b[i] > 0 ? 0 : blockMask) + 0.5f) + c[i] > 0;
+         }
+#endif
+
+         for (int qy = by; qy < by + GGL_RASTER_BLOCK_SIZE; qy += 2)
+            for (int qx = bx; qx < bx + GGL_RASTER_BLOCK_SIZE; qx += 2) {
+               unsigned mask = 0; // covered pixels of quad
+               for (unsigned p = 0; p < 4; p++) {
+                  const int x = qx + (p & 1), y = qy + (p >> 1);
+                  if (x < left || x > right || y < top || y > bottom)
+                     continue;
+                  bool inside = true;
+                  for (unsigned i = 0; i < 3 && inside; i++) {
+                     const VectorComp_t e = a[i] * (x + 0.5f) + b[i] * (y + 0.5f) + c[i];
+                     inside = e > 0 || (0 == e && topLeft[i]);
+                  }
+                  mask |= inside << p;
+               }
+               if (!mask)
+                  continue;
+
+               // uncovered pixels of the quad are shaded only for derivatives
+               quad[0] = *v1;
+               StepVertex(quad + 0, ddx, qx + 0.5f - v1->position.x, varyingCount);
+               StepVertex(quad + 0, ddy, qy + 0.5f - v1->position.y, varyingCount);
+               quad[1] = quad[0];
+               StepVertex(quad + 1, ddx, VectorComp_t_One, varyingCount);
+               quad[2] = quad[0];
+               StepVertex(quad + 2, ddy, VectorComp_t_One, varyingCount);
+               quad[3] = quad[2];
+               StepVertex(quad + 3, ddx, VectorComp_t_One, varyingCount);
+               quadShader(quad, quad, constants);
+               if (stats) // raster threads share stats
+                  __sync_fetch_and_add(&stats->fragmentsShaded, 4);
+
+               for (unsigned p = 0; p < 4; p++) {
+                  if (!(mask & (1 << p)))
+                     continue;
+                  const unsigned x = qx + (p & 1), y = qy + (p >> 1);
+                  quadScanLine(quad + p, &step, constants, SurfaceAddress(ctx->frameSurface, x, y),
+                               (int *)SurfaceAddress(ctx->depthSurface, x, y),
+                               (unsigned char *)SurfaceAddress(ctx->stencilSurface, x, y),
+                               activeStencil, 1, stats);
+               }
+            }
+#if USE_HIERARCHICAL_Z
+         if (covered)
+            HiZCovered(ctx, block, zMin, zMax);
+#endif
+      }
+}
+
+#endif // #if USE_QUAD_RASTER
+
+// splits triangle into trapezoids and submits them, does not flush tiles;
+// triangles of programs with a quad fragment shader are submitted whole for RasterTriangleRect
+static void SubmitTriangle(const GGLContext * ctx, const VertexOutput * v1,
+                           const VertexOutput * v2, const VertexOutput * v3)
+{
+#if USE_QUAD_RASTER
+   if (ctx->shaderFunctions.quadScanLine) {
+#if USE_TILED_RASTER
+      if (ctx->rasterPool.threadCount > 1)
+         return BinTriangle(ctx, v1, v2, v3);
+#endif
+      ResolveBounds(ctx, v1, v2, v3, v3);
+      if (ctx->clipRect.left < ctx->clipRect.right && ctx->clipRect.top < ctx->clipRect.bottom)
+         RasterTriangleRect(ctx, v1, v2, v3, &ctx->activeStencil, ctx->clipRect);
+      return;
+   }
+#endif
    const unsigned varyingCount = ctx->CurrentProgram->VaryingSlots;
    const unsigned height = ctx->frameSurface.height;
    const VertexOutput * a = v1, * b = v2, * d = v3;
@@ -374,11 +609,206 @@ static void RasterTriangle(const GGLInterface * iface, const VertexOutput * v1,
    }
 
    if ((int)a->position.y < (int)height && (int)b->position.y >= 0)
-      RasterTrapezoid(iface, a, a, b, c);
+      SubmitTrapezoid(ctx, a, a, b, c);
    //b->position.y += VectorComp_t_One;
    //c->position.y += VectorComp_t_One;
    if ((int)b->position.y < (int)height && (int)d->position.y >= 0)
-      RasterTrapezoid(iface, b, c, d, d);
+      SubmitTrapezoid(ctx, b, c, d, d);
+}
+
+static void RasterTriangle(const GGLInterface * iface, const VertexOutput * v1,
+                           const VertexOutput * v2, const VertexOutput * v3)
+{
+   GGL_GET_CONST_CONTEXT(ctx, iface);
+   SubmitTriangle(ctx, v1, v2, v3);
+#if USE_TILED_RASTER
+   SetProgramBinned(ctx);
+#endif
+}
+
+// perspective divide and viewport transform of a vertex shader output
+static inline void TransformVertex(const GGLInterface * iface, VertexOutput * v)
+{
+   v->position /= v->position.w;
+   iface->ViewportTransform(iface, &v->position);
+}
+
+static void Culled(const GGLContext * ctx)
+{
+   if (ctx->state.statistics)
+      ctx->stats.trianglesCulled++;
+}
+
+// rejects scissored, zero area and culled window space triangle, then selects stencil face and submits it;
+// gl_FrontFacing of the vertices is written, so vertices shared between triangles are fine
+static void CullTriangle(const GGLInterface * iface, VertexOutput * v1,
+                         VertexOutput * v2, VertexOutput * v3)
+{
+   GGL_GET_CONST_CONTEXT(ctx, iface);
+   const GGLRect & clip = ctx->clipRect; // reject outside scissor box before any setup
+   if (MAX2(MAX2(v1->position.x, v2->position.x), v3->position.x) < clip.left ||
+         MIN2(MIN2(v1->position.x, v2->position.x), v3->position.x) >= clip.right ||
+         MAX2(MAX2(v1->position.y, v2->position.y), v3->position.y) < clip.top ||
+         MIN2(MIN2(v1->position.y, v2->position.y), v3->position.y) >= clip.bottom)
+      return Culled(ctx);
+
+   VectorComp_t area;
+   area = v1->position.x * v2->position.y - v2->position.x * v1->position.y;
+   area += v2->position.x * v3->position.y - v3->position.x * v2->position.y;
+   area += v3->position.x * v1->position.y - v1->position.x * v3->position.y;
+   area *= 0.5f;
+
+   if (!(area > 0 || area < 0)) // degenerate or NaN, covers no pixel centers
+      return Culled(ctx);
+
+   if (GL_CCW == ctx->cullState.frontFace + GL_CW)
+      (unsigned &)area ^= 0x80000000;
+
+   if (ctx->cullState.enable) {
+      switch (ctx->cullState.cullFace + GL_FRONT) {
+      case GL_FRONT:
+         if (!((unsigned &)area & 0x80000000)) // +ve, front facing
+            return Culled(ctx);
+         break;
+      case GL_BACK:
+         if ((unsigned &)area & 0x80000000) // -ve, back facing
+            return Culled(ctx);
+         break;
+      case GL_FRONT_AND_BACK:
+         return Culled(ctx);
+      default:
+         assert(0);
+      }
+   }
+
+   v1->frontFacingPointCoord.y = v2->frontFacingPointCoord.y =
+                                    v3->frontFacingPointCoord.y = !((unsigned &)area & 0x80000000) ?
+                                                                  VectorComp_t_One : VectorComp_t_Zero;
+
+   iface->StencilSelect(iface, ((unsigned &)area & 0x80000000) ? GL_BACK : GL_FRONT);
+
+   SubmitTriangle(ctx, v1, v2, v3);
+}
+
+// clip space planes, bit i of an outcode is set when ClipDistance to plane i is negative;
+// x and y are clipped against the guard band, and only rejected against the frustum
+enum {
+   CLIP_LEFT = 1 << 0, CLIP_RIGHT = 1 << 1, CLIP_BOTTOM = 1 << 2, CLIP_TOP = 1 << 3,
+   CLIP_NEAR = 1 << 4, CLIP_FAR = 1 << 5,
+   CLIP_GUARD_LEFT = 1 << 6, CLIP_GUARD_RIGHT = 1 << 7, CLIP_GUARD_BOTTOM = 1 << 8, CLIP_GUARD_TOP = 1 << 9,
+   CLIP_PLANE_COUNT = 10,
+   CLIP_FRUSTUM = CLIP_LEFT | CLIP_RIGHT | CLIP_BOTTOM | CLIP_TOP | CLIP_NEAR | CLIP_FAR,
+   CLIP_CLIPPED = CLIP_NEAR | CLIP_FAR | CLIP_GUARD_LEFT | CLIP_GUARD_RIGHT | CLIP_GUARD_BOTTOM | CLIP_GUARD_TOP
+};
+
+// signed distance of clip space p to plane, guard band is guardX and guardY times the frustum
+static inline VectorComp_t ClipDistance(const Vector4 & p, const unsigned plane,
+                                        const VectorComp_t guardX, const VectorComp_t guardY)
+{
+   switch (plane) {
+   case 0:
+      return p.w + p.x;
+   case 1:
+      return p.w - p.x;
+   case 2:
+      return p.w + p.y;
+   case 3:
+      return p.w - p.y;
+   case 4:
+      return p.w + p.z;
+   case 5:
+      return p.w - p.z;
+   case 6:
+      return guardX * p.w + p.x;
+   case 7:
+      return guardX * p.w - p.x;
+   case 8:
+      return guardY * p.w + p.y;
+   default:
+      return guardY * p.w - p.y;
+   }
+}
+
+static inline unsigned OutCode(const Vector4 & p, const VectorComp_t guardX, const VectorComp_t guardY)
+{
+   unsigned code = 0;
+   for (unsigned plane = 0; plane < CLIP_PLANE_COUNT; plane++)
+      code |= (ClipDistance(p, plane, guardX, guardY) < 0) << plane;
+   return code;
+}
+
+// primitive setup of a vertex shaded clip space triangle: rejects it if it is outside a frustum
+// plane, clips it to the near and far planes and the guard band, then transforms copies of the
+// vertices to window space for CullTriangle, so shaded vertices can be shared between triangles
+static void SetupTriangle(const GGLInterface * iface, const VertexOutput * v1,
+                          const VertexOutput * v2, const VertexOutput * v3)
+{
+   GGL_GET_CONST_CONTEXT(ctx, iface);
+   // window space positions stay within GGL_GUARD_BAND pixels of viewport center
+   const VectorComp_t guardX = VectorComp_t_CTR(GGL_GUARD_BAND) / MAX2(ctx->viewport.w, VectorComp_t_One);
+   const VectorComp_t guardY = VectorComp_t_CTR(GGL_GUARD_BAND) / MAX2(ctx->viewport.h, VectorComp_t_One);
+   const unsigned code1 = OutCode(v1->position, guardX, guardY);
+   const unsigned code2 = OutCode(v2->position, guardX, guardY);
+   const unsigned code3 = OutCode(v3->position, guardX, guardY);
+   if (ctx->state.statistics)
+      ctx->stats.trianglesSubmitted++;
+   if (code1 & code2 & code3 & CLIP_FRUSTUM)
+      return Culled(ctx);
+
+   VertexOutput window[3 + 6]; // clipped polygon in window space
+   const unsigned crossed = (code1 | code2 | code3) & CLIP_CLIPPED;
+   if (!crossed) {
+      window[0] = *v1;
+      window[1] = *v2;
+      window[2] = *v3;
+      for (unsigned i = 0; i < 3; i++)
+         TransformVertex(iface, window + i);
+      return CullTriangle(iface, window, window + 1, window + 2);
+   }
+
+   if (ctx->state.statistics)
+      ctx->stats.trianglesClipped++;
+   // Sutherland-Hodgman against crossed planes; each plane adds at most 1 vertex and creates 2
+   const unsigned varyingCount = ctx->CurrentProgram->VaryingSlots;
+   VertexOutput created[2 * 6];
+   unsigned createdCount = 0;
+   const VertexOutput * polygons[2][3 + 6] = {{v1, v2, v3}};
+   const VertexOutput ** polygon = polygons[0];
+   unsigned count = 3;
+   for (unsigned plane = 0; plane < CLIP_PLANE_COUNT; plane++) {
+      if (!(crossed & (1 << plane)))
+         continue;
+      const VertexOutput ** const clipped = polygons[polygon == polygons[0]];
+      unsigned clippedCount = 0;
+      for (unsigned i = 0; i < count; i++) {
+         const VertexOutput * a = polygon[i], * b = polygon[(i + 1) % count];
+         const VectorComp_t da = ClipDistance(a->position, plane, guardX, guardY);
+         const VectorComp_t db = ClipDistance(b->position, plane, guardX, guardY);
+         if (da >= 0)
+            clipped[clippedCount++] = a;
+         if ((da >= 0) == (db >= 0))
+            continue;
+         // interpolate from inside vertex, so an edge shared by two triangles is cut the same
+         assert(createdCount < sizeof(created) / sizeof(*created));
+         VertexOutput * v = created + createdCount++;
+         if (da >= 0)
+            InterpolateVertex(a, b, da / (da - db), v, varyingCount);
+         else
+            InterpolateVertex(b, a, db / (db - da), v, varyingCount);
+         clipped[clippedCount++] = v;
+      }
+      polygon = clipped;
+      count = clippedCount;
+      if (count < 3)
+         return Culled(ctx);
+   }
+
+   for (unsigned i = 0; i < count; i++) {
+      window[i] = *polygon[i];
+      TransformVertex(iface, window + i);
+   }
+   for (unsigned i = 2; i < count; i++) // fan keeps winding of the triangle
+      CullTriangle(iface, window, window + i - 1, window + i);
 }
 
 static void DrawTriangle(const GGLInterface * iface, const VertexInput * vin1,
@@ -464,17 +894,6 @@ static void DrawTriangle(const GGLInterface * iface, const VertexInput * vin1,
 //        v2->position.x, v2->position.y, v2->position.z, v2->position.w,
 //        v3->position.x, v3->position.y, v3->position.z, v3->position.w);
 
-   v1->position /= v1->position.w;
-   v2->position /= v2->position.w;
-   v3->position /= v3->position.w;
-
-//   ALOGD("pf2: DrawTriangle divided %.02f,%.02f \t %.02f,%.02f \t %.02f,%.02f", v1->position.x, v1->position.y,
-//      v2->position.x, v2->position.y, v3->position.x, v3->position.y);
-
-   iface->ViewportTransform(iface, &v1->position);
-   iface->ViewportTransform(iface, &v2->position);
-   iface->ViewportTransform(iface, &v3->position);
-
 //   if (strstr(program->Shaders[MESA_SHADER_FRAGMENT]->Source,
 //              "gl_FragColor = color * texture2D(sampler, outTexCoords).a;")) {
 ////      ALOGD("%s", program->Shaders[MESA_SHADER_FRAGMENT]->Source);
@@ -495,73 +914,186 @@ static void DrawTriangle(const GGLInterface * iface, const VertexInput * vin1,
 //        v2->varyings[0].x, v2->varyings[0].y, v2->varyings[0].z, v2->varyings[0].w,
 //        v3->varyings[0].x, v3->varyings[0].y, v3->varyings[0].z, v3->varyings[0].w);
 
-   VectorComp_t area;
-   area = v1->position.x * v2->position.y - v2->position.x * v1->position.y;
-   area += v2->position.x * v3->position.y - v3->position.x * v2->position.y;
-   area += v3->position.x * v1->position.y - v1->position.x * v3->position.y;
-   area *= 0.5f;
 
-   if (GL_CCW == ctx->cullState.frontFace + GL_CW)
-      (unsigned &)area ^= 0x80000000;
+   SetupTriangle(iface, v1, v2, v3);
+#if USE_TILED_RASTER
+   SetProgramBinned(ctx);
+#endif
 
-   if (false && ctx->cullState.enable) { // TODO: turn off for now
-      switch (ctx->cullState.cullFace + GL_FRONT) {
-      case GL_FRONT:
-         if (!((unsigned &)area & 0x80000000)) // +ve, front facing
-            return;
-         break;
-      case GL_BACK:
-         if ((unsigned &)area & 0x80000000) // -ve, back facing
-            return;
-         break;
-      case GL_FRONT_AND_BACK:
-         return;
-      default:
-         assert(0);
+//   ALOGD("pf2: DrawTriangle end");
+
+}
+
+// returns index of element i in GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT or GL_UNSIGNED_INT indices
+static inline unsigned ElementIndex(const GLenum type, const GLvoid * indices, const unsigned i)
+{
+   switch (type) {
+   case GL_UNSIGNED_BYTE:
+      return ((const GLubyte *)indices)[i];
+   case GL_UNSIGNED_SHORT:
+      return ((const GLushort *)indices)[i];
+   default:
+      return ((const GLuint *)indices)[i];
+   }
+}
+
+// FIFO post-transform cache of shaded clip space vertices for indexed draws; it lives for one draw call,
+// so entries are implicitly keyed by program and vertex array as well as index
+struct VertexCache {
+   VertexOutput outputs[GGL_VERTEX_CACHE_SIZE];
+   unsigned indices[GGL_VERTEX_CACHE_SIZE];
+   unsigned next; // oldest entry, replaced on miss
+};
+
+// returns shaded vertex for index, shading it on a miss;
+// pin0 and pin1 are vertices of the current triangle that must not be replaced
+static VertexOutput * CachedVertex(const GGLInterface * iface, VertexCache * cache,
+                                   const VertexInput * vertices, const unsigned index,
+                                   const VertexOutput * pin0, const VertexOutput * pin1)
+{
+   GGL_GET_CONST_CONTEXT(ctx, iface);
+   for (unsigned i = 0; i < GGL_VERTEX_CACHE_SIZE; i++)
+      if (index == cache->indices[i]) {
+         ctx->stats.vertexCacheHits++;
+         return cache->outputs + i;
       }
+   ctx->stats.vertexCacheMisses++;
+   while (cache->outputs + cache->next == pin0 || cache->outputs + cache->next == pin1)
+      cache->next = (cache->next + 1) % GGL_VERTEX_CACHE_SIZE;
+   VertexOutput * output = cache->outputs + cache->next;
+   cache->indices[cache->next] = index;
+   cache->next = (cache->next + 1) % GGL_VERTEX_CACHE_SIZE;
+   iface->ProcessVertex(iface, vertices + index, output);
+   return output;
+}
+
+// shades indexed elements through VertexCache, sets up all triangles, and shades tiles once
+static void DrawIndexedBatch(const GGLInterface * iface, const GLenum mode, const VertexInput * vertices,
+                             const unsigned triangleCount, const GLenum type, const GLvoid * indices)
+{
+   VertexCache cache;
+   memset(cache.outputs, 0, sizeof(cache.outputs)); // shader writes the same outputs for every vertex
+   memset(cache.indices, 0xff, sizeof(cache.indices));
+   cache.next = 0;
+
+   for (unsigned triangle = 0; triangle < triangleCount; triangle++) {
+      unsigned e1, e2, e3; // element positions
+      if (GL_TRIANGLES == mode) {
+         e1 = triangle * 3;
+         e2 = e1 + 1;
+         e3 = e1 + 2;
+      } else if (GL_TRIANGLE_STRIP == mode) {
+         e1 = triangle + (triangle & 1); // odd triangles are flipped to keep winding
+         e2 = triangle + !(triangle & 1);
+         e3 = triangle + 2;
+      } else {
+         e1 = 0;
+         e2 = triangle + 1;
+         e3 = triangle + 2;
+      }
+      VertexOutput * v1 = CachedVertex(iface, &cache, vertices, ElementIndex(type, indices, e1), NULL, NULL);
+      VertexOutput * v2 = CachedVertex(iface, &cache, vertices, ElementIndex(type, indices, e2), v1, NULL);
+      VertexOutput * v3 = CachedVertex(iface, &cache, vertices, ElementIndex(type, indices, e3), v1, v2);
+      SetupTriangle(iface, v1, v2, v3);
    }
+}
 
-   v1->frontFacingPointCoord.y = v2->frontFacingPointCoord.y =
-                                    v3->frontFacingPointCoord.y = !((unsigned &)area & 0x80000000) ?
-                                                                  VectorComp_t_One : VectorComp_t_Zero;
+// shades each element of the batch once in chunks of GGL_DRAW_BATCH_VERTICES, sets up all
+// triangles of a chunk, and shades tiles once for the whole batch;
+// indices is NULL for DrawArrays, where element i is vertex first + i,
+// otherwise elements are shaded through VertexCache
+static void DrawBatch(const GGLInterface * iface, const GLenum mode, const VertexInput * vertices,
+                      const GLint first, const GLsizei count, const GLenum type, const GLvoid * indices)
+{
+   GGL_GET_CONST_CONTEXT(ctx, iface);
 
-   iface->StencilSelect(iface, ((unsigned &)area & 0x80000000) ? GL_BACK : GL_FRONT);
+   unsigned triangleCount = 0;
+   if (GL_TRIANGLES == mode)
+      triangleCount = count / 3;
+   else if (GL_TRIANGLE_STRIP == mode || GL_TRIANGLE_FAN == mode)
+      triangleCount = count > 2 ? count - 2 : 0;
+   else
+      return gglError(GL_INVALID_ENUM);
+   if (count < 0)
+      return gglError(GL_INVALID_VALUE);
+   if (indices && GL_UNSIGNED_BYTE != type && GL_UNSIGNED_SHORT != type && GL_UNSIGNED_INT != type)
+      return gglError(GL_INVALID_ENUM);
+
+   if (indices) {
+      DrawIndexedBatch(iface, mode, vertices, triangleCount, type, indices);
+#if USE_TILED_RASTER
+      FlushTiles(ctx);
+#endif
+      return;
+   }
 
-//    if (0)
-//    {
-//        GGLContext * ctx =(GGLContext *)iface;
-//        for (unsigned sampler = 0; sampler < GGL_MAXCOMBINEDTEXTUREIMAGEUNITS; sampler++)
-//        {
-//            if (!((1 << sampler) & ctx->glCtx->Shader.CurrentProgram->FragmentProgram->SamplersUsed))
-//                continue;
-//            const GGLTexture * texture = ctx->textureState.textures + sampler;
-//            int level = texture->width * texture->height / (area * 2) - 4;
-//            assert(texture->levels);
-//            ctx->textureState.textureData[sampler] = texture->levels[0];
-//            ctx->textureState.textureDimensions[sampler * 2] = texture->width;
-//            ctx->textureState.textureDimensions[sampler * 2 + 1] = texture->height;
-//            for (unsigned i = 1; i < texture->levelCount && i <= level; i++)
-//            {
-//                ctx->textureState.textureData[sampler] = texture->levels[i];
-//                ctx->textureState.textureDimensions[sampler * 2] += 1;
-//                ctx->textureState.textureDimensions[sampler * 2] /= 2;
-//                ctx->textureState.textureDimensions[sampler * 2 + 1] += 1;
-//                ctx->textureState.textureDimensions[sampler * 2 + 1] /= 2;
-//            }
-//        }
-//    }
-
-   // TODO DXL view frustum clipping
-   iface->RasterTriangle(iface, v1, v2, v3);
+   // shaded elements [start, end) of current chunk, fan center is element 0
+   VertexOutput shaded[GGL_DRAW_BATCH_VERTICES], center;
+   memset(shaded, 0, sizeof(shaded)); // shader writes the same outputs for every vertex
+   memset(&center, 0, sizeof(center));
+   if (GL_TRIANGLE_FAN == mode && triangleCount)
+      iface->ProcessVertex(iface, vertices + first, &center);
+
+   for (unsigned triangle = 0; triangle < triangleCount; ) {
+      unsigned chunk, start, end;
+      if (GL_TRIANGLES == mode) {
+         chunk = MIN2(triangleCount - triangle, GGL_DRAW_BATCH_VERTICES / 3);
+         start = triangle * 3;
+         end = start + chunk * 3;
+      } else {
+         chunk = MIN2(triangleCount - triangle, GGL_DRAW_BATCH_VERTICES - 2);
+         start = triangle + (GL_TRIANGLE_FAN == mode);
+         end = triangle + chunk + 2;
+      }
 
-//   ALOGD("pf2: DrawTriangle end");
+      ProcessVertices(iface, vertices + first + start, shaded, end - start);
+
+      for (const unsigned last = triangle + chunk; triangle < last; triangle++) {
+         VertexOutput * v1, * v2, * v3;
+         if (GL_TRIANGLES == mode) {
+            v1 = shaded + triangle * 3 - start;
+            v2 = v1 + 1;
+            v3 = v1 + 2;
+         } else if (GL_TRIANGLE_STRIP == mode) {
+            v1 = shaded + triangle - start;
+            v2 = v1 + 1;
+            v3 = v1 + 2;
+            if (triangle & 1) { // odd triangles are flipped to keep winding
+               v1 = v2;
+               v2 = v1 - 1;
+            }
+         } else {
+            v1 = &center;
+            v2 = shaded + triangle + 1 - start;
+            v3 = v2 + 1;
+         }
+         SetupTriangle(iface, v1, v2, v3);
+      }
+   }
 
+#if USE_TILED_RASTER
+   FlushTiles(ctx);
+#endif
+}
+
+static void DrawArrays(const GGLInterface * iface, GLenum mode, const VertexInput * vertices,
+                       GLint first, GLsizei count)
+{
+   DrawBatch(iface, mode, vertices, first, count, GL_NONE, NULL);
+}
+
+static void DrawElements(const GGLInterface * iface, GLenum mode, const VertexInput * vertices,
+                         GLsizei count, GLenum type, const GLvoid * indices)
+{
+   DrawBatch(iface, mode, vertices, 0, count, type, indices);
 }
 
 static void PickRaster(GGLInterface * iface)
 {
    iface->ProcessVertex = ProcessVertex;
    iface->DrawTriangle = DrawTriangle;
+   iface->DrawArrays = DrawArrays;
+   iface->DrawElements = DrawElements;
    iface->RasterTriangle = RasterTriangle;
    iface->RasterTrapezoid = RasterTrapezoid;
 }
@@ -176,39 +176,27 @@ unsigned char StencilOp(const unsigned op, unsigned char s, const unsigned char
 
 #endif // #if !USE_LLVM_SCANLINE
 
-#ifdef USE_LLVM_SCANLINE
-typedef void (* ScanLineFunction_t)(VertexOutput * start, VertexOutput * step,
-                                    const float (*constants)[4], void * frame,
-                                    int * depth, unsigned char * stencil,
-                                    GGLActiveStencil *, unsigned count);
-#endif
-
-void GGLScanLine(const gl_shader_program * program, const GGLPixelFormat colorFormat,
-                 void * frameBuffer, int * depthBuffer, unsigned char * stencilBuffer,
-                 unsigned bufferWidth, unsigned bufferHeight, GGLActiveStencil * activeStencil,
-                 const VertexOutput_t * start, const VertexOutput_t * end, const float (*constants)[4])
+static void ShadeSpan(const ScanLineFunction_t scanLineFunction, const gl_shader_program * program,
+                      const GGLSurface * frameSurface, const GGLSurface * depthSurface,
+                      const GGLSurface * stencilSurface, GGLActiveStencil * activeStencil,
+                      const VertexOutput_t * start, const VertexOutput_t * end,
+                      const float (*constants)[4], GGLStatistics * stats)
 {
 #if !USE_LLVM_SCANLINE
    assert(!"only for USE_LLVM_SCANLINE");
 #endif
 
 //   ALOGD("pf2: GGLScanLine program=%p format=0x%.2X frameBuffer=%p depthBuffer=%p stencilBuffer=%p ",
-//      program, colorFormat, frameBuffer, depthBuffer, stencilBuffer);
+//      program, frameSurface->format, frameSurface->data, depthSurface->data, stencilSurface->data);
 
    const unsigned int varyingCount = program->VaryingSlots;
    const unsigned y = start->position.y, startX = start->position.x,
                       endX = end->position.x;
 
-   assert(bufferWidth > startX && bufferWidth > endX);
-   assert(bufferHeight > y);
+   assert(frameSurface->width > startX && frameSurface->width > endX);
+   assert(frameSurface->height > y);
 
-   char * frame = (char *)frameBuffer;
-   if (GGL_PIXEL_FORMAT_RGBA_8888 == colorFormat)
-      frame += (y * bufferWidth + startX) * 4;
-   else if (GGL_PIXEL_FORMAT_RGB_565 == colorFormat)
-      frame += (y * bufferWidth + startX) * 2;
-   else 
-      assert(0);
+   void * const frame = SurfaceAddress(*frameSurface, startX, y);
    const VectorComp_t div = VectorComp_t_CTR(1 / (float)(endX - startX));
 
    //memcpy(ctx->glCtx->CurrentProgram->ValuesVertexOutput, start, sizeof(*start));
@@ -228,28 +216,62 @@ void GGLScanLine(const gl_shader_program * program, const GGLPixelFormat colorFo
    vertexDx.frontFacingPointCoord *= div; // gl_PointCoord, only zw
    vertexDx.frontFacingPointCoord.y = 0; // gl_FrontFacing not interpolated
 
-   int * depth = depthBuffer + y * bufferWidth + startX;
-   unsigned char * stencil = stencilBuffer + y * bufferWidth + startX;
+   int * const depth = (int *)SurfaceAddress(*depthSurface, startX, y);
+   unsigned char * const stencil = (unsigned char *)SurfaceAddress(*stencilSurface, startX, y);
 
    // TODO DXL consider inverting gl_FragCoord.y
-   ScanLineFunction_t scanLineFunction = (ScanLineFunction_t)
-                                         program->_LinkedShaders[MESA_SHADER_FRAGMENT]->function;
 //   ALOGD("pf2 GGLScanLine scanline=%p start=%p constants=%p", scanLineFunction, &vertex, constants);
    if (endX >= startX)
-      scanLineFunction(&vertex, &vertexDx, constants, frame, depth, stencil, activeStencil, endX - startX + 1);
+      scanLineFunction(&vertex, &vertexDx, constants, frame, depth, stencil, activeStencil,
+                       endX - startX + 1, stats);
+   if (stats) // raster threads share stats
+      __sync_fetch_and_add(&stats->scanLines, 1);
 
 //   ALOGD("pf2: GGLScanLine end");
 
 }
 
+void GGLScanLine(const gl_shader_program * program, const GGLSurface * frameSurface,
+                 const GGLSurface * depthSurface, const GGLSurface * stencilSurface,
+                 GGLActiveStencil * activeStencil, const VertexOutput_t * start,
+                 const VertexOutput_t * end, const float (*constants)[4], GGLStatistics * stats)
+{
+   ShadeSpan((ScanLineFunction_t)program->_LinkedShaders[MESA_SHADER_FRAGMENT]->function, program,
+             frameSurface, depthSurface, stencilSurface, activeStencil, start, end, constants, stats);
+}
+
+void ShadeScanLine(const GGLContext * ctx, GGLActiveStencil * activeStencil,
+                   const VertexOutput * start, const VertexOutput * end)
+{
+   ShadeSpan(ctx->shaderFunctions.scanLine, ctx->CurrentProgram, &ctx->frameSurface,
+             &ctx->depthSurface, &ctx->stencilSurface, activeStencil, start, end,
+             ctx->CurrentProgram->ValuesUniform, ctx->state.statistics ? &ctx->stats : NULL);
+}
+
 template <bool StencilTest, bool DepthTest, bool DepthWrite, bool BlendEnable>
 void ScanLine(const GGLInterface * iface, const VertexOutput * start, const VertexOutput * end)
 {
    GGL_GET_CONST_CONTEXT(ctx, iface);
-   GGLScanLine(ctx->CurrentProgram, ctx->frameSurface.format, ctx->frameSurface.data,
-               (int *)ctx->depthSurface.data, (unsigned char *)ctx->stencilSurface.data,
-               ctx->frameSurface.width, ctx->frameSurface.height, &ctx->activeStencil,
-               start, end, ctx->CurrentProgram->ValuesUniform);
+   FlushBinned(ctx); // shaded now, so after primitives still binned
+   if (ctx->fastClear.pending) {
+      GGLRect span;
+      span.left = start->position.x;
+      span.top = start->position.y;
+      span.right = end->position.x + 1;
+      span.bottom = span.top + 1;
+      ResolveRect(ctx, span);
+   }
+#if USE_HIERARCHICAL_Z
+   if (ctx->hiZ.bounds && ctx->state.bufferState.depthTest) { // widen bounds for depths written
+      const unsigned row = ((unsigned)start->position.y / GGL_RASTER_BLOCK_SIZE) * ctx->hiZ.blocksX;
+      const VectorComp_t zMin = MIN2(start->position.z, end->position.z);
+      const VectorComp_t zMax = MAX2(start->position.z, end->position.z);
+      for (unsigned x = (unsigned)start->position.x / GGL_RASTER_BLOCK_SIZE;
+           x <= (unsigned)end->position.x / GGL_RASTER_BLOCK_SIZE; x++)
+         HiZVisible(ctx, row + x, zMin, zMax);
+   }
+#endif
+   ShadeScanLine(ctx, &ctx->activeStencil, start, end);
 //   GGL_GET_CONST_CONTEXT(ctx, iface);
 //   //    assert((unsigned)start->position.y == (unsigned)end->position.y);
 //   //
@@ -14,11 +14,13 @@
  * limitations under the License.
  */
 #include "src/pixelflinger2/pixelflinger2.h"
+#include "src/pixelflinger2/texture.h"
 
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
 #include <map>
+#include <pthread.h>
 
 #include <llvm/LLVMContext.h>
 #include <llvm/Module.h>
@@ -95,6 +97,12 @@ static const struct GLContext {
    }
 } glContext;
 
+// GLSL compiler state (glContext, glsl_type tables, builtin functions) and shader IR are
+// not reentrant; compile, link and IR to LLVM conversion of any context hold this lock
+static pthread_mutex_t compilerLock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned contextCount; // type tables are released with the last context
+static pthread_once_t bccInitOnce = PTHREAD_ONCE_INIT;
+
 extern "C" void GLContextDctr()
 {
    _mesa_glsl_release_types(); // TODO: find when to release to minize memory
@@ -107,9 +115,12 @@ struct ShaderKey {
       GGLStencilState frontStencil, backStencil;
       GGLBufferState bufferState;
       GGLBlendState blendState;
+      bool earlyZ; // stencil and depth tested before fragment shader, which has no discard
+      bool statistics; // fragment counters
    } scanLineKey;
    GGLPixelFormat textureFormats[GGL_MAXCOMBINEDTEXTUREIMAGEUNITS];
-   unsigned char textureParameters[GGL_MAXCOMBINEDTEXTUREIMAGEUNITS]; // wrap and filter
+   unsigned textureParameters[GGL_MAXCOMBINEDTEXTUREIMAGEUNITS]; // wrap, filter, layout and size
+   const GGLState * textureState; // texture data is linked by SymbolLookup, NULL without samplers
    bool operator <(const ShaderKey & rhs) const {
       return memcmp(this, &rhs, sizeof(*this)) < 0;
    }
@@ -120,14 +131,18 @@ struct Instance {
    llvm::SmallVector<char, 1024> resultObj;
    bcc::ObjectLoader * exec;
    void (* function)();
+   void (* batchFunction)(); // SoA vertex shader or quad fragment shader, NULL if not supported
+   void (* quadFunction)(); // scanline for fragments shaded by batchFunction
+   bool quadOnly; // function can't compute derivatives, so fragments are shaded by batchFunction
    ~Instance() {
-      delete script;
+      delete script; // NULL after CodeGen, so instances outlive the context compiling them
       delete exec;
    }
 };
 
-struct Executable { // codegen info
+struct Executable { // codegen info, shared by contexts using the program
    std::map<ShaderKey, Instance *> instances;
+   pthread_mutex_t lock; // guards instances, held while compiling one
 };
 
 bool do_mat_op_to_vec(exec_list *instructions);
@@ -172,7 +187,9 @@ GLboolean GGLShaderCompile(gl_shader * shader, const char * glsl, const char **
    if (glsl)
       shader->Source = glsl;
    assert(shader->Source);
+   pthread_mutex_lock(&compilerLock);
    compile_shader(glContext.ctx, shader);
+   pthread_mutex_unlock(&compilerLock);
    if (glsl)
       shader->Source = NULL;
    if (infoLog)
@@ -199,6 +216,7 @@ void GGLShaderDelete(gl_shader * shader)
             it != shader->executable->instances.end(); it++)
          (*it).second->~Instance();
       shader->executable->instances.~map();
+      pthread_mutex_destroy(&shader->executable->lock);
    }
    _mesa_delete_shader(NULL, shader);
 }
@@ -261,9 +279,33 @@ static void ShaderAttach(const GGLInterface * iface, gl_shader_program * program
       gglError(error);
 }
 
+// uniforms and linking are changed without a context, so the one that binned primitives
+//  shaded with the program is kept in it until it flushes; bins of a context are only
+//  flushed by its own thread, so a program bound in more than one context is drawn now
+void SetProgramBinned(const GGLContext * ctx)
+{
+   gl_shader_program * program = ctx->CurrentProgram;
+   if (program->BoundContexts > 1)
+      FlushBinned(ctx);
+   else
+      program->BinningContext = ctx;
+}
+
+// shades primitives binned with program before it changes; BinningContext is only set
+//  while bound in that context alone, so it is the caller's unless the program is changed
+//  from another thread without synchronizing with its use, which GL leaves undefined
+static void FlushProgram(gl_shader_program * program)
+{
+   if (program->BinningContext)
+      FlushBinned((const GGLContext *)program->BinningContext);
+}
+
 GLboolean GGLShaderProgramLink(gl_shader_program * program, const char ** infoLog)
 {
+   FlushProgram(program);
+   pthread_mutex_lock(&compilerLock);
    link_shaders(glContext.ctx, program);
+   pthread_mutex_unlock(&compilerLock);
    if (infoLog)
       *infoLog = program->InfoLog;
    if (!program->LinkStatus)
@@ -289,14 +331,22 @@ static GLboolean ShaderProgramLink(gl_shader_program * program, const char ** in
    return GGLShaderProgramLink(program, infoLog);
 }
 
-static void GetShaderKey(const GGLState * ctx, const gl_shader * shader, ShaderKey * key)
+static void GetShaderKey(const GGLState * ctx, const gl_shader_program * program,
+                         const gl_shader * shader, ShaderKey * key)
 {
    memset(key, 0, sizeof(*key));
    if (GL_FRAGMENT_SHADER == shader->Type) {
       key->scanLineKey.frontStencil = ctx->frontStencil;
       key->scanLineKey.backStencil = ctx->backStencil;
       key->scanLineKey.bufferState = ctx->bufferState;
+      // depth and stencil formats only change scanlines that test them
+      if (!ctx->bufferState.depthTest)
+         key->scanLineKey.bufferState.depthFormat = GGL_PIXEL_FORMAT_NONE;
+      if (!ctx->bufferState.stencilTest)
+         key->scanLineKey.bufferState.stencilFormat = GGL_PIXEL_FORMAT_NONE;
       key->scanLineKey.blendState = ctx->blendState;
+      key->scanLineKey.earlyZ = !program->UsesDiscard;
+      key->scanLineKey.statistics = ctx->statistics;
    }
 
    for (unsigned i = 0; i < GGL_MAXCOMBINEDTEXTUREIMAGEUNITS; i++)
@@ -311,7 +361,21 @@ static void GetShaderKey(const GGLState * ctx, const gl_shader * shader, ShaderK
          key->textureParameters[i] |= texture.minFilter << (2 + 2);
          assert((1 << 1) > texture.magFilter);
          key->textureParameters[i] |= texture.magFilter << (2 + 2 + 3);
+         assert((1 << 1) > texture.layout);
+         key->textureParameters[i] |= texture.layout << (2 + 2 + 3 + 1);
+         if (IsPowerOf2Texture(texture)) {
+            key->textureParameters[i] |= 1 << (2 + 2 + 3 + 1 + 1);
+            if (texture.constantSize) { // log2 of width and height are jitted as constants
+               const unsigned * shifts = ctx->textureState.textureShifts + i * 2;
+               assert((1 << 4) > shifts[0] && (1 << 4) > shifts[1]);
+               key->textureParameters[i] |= 1 << (2 + 2 + 3 + 1 + 1 + 1);
+               key->textureParameters[i] |= shifts[0] << (2 + 2 + 3 + 1 + 1 + 1 + 1);
+               key->textureParameters[i] |= shifts[1] << (2 + 2 + 3 + 1 + 1 + 1 + 1 + 4);
+            }
+         }
       }
+   if (shader->SamplersUsed) // other instances are independent of state and shared
+      key->textureState = ctx;
 }
 
 static inline char HexDigit(unsigned char d)
@@ -319,7 +383,7 @@ static inline char HexDigit(unsigned char d)
    return (d > 9 ? d + 'A' - 10 : d + '0');
 }
 
-static const unsigned SHADER_KEY_STRING_LEN = GGL_MAXCOMBINEDTEXTUREIMAGEUNITS * 4 + 2;
+static const unsigned SHADER_KEY_STRING_LEN = GGL_MAXCOMBINEDTEXTUREIMAGEUNITS * 7 + 2;
 
 static void GetShaderKeyString(const GLenum type, const ShaderKey * key,
                                char * buffer, const unsigned bufferSize)
@@ -337,8 +401,9 @@ static void GetShaderKeyString(const GLenum type, const ShaderKey * key,
    for (unsigned i = 0; i < GGL_MAXCOMBINEDTEXTUREIMAGEUNITS; i++) {
       *str++ = HexDigit(key->textureFormats[i] / 16);
       *str++ = HexDigit(key->textureFormats[i] % 16);
-      *str++ = HexDigit(key->textureParameters[i] / 16);
-      *str++ = HexDigit(key->textureParameters[i] % 16);
+      assert(0xfffff >= key->textureParameters[i]);
+      for (int shift = 16; shift >= 0; shift -= 4)
+         *str++ = HexDigit(key->textureParameters[i] >> shift & 0xf);
    }
    *str++ = '\0';
 }
@@ -379,6 +444,14 @@ static void* SymbolLookup(void* pContext, const char* name)
          symbol = (void *)gglCtx->textureState.textureData;
       else if (!strcmp(_PF2_TEXTURE_DIMENSIONS_NAME_, name))
          symbol = (void *)gglCtx->textureState.textureDimensions;
+      else if (!strcmp(_PF2_TEXTURE_LEVELS_NAME_, name))
+         symbol = (void *)gglCtx->textureState.textureLevels;
+      else if (!strcmp(_PF2_TEXTURE_MAX_LEVEL_NAME_, name))
+         symbol = (void *)gglCtx->textureState.textureMaxLevel;
+      else if (!strcmp(_PF2_TEXTURE_SHIFTS_NAME_, name))
+         symbol = (void *)gglCtx->textureState.textureShifts;
+      else if (!strcmp("GGLSampleETC1", name)) // not exported when linked statically
+         symbol = (void *)GGLSampleETC1;
       else // attributes, varyings and uniforms are mapped to locations in pointers
       {
          ALOGD("pf2: SymbolLookup unknown symbol: '%s'", name);
@@ -390,8 +463,9 @@ static void* SymbolLookup(void* pContext, const char* name)
    return (void *)symbol;
 }
 
-static void CodeGen(Instance * instance, const char * mainName, gl_shader * shader,
-                    gl_shader_program * program, const GGLState * gglCtx)
+static void CodeGen(Instance * instance, const char * mainName, const char * batchName,
+                    const char * quadName, gl_shader * shader, gl_shader_program * program,
+                    const GGLState * gglCtx)
 {
    bcc::Compiler compiler;
    bcc::Compiler::ErrorCode compile_result;
@@ -432,6 +506,14 @@ static void CodeGen(Instance * instance, const char * mainName, gl_shader * shad
    if (!instance->function) {
       ALOGD("Could not find '%s'\n", mainName);
    }
+   if (batchName) {
+      instance->batchFunction = reinterpret_cast<void (*)()>(instance->exec->getSymbolAddress(batchName));
+      assert(instance->batchFunction);
+   }
+   if (quadName) {
+      instance->quadFunction = reinterpret_cast<void (*)()>(instance->exec->getSymbolAddress(quadName));
+      assert(instance->quadFunction);
+   }
 //   else
 //      printf("bcc_compile %s=%p \n", mainName, instance->function);
 
@@ -439,28 +521,39 @@ static void CodeGen(Instance * instance, const char * mainName, gl_shader * shad
 }
 
 void GenerateScanLine(const GGLState * gglCtx, const gl_shader_program * program, llvm::Module * mod,
-                      const char * shaderName, const char * scanlineName);
-
-void GGLShaderUse(void * bccCtx, const GGLState * gglState, gl_shader_program * program)
+                      const char * shaderName, const char * scanlineName, const bool preShaded);
+void GenerateQuadScanLine(const GGLState * gglCtx, const gl_shader_program * program, llvm::Module * mod,
+                          const char * scanlineName);
+
+// finds or jits instances of the linked shaders of program for gglState, NULL for missing
+// shaders; returns number of instances compiled
+static unsigned GetInstances(void * bccCtx, const GGLState * gglState, gl_shader_program * program,
+                             Instance * instances[MESA_SHADER_TYPES])
 {
+   unsigned compiled = 0;
 //   ALOGD("%s", program->Shaders[MESA_SHADER_FRAGMENT]->Source);
    for (unsigned i = 0; i < MESA_SHADER_TYPES; i++) {
+      instances[i] = NULL;
       if (!program->_LinkedShaders[i])
          continue;
       gl_shader * shader = program->_LinkedShaders[i];
-      shader->function = NULL;
+      pthread_mutex_lock(&compilerLock);
       if (!shader->executable) {
          shader->executable = hieralloc_zero(shader, Executable);
          shader->executable->instances = std::map<ShaderKey, Instance *>();
+         pthread_mutex_init(&shader->executable->lock, NULL);
       }
+      pthread_mutex_unlock(&compilerLock);
 
       ShaderKey shaderKey;
-      GetShaderKey(gglState, shader, &shaderKey);
+      GetShaderKey(gglState, program, shader, &shaderKey);
+      pthread_mutex_lock(&shader->executable->lock);
       Instance * instance = shader->executable->instances[shaderKey];
       bcc::BCCContext * compilerCtx = reinterpret_cast<bcc::BCCContext *>(bccCtx);
       if (!instance) {
 //         puts("begin jit new shader");
          instance = hieralloc_zero(shader->executable, Instance);
+         compiled++;
 
          llvm::Module * module = new llvm::Module("glsl", compilerCtx->getLLVMContext());
 
@@ -470,6 +563,7 @@ void GGLShaderUse(void * bccCtx, const GGLState * gglState, gl_shader_program *
          char mainName [SHADER_KEY_STRING_LEN + 6] = {"main"};
          strcat(mainName, shaderName);
 
+         pthread_mutex_lock(&compilerLock); // IR and glsl_type are shared
          do_mat_op_to_vec(shader->ir); // TODO: move these passes to link?
 //#ifdef __arm__
 //         static const char fileName[] = "/data/pf2.txt";
@@ -491,10 +585,32 @@ void GGLShaderUse(void * bccCtx, const GGLState * gglState, gl_shader_program *
 //         }
 //         fclose(file);
 //#endif
-         if (!glsl_ir_to_llvm_module(shader->ir, module, gglState, shaderName)) {
+         bool mainFailed = false;
+         if (!glsl_ir_to_llvm_module(shader->ir, module, gglState, shaderName, &mainFailed)) {
             assert(0);
             delete module;
          }
+         char batchName [SHADER_KEY_STRING_LEN + 6] = {"soa"};
+         strcat(batchName, shaderName);
+         bool batch = false;
+#if USE_SOA_VERTEX_SHADER
+         if (GL_VERTEX_SHADER == shader->Type)
+            batch = glsl_ir_to_llvm_soa_function(shader->ir, module, gglState, batchName,
+                                                 GGL_VERTEX_SOA_WIDTH, false,
+                                                 sizeof(VertexInput) / sizeof(Vector4),
+                                                 sizeof(VertexOutput) / sizeof(Vector4));
+#endif
+#if USE_QUAD_RASTER
+         if (GL_FRAGMENT_SHADER == shader->Type) // fragment inputs and outputs are in VertexOutput
+            batch = glsl_ir_to_llvm_soa_function(shader->ir, module, gglState, batchName, 4, true,
+                                                 sizeof(VertexOutput) / sizeof(Vector4),
+                                                 sizeof(VertexOutput) / sizeof(Vector4));
+#endif
+         pthread_mutex_unlock(&compilerLock);
+         // without the quad shader, main shades with derivatives of 0 rather than nothing
+         if (mainFailed && !batch)
+            ALOGD("pf2: %s has no quad fragment shader, derivatives are 0 \n", shaderName);
+         instance->quadOnly = mainFailed && batch;
          bcc::Source * source = bcc::Source::CreateFromModule(*compilerCtx, *module);
          if (!source) {
             delete module;
@@ -552,28 +668,59 @@ void GGLShaderUse(void * bccCtx, const GGLState * gglState, gl_shader_program *
          if (GL_FRAGMENT_SHADER == shader->Type) {
             char scanlineName [SCANLINE_KEY_STRING_LEN] = {0};
             GetScanlineKeyString(&shaderKey, scanlineName, sizeof scanlineName / sizeof *scanlineName);
-            GenerateScanLine(gglState, program, module, mainName, scanlineName);
-            CodeGen(instance, scanlineName, shader, program, gglState);
+            GenerateScanLine(gglState, program, module, mainName, scanlineName, false);
+            char quadName [SCANLINE_KEY_STRING_LEN + 1] = {"q"};
+            strcat(quadName, scanlineName);
+#if USE_QUAD_RASTER
+            if (batch)
+               GenerateQuadScanLine(gglState, program, module, quadName);
+#endif
+            CodeGen(instance, scanlineName, batch ? batchName : NULL, batch ? quadName : NULL,
+                    shader, program, gglState);
          } else
 #endif
-            CodeGen(instance, mainName, shader, program, gglState);
+            CodeGen(instance, mainName, batch ? batchName : NULL, NULL, shader, program, gglState);
+         // module belongs to this context's BCCContext, the loaded object is all that is needed
+         delete instance->script;
+         instance->script = NULL;
 
          shader->executable->instances[shaderKey] = instance;
 //         debug_printf("jit new shader '%s'(%p) \n", mainName, instance->function);
       } else
 //         debug_printf("use cached shader %p \n", instance->function);
          ;
-
-      shader->function  = instance->function;
+      pthread_mutex_unlock(&shader->executable->lock);
+      instances[i] = instance;
    }
 //   puts("pf2: GGLShaderUse end");
 
 //   assert(0);
+   return compiled;
+}
+
+unsigned GGLShaderUse(void * bccCtx, const GGLState * gglState, gl_shader_program * program)
+{
+   Instance * instances[MESA_SHADER_TYPES];
+   const unsigned compiled = GetInstances(bccCtx, gglState, program, instances);
+   for (unsigned i = 0; i < MESA_SHADER_TYPES; i++) {
+      gl_shader * shader = program->_LinkedShaders[i];
+      if (!shader)
+         continue;
+      shader->function = instances[i]->function;
+      shader->batchFunction = instances[i]->batchFunction;
+      shader->quadFunction = instances[i]->quadFunction;
+   }
+   return compiled;
 }
 
 static void ShaderUse(GGLInterface * iface, gl_shader_program * program)
 {
    GGL_GET_CONTEXT(ctx, iface);
+   FlushBinned(ctx);
+   if (ctx->CurrentProgram)
+      __sync_fetch_and_sub(&ctx->CurrentProgram->BoundContexts, 1);
+   if (program)
+      __sync_fetch_and_add(&program->BoundContexts, 1);
    // so drawing calls will do nothing until ShaderUse with a program
    SetShaderVerifyFunctions(iface);
    if (!program) {
@@ -581,17 +728,26 @@ static void ShaderUse(GGLInterface * iface, gl_shader_program * program)
       return;
    }
 
-   GGLShaderUse(ctx->bccCtx, &ctx->state, program);
+   // functions are kept in ctx instead of the program, which other contexts may be using
+   Instance * instances[MESA_SHADER_TYPES];
+   const unsigned compiled = GetInstances(ctx->bccCtx, &ctx->state, program, instances);
+   if (ctx->state.statistics)
+      ctx->stats.shaderCompiles += compiled;
+   memset(&ctx->shaderFunctions, 0, sizeof(ctx->shaderFunctions));
    for (unsigned i = 0; i < MESA_SHADER_TYPES; i++) {
-      if (!program->_LinkedShaders[i])
+      if (!instances[i] || !instances[i]->function)
          continue;
-      if (!program->_LinkedShaders[i]->function)
-         continue;
-      if (GL_VERTEX_SHADER == program->_LinkedShaders[i]->Type)
+      if (GL_VERTEX_SHADER == program->_LinkedShaders[i]->Type) {
+         ctx->shaderFunctions.vertex = (ShaderFunction_t)instances[i]->function;
+         ctx->shaderFunctions.vertexBatch = (ShaderFunction_t)instances[i]->batchFunction;
          ctx->PickRaster(iface);
-      else if (GL_FRAGMENT_SHADER == program->_LinkedShaders[i]->Type)
+      } else if (GL_FRAGMENT_SHADER == program->_LinkedShaders[i]->Type) {
+         ctx->shaderFunctions.scanLine = (ScanLineFunction_t)instances[i]->function;
+         ctx->shaderFunctions.fragmentBatch = (ShaderFunction_t)instances[i]->batchFunction;
+         ctx->shaderFunctions.quadScanLine = (ScanLineFunction_t)instances[i]->quadFunction;
+         ctx->shaderFunctions.quadOnly = instances[i]->quadOnly;
          ctx->PickScanLine(iface);
-      else
+      } else
          assert(0);
    }
    ctx->CurrentProgram = program;
@@ -622,6 +778,7 @@ static void ShaderDetach(const GGLInterface * iface, gl_shader_program * program
 
 void GGLShaderProgramDelete(gl_shader_program * program)
 {
+   FlushProgram(program);
    for (unsigned i = 0; i < program->NumShaders; i++) {
       GGLShaderDelete(program->Shaders[i]); // actually just mark for delete
       GGLShaderDetach(program, program->Shaders[i]); // detach will delete if ref == 1
@@ -637,6 +794,7 @@ void GGLShaderProgramDelete(gl_shader_program * program)
 static void ShaderProgramDelete(GGLInterface * iface, gl_shader_program * program)
 {
    GGL_GET_CONTEXT(ctx, iface);
+   FlushBinned(ctx);
    if (ctx->CurrentProgram == program) {
       ctx->CurrentProgram = NULL;
       SetShaderVerifyFunctions(iface);
@@ -814,6 +972,7 @@ GLint GGLShaderUniform(gl_shader_program * program, GLint location, GLsizei coun
    }
    if (-1 == location)
       return -1;
+   FlushProgram(program);
    assert(0 <= location && program->Uniforms->NumUniforms > location);
    const gl_uniform & uniform = program->Uniforms->Uniforms[location];
    int start = -1;
@@ -873,6 +1032,7 @@ void GGLShaderUniformMatrix(gl_shader_program * program, GLint cols, GLint rows,
 {
    if (location == -1)
       return;
+   FlushProgram(program);
    assert(!transpose);
    assert(cols == rows);
    assert(0 <= location && program->Uniforms->NumUniforms > location);
@@ -920,6 +1080,29 @@ static void ShaderVerifyDrawTriangle(const GGLInterface * iface, const VertexInp
    }
 }
 
+static void ShaderVerifyDrawArrays(const GGLInterface * iface, GLenum mode,
+                                   const VertexInput * vertices, GLint first, GLsizei count)
+{
+   GGL_GET_CONST_CONTEXT(ctx, iface);
+   if (ctx->CurrentProgram) {
+      ShaderUse(const_cast<GGLInterface *>(iface), ctx->CurrentProgram);
+      if (ShaderVerifyDrawArrays != iface->DrawArrays)
+         iface->DrawArrays(iface, mode, vertices, first, count);
+   }
+}
+
+static void ShaderVerifyDrawElements(const GGLInterface * iface, GLenum mode,
+                                     const VertexInput * vertices, GLsizei count,
+                                     GLenum type, const GLvoid * indices)
+{
+   GGL_GET_CONST_CONTEXT(ctx, iface);
+   if (ctx->CurrentProgram) {
+      ShaderUse(const_cast<GGLInterface *>(iface), ctx->CurrentProgram);
+      if (ShaderVerifyDrawElements != iface->DrawElements)
+         iface->DrawElements(iface, mode, vertices, count, type, indices);
+   }
+}
+
 static void ShaderVerifyRasterTriangle(const GGLInterface * iface, const VertexOutput * v1,
                                        const VertexOutput * v2, const VertexOutput * v3)
 {
@@ -959,6 +1142,8 @@ void SetShaderVerifyFunctions(struct GGLInterface * iface)
 {
    iface->ProcessVertex = ShaderVerifyProcessVertex;
    iface->DrawTriangle = ShaderVerifyDrawTriangle;
+   iface->DrawArrays = ShaderVerifyDrawArrays;
+   iface->DrawElements = ShaderVerifyDrawElements;
    iface->RasterTriangle = ShaderVerifyRasterTriangle;
    iface->RasterTrapezoid = ShaderVerifyRasterTrapezoid;
    iface->ScanLine = ShaderVerifyScanLine;
@@ -967,7 +1152,10 @@ void SetShaderVerifyFunctions(struct GGLInterface * iface)
 void InitializeShaderFunctions(struct GGLInterface * iface)
 {
    GGL_GET_CONTEXT(ctx, iface);
-   bcc::init::Initialize();
+   pthread_once(&bccInitOnce, bcc::init::Initialize);
+   pthread_mutex_lock(&compilerLock);
+   contextCount++;
+   pthread_mutex_unlock(&compilerLock);
 
    ctx->bccCtx = new bcc::BCCContext();
 
@@ -999,8 +1187,14 @@ void InitializeShaderFunctions(struct GGLInterface * iface)
 void DestroyShaderFunctions(GGLInterface * iface)
 {
    GGL_GET_CONTEXT(ctx, iface);
-   _mesa_glsl_release_types();
-   _mesa_glsl_release_functions();
+   if (ctx->CurrentProgram) // bins were flushed by DestroyTileFunctions
+      __sync_fetch_and_sub(&ctx->CurrentProgram->BoundContexts, 1);
+   pthread_mutex_lock(&compilerLock);
+   if (!--contextCount) {
+      _mesa_glsl_release_types();
+      _mesa_glsl_release_functions();
+   }
+   pthread_mutex_unlock(&compilerLock);
    delete ctx->bccCtx;
    ctx->bccCtx = NULL;
 }
@@ -20,6 +20,8 @@
 #include <assert.h>
 #include <string.h>
 #include <math.h>
+#include <stdlib.h>
+#include <pthread.h>
 
 #include "pixelflinger2.h"
 
@@ -29,6 +31,44 @@
 #include <llvm/DerivedTypes.h>
 #endif
 
+// index of texel x, y in a level width texels wide stored in layout
+static inline unsigned TexelIndex(const unsigned layout, const unsigned x, const unsigned y,
+                                  const unsigned width)
+{
+    if (GGLTexture::GGL_TILED_LAYOUT == layout)
+        return (y & ~3) * ((width + 3) & ~3) + (x & ~3) * 4 + ((y & 3) << 2) + (x & 3);
+    return y * width + x;
+}
+
+// texels stored for a level, tiled layout pads to whole tiles
+static inline unsigned LevelTexels(const unsigned layout, const unsigned width, const unsigned height)
+{
+    if (GGLTexture::GGL_TILED_LAYOUT == layout)
+        return ((width + 3) & ~3) * ((height + 3) & ~3);
+    return width * height;
+}
+
+// ETC1 blocks are 4x4 texels, so they are always in tile order
+static inline GGLTexture::GGLTextureLayout StorageLayout(const GGLTexture * texture)
+{
+    if (GGL_PIXEL_FORMAT_ETC1 == texture->format)
+        return GGLTexture::GGL_TILED_LAYOUT;
+    return texture->layout;
+}
+
+// texel offset of level of face, levels are stored level 0 of each face, then level 1 ...
+static unsigned LevelOffset(const GGLTexture * texture, const unsigned level, const unsigned face)
+{
+    const unsigned faces = GL_TEXTURE_CUBE_MAP == texture->type ? 6 : 1;
+    const unsigned layout = StorageLayout(texture);
+    unsigned offset = 0;
+    for (unsigned i = 0; i < level; i++)
+        offset += faces * LevelTexels(layout, MAX2(texture->width >> i, 1u),
+                                      MAX2(texture->height >> i, 1u));
+    return offset + face * LevelTexels(layout, MAX2(texture->width >> level, 1u),
+                                       MAX2(texture->height >> level, 1u));
+}
+
 #if !USE_LLVM_TEXTURE_SAMPLER
 
 const struct GGLContext * textureGGLContext;
@@ -68,6 +108,24 @@ static inline void Lerp(Vec4<int> * a, Vec4<int> * b, int x, Vec4<int> * d)
     }
 }
 
+// a * (256 - weight) + b * weight of packed texels with weight in [0, 256], two channels per word
+// in 16 bit lanes; a lane is at most 255 * 256 + 128 before the shift, so lanes never carry
+static inline unsigned LerpTexels(const unsigned a, const unsigned b, const unsigned weight)
+{
+    const unsigned rb = (a & 0xff00ff) * (256 - weight) + (b & 0xff00ff) * weight + 0x800080;
+    const unsigned ga = ((a >> 8) & 0xff00ff) * (256 - weight) + ((b >> 8) & 0xff00ff) * weight + 0x800080;
+    return ((rb >> 8) & 0xff00ff) | (ga & 0xff00ff00);
+}
+
+// blends packed texels s0 s1 (top row) and s3 s2 (bottom row), 16 bit fractions are rounded to
+// 8 bit weights; same arithmetic as bilinear16 in llvm_texture.cpp
+static inline unsigned Bilinear(const unsigned s0, const unsigned s1, const unsigned s2, const unsigned s3,
+                                const unsigned xLerp, const unsigned yLerp)
+{
+    const unsigned x = (xLerp + 128) >> 8, y = (yLerp + 128) >> 8;
+    return LerpTexels(LerpTexels(s0, s1, x), LerpTexels(s3, s2, x), y);
+}
+
 static inline void ToIntVec(Vec4<int> * a)
 {
     a->u[3] = a->u[0] >> 24;
@@ -101,6 +159,30 @@ static void PointSample(unsigned sample[4], const unsigned * data, const unsigne
         sample[0] |= sample[2];
         sample[0] |= 0xff000000;
     }
+    else if (GGL_PIXEL_FORMAT_RGBA_4444 == format)
+    {
+        const unsigned texel = *((const unsigned short *)data + index);
+        sample[0] = ((texel >> 12) & 0xf) | (texel & 0xf00) | ((texel << 12) & 0xf0000) | ((texel & 0xf) << 24);
+        sample[0] |= sample[0] << 4;
+    }
+    else if (GGL_PIXEL_FORMAT_RGBA_5551 == format)
+    {
+        const unsigned texel = *((const unsigned short *)data + index);
+        sample[0] = ((texel >> 11) & 0x1f) | ((texel << 2) & 0x1f00) | ((texel << 15) & 0x1f0000);
+        sample[0] = (sample[0] << 3) | ((sample[0] >> 2) & 0x070707);
+        sample[0] |= (0 - (texel & 1)) << 24;
+    }
+    else if (GGL_PIXEL_FORMAT_A_8 == format)
+        sample[0] = *((const unsigned char *)data + index) << 24;
+    else if (GGL_PIXEL_FORMAT_L_8 == format)
+        sample[0] = *((const unsigned char *)data + index) * 0x010101 | 0xff000000;
+    else if (GGL_PIXEL_FORMAT_LA_88 == format)
+    {
+        const unsigned texel = *((const unsigned short *)data + index);
+        sample[0] = (texel & 0xff) * 0x010101 | ((texel & 0xff00) << 16);
+    }
+    else if (GGL_PIXEL_FORMAT_ETC1 == format)
+        sample[0] = GGLSampleETC1(data, index);
     else if (GGL_PIXEL_FORMAT_UNKNOWN == format)
         sample[0] = 0xff00ffff;
     else 
@@ -135,43 +217,74 @@ static unsigned texcoordWrap(const unsigned wrap, float r, const unsigned size,
     return tc;
 }
 
-template<GGLPixelFormat format, ChannelType output, unsigned minMag, unsigned wrapS, unsigned wrapT>
-static void tex2d(unsigned sample[4], const float tex_coord[4], const unsigned sampler)
+// samples level at offset texels into data into 4 channels, filter is GGL_NEAREST or GGL_LINEAR
+template<GGLPixelFormat format, unsigned wrapS, unsigned wrapT>
+static void SampleLevel(unsigned sample[4], const unsigned * data, const unsigned offset,
+                        const unsigned width, const unsigned height, const unsigned layout,
+                        const unsigned filter, const float s, const float t)
 {
-   const unsigned * data = (const unsigned *)textureGGLContext->textureState.textureData[sampler];
-   const unsigned width = textureGGLContext->textureState.textureDimensions[sampler * 2];
-	const unsigned height = textureGGLContext->textureState.textureDimensions[sampler * 2 + 1];
     unsigned xLerp = 0, yLerp = 0;
-    const unsigned x0 = texcoordWrap(wrapS, tex_coord[0], width, &xLerp);
-    const unsigned y0 = texcoordWrap(wrapT, tex_coord[1], height, &yLerp);
+    const unsigned x0 = texcoordWrap(wrapS, s, width, &xLerp);
+    const unsigned y0 = texcoordWrap(wrapT, t, height, &yLerp);
     
-    if (0 == minMag)
+    if (0 == filter)
     {
-        PointSample<format>(sample, data, y0 * width + x0);
+        PointSample<format>(sample, data, offset + TexelIndex(layout, x0, y0, width));
         sample[1] = (sample[0] & 0xff00) >> 8;
         sample[2] = (sample[0] & 0xff0000) >> 16;
         sample[3] = (sample[0] & 0xff000000) >> 24;
         sample[0] &= 0xff;
     }
-    else if (1 == minMag)
+    else if (1 == filter)
     {
         const unsigned x1 = MIN2(width - 1, x0 + 1), y1 = MIN2(height - 1, y0 + 1);
-        Vec4<int> samples[4] = {0};
-        PointSample<format>((unsigned *)(samples + 0), data, y0 * width + x0);
-        ToIntVec(samples + 0);
-        PointSample<format>((unsigned *)(samples + 1), data, y0 * width + x1);
-        ToIntVec(samples + 1);
-        PointSample<format>((unsigned *)(samples + 2), data, y1 * width + x1);
-        ToIntVec(samples + 2);
-        PointSample<format>((unsigned *)(samples + 3), data, y1 * width + x0);
-        ToIntVec(samples + 3);
+        unsigned texels[4][4] = {{0}}; // PointSample may use all 4 as scratch
+        PointSample<format>(texels[0], data, offset + TexelIndex(layout, x0, y0, width));
+        PointSample<format>(texels[1], data, offset + TexelIndex(layout, x1, y0, width));
+        PointSample<format>(texels[2], data, offset + TexelIndex(layout, x1, y1, width));
+        PointSample<format>(texels[3], data, offset + TexelIndex(layout, x0, y1, width));
         
-        Lerp(samples + 0, samples + 1, xLerp, samples + 0);
-        Lerp(samples + 3, samples + 2, xLerp, samples + 3);
-        Lerp(samples + 0, samples + 3, yLerp, (Vec4<int> *)sample);
+        sample[0] = Bilinear(texels[0][0], texels[1][0], texels[2][0], texels[3][0], xLerp, yLerp);
+        ToIntVec((Vec4<int> *)sample);
     }
     else
         assert(0);
+}
+
+// tex_coord[3] is the level of detail for mipmap min filters, level 0 uses minMag when not minified
+template<GGLPixelFormat format, ChannelType output, unsigned minMag, unsigned wrapS, unsigned wrapT>
+static void tex2d(unsigned sample[4], const float tex_coord[4], const unsigned sampler)
+{
+    const GGLTextureState & state = textureGGLContext->textureState;
+    const unsigned * data = (const unsigned *)state.textureData[sampler];
+    const unsigned width = state.textureDimensions[sampler * 2];
+    const unsigned height = state.textureDimensions[sampler * 2 + 1];
+    const unsigned layout = state.textures[sampler].layout;
+    const unsigned minFilter = state.textures[sampler].minFilter;
+    const float lod = MIN2(tex_coord[3], (float)state.textureMaxLevel[sampler]);
+    
+    if (GGLTexture::GGL_NEAREST_MIPMAP_NEAREST > minFilter || lod <= 0)
+        SampleLevel<format, wrapS, wrapT>(sample, data, 0, width, height, layout, minMag,
+                                          tex_coord[0], tex_coord[1]);
+    else if (GGLTexture::GGL_NEAREST_MIPMAP_LINEAR > minFilter) // nearest level
+    {
+        const unsigned level = lod + 0.5f;
+        SampleLevel<format, wrapS, wrapT>(sample, data, state.textureLevels[sampler * GGL_MAXTEXTURELEVELS + level],
+                                          MAX2(width >> level, 1u), MAX2(height >> level, 1u), layout,
+                                          minFilter & 1, tex_coord[0], tex_coord[1]);
+    }
+    else // linear between the two nearest levels
+    {
+        const unsigned level = lod, next = MIN2(level + 1, state.textureMaxLevel[sampler]);
+        Vec4<int> samples[2];
+        SampleLevel<format, wrapS, wrapT>(samples[0].u, data, state.textureLevels[sampler * GGL_MAXTEXTURELEVELS + level],
+                                          MAX2(width >> level, 1u), MAX2(height >> level, 1u), layout,
+                                          minFilter & 1, tex_coord[0], tex_coord[1]);
+        SampleLevel<format, wrapS, wrapT>(samples[1].u, data, state.textureLevels[sampler * GGL_MAXTEXTURELEVELS + next],
+                                          MAX2(width >> next, 1u), MAX2(height >> next, 1u), layout,
+                                          minFilter & 1, tex_coord[0], tex_coord[1]);
+        Lerp(samples + 0, samples + 1, (lod - level) * (1 << 16), (Vec4<int> *)sample);
+    }
     
     if (Fixed0 == output) // i32 non vector
         sample[0] = (sample[3] << 24) | (sample[2] << 16) | (sample[1] << 8) | sample[0];
@@ -250,13 +363,15 @@ void texcube(unsigned sample[4], const float tex_coord[4], const unsigned sample
     const unsigned * data = (const unsigned *)textureGGLContext->textureState.textureData[sampler];
     const unsigned width = textureGGLContext->textureState.textureDimensions[sampler * 2];
 	const unsigned height = textureGGLContext->textureState.textureDimensions[sampler * 2 + 1];
+    const unsigned layout = textureGGLContext->textureState.textures[sampler].layout;
+    const unsigned faceOffset = face * LevelTexels(layout, width, height);
     unsigned xLerp = 0, yLerp = 0;
     const unsigned x0 = texcoordWrap(wrapS, s, width, &xLerp);
     const unsigned y0 = texcoordWrap(wrapT, t, height, &yLerp);
     
     if (0 == minMag)
     {
-        PointSample<format>(sample, data, y0 * width + x0);
+        PointSample<format>(sample, data, TexelIndex(layout, x0, y0, width));
         sample[1] = (sample[0] & 0xff00) >> 8;
         sample[2] = (sample[0] & 0xff0000) >> 16;
         sample[3] = (sample[0] & 0xff000000) >> 24;
@@ -265,19 +380,14 @@ void texcube(unsigned sample[4], const float tex_coord[4], const unsigned sample
     else if (1 == minMag)
     {
         const unsigned x1 = MIN2(width - 1, x0 + 1), y1 = MIN2(height - 1, y0 + 1);
-        Vec4<int> samples[4] = {0};
-        PointSample<format>((unsigned *)(samples + 0), data, face * width * height + y0 * width + x0);
-        ToIntVec(samples + 0);
-        PointSample<format>((unsigned *)(samples + 1), data, face * width * height + y0 * width + x1);
-        ToIntVec(samples + 1);
-        PointSample<format>((unsigned *)(samples + 2), data, face * width * height + y1 * width + x1);
-        ToIntVec(samples + 2);
-        PointSample<format>((unsigned *)(samples + 3), data, face * width * height + y1 * width + x0);
-        ToIntVec(samples + 3);
+        unsigned texels[4][4] = {{0}}; // PointSample may use all 4 as scratch
+        PointSample<format>(texels[0], data, faceOffset + TexelIndex(layout, x0, y0, width));
+        PointSample<format>(texels[1], data, faceOffset + TexelIndex(layout, x1, y0, width));
+        PointSample<format>(texels[2], data, faceOffset + TexelIndex(layout, x1, y1, width));
+        PointSample<format>(texels[3], data, faceOffset + TexelIndex(layout, x0, y1, width));
         
-        Lerp(samples + 0, samples + 1, xLerp, samples + 0);
-        Lerp(samples + 3, samples + 2, xLerp, samples + 3);
-        Lerp(samples + 0, samples + 3, yLerp, (Vec4<int> *)sample);
+        sample[0] = Bilinear(texels[0][0], texels[1][0], texels[2][0], texels[3][0], xLerp, yLerp);
+        ToIntVec((Vec4<int> *)sample);
     }
     else
         assert(0);
@@ -327,6 +437,12 @@ TEXTURE_FUNCTION_ENTRY_FILTER(target,format,Fixed0)
 TEXTURE_FUNCTION_ENTRY_OUTPUT(target,RGBA_8888) \
 TEXTURE_FUNCTION_ENTRY_OUTPUT(target,RGBX_8888) \
 TEXTURE_FUNCTION_ENTRY_OUTPUT(target,RGB_565) \
+TEXTURE_FUNCTION_ENTRY_OUTPUT(target,RGBA_4444) \
+TEXTURE_FUNCTION_ENTRY_OUTPUT(target,RGBA_5551) \
+TEXTURE_FUNCTION_ENTRY_OUTPUT(target,A_8) \
+TEXTURE_FUNCTION_ENTRY_OUTPUT(target,L_8) \
+TEXTURE_FUNCTION_ENTRY_OUTPUT(target,LA_88) \
+TEXTURE_FUNCTION_ENTRY_OUTPUT(target,ETC1) \
 TEXTURE_FUNCTION_ENTRY_OUTPUT(target,UNKNOWN)
 
 #define TEXTURE_FUNCTION_ENTRIES \
@@ -386,10 +502,113 @@ void AddTextureFunctionMappings(llvm::Module * mod, llvm::ExecutionEngine * ee)
 }
 #endif // #if USE_LLVM_EXECUTIONENGINE && !USE_LLVM_TEXTURE_SAMPLER
 
+// ETC1 blocks are decoded whole into a small cache, direct mapped by block address, so the
+// bilinear footprints of neighbouring fragments share one decode; each thread has its own
+// cache, so raster threads need no locking
+static const unsigned ETC1_CACHE_BLOCKS = 64;
+
+struct ETC1BlockCache
+{
+    unsigned generation; // blocks are dropped when etc1Generation changes
+    const unsigned char * blocks[ETC1_CACHE_BLOCKS];
+    unsigned texels[ETC1_CACHE_BLOCKS][16]; // 0xAABBGGRR at (y % 4) * 4 + x % 4
+};
+
+static volatile unsigned etc1Generation;
+static pthread_key_t etc1CacheKey;
+static pthread_once_t etc1CacheOnce = PTHREAD_ONCE_INIT;
+
+static void CreateETC1CacheKey()
+{
+    pthread_key_create(&etc1CacheKey, free);
+}
+
+static void InvalidateETC1Caches()
+{
+    __sync_fetch_and_add(&etc1Generation, 1);
+}
+
+static inline unsigned ClampByte(const int value)
+{
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+// decodes a big endian ETC1 block as in OES_compressed_ETC1_RGB8_texture
+static void DecodeETC1Block(const unsigned char * block, unsigned texels[16])
+{
+    static const int modifiers[8][2] = { {2, 8}, {5, 17}, {9, 29}, {13, 42},
+                                         {18, 60}, {24, 80}, {33, 106}, {47, 183} };
+    const unsigned high = (block[0] << 24) | (block[1] << 16) | (block[2] << 8) | block[3];
+    const unsigned low = (block[4] << 24) | (block[5] << 16) | (block[6] << 8) | block[7];
+    int base[2][3];
+    for (unsigned c = 0; c < 3; c++) // r, g and b are the top 3 bytes
+    {
+        const unsigned bits = high >> (24 - c * 8);
+        if (high & 2) // differential, 5 bit base and 3 bit signed delta
+        {
+            const int base0 = (bits >> 3) & 0x1f;
+            const int base1 = (base0 + (int)((bits & 7) ^ 4) - 4) & 0x1f;
+            base[0][c] = (base0 << 3) | (base0 >> 2);
+            base[1][c] = (base1 << 3) | (base1 >> 2);
+        }
+        else // individual, two 4 bit bases
+        {
+            base[0][c] = ((bits >> 4) & 0xf) * 17;
+            base[1][c] = (bits & 0xf) * 17;
+        }
+    }
+    const int * tables[2] = { modifiers[(high >> 5) & 7], modifiers[(high >> 2) & 7] };
+    for (unsigned x = 0; x < 4; x++)
+        for (unsigned y = 0; y < 4; y++)
+        {
+            const unsigned bit = x * 4 + y; // texel indices are column major
+            const unsigned subBlock = (high & 1) ? y >> 1 : x >> 1; // flipped halves are 4x2
+            int modifier = tables[subBlock][(low >> bit) & 1];
+            if ((low >> (bit + 16)) & 1)
+                modifier = -modifier;
+            texels[y * 4 + x] = ClampByte(base[subBlock][0] + modifier) |
+                                (ClampByte(base[subBlock][1] + modifier) << 8) |
+                                (ClampByte(base[subBlock][2] + modifier) << 16) | 0xff000000;
+        }
+}
+
+unsigned GGLSampleETC1(const void * data, const unsigned index)
+{
+    const unsigned char * block = (const unsigned char *)data + (index >> 4) * 8;
+    ETC1BlockCache * cache = (ETC1BlockCache *)pthread_getspecific(etc1CacheKey);
+    if (!cache)
+    {
+        cache = (ETC1BlockCache *)calloc(1, sizeof(*cache));
+        if (!cache)
+        {
+            unsigned texels[16];
+            DecodeETC1Block(block, texels);
+            return texels[index & 15];
+        }
+        pthread_setspecific(etc1CacheKey, cache);
+    }
+    const unsigned generation = etc1Generation;
+    if (cache->generation != generation)
+    {
+        memset(cache->blocks, 0, sizeof(cache->blocks));
+        cache->generation = generation;
+    }
+    // fold row strides that are multiples of the cache size, so vertical neighbours don't collide
+    const unsigned address = (unsigned)((size_t)block >> 3);
+    const unsigned entry = (address ^ (address >> 6) ^ (address >> 12)) % ETC1_CACHE_BLOCKS;
+    if (cache->blocks[entry] != block)
+    {
+        DecodeETC1Block(block, cache->texels[entry]);
+        cache->blocks[entry] = block;
+    }
+    return cache->texels[entry][index & 15];
+}
+
 static void SetSampler(GGLInterface * iface, const unsigned sampler, GGLTexture * texture)
 {
     assert(GGL_MAXCOMBINEDTEXTUREIMAGEUNITS > sampler);
     GGL_GET_CONTEXT(ctx, iface);
+    FlushBinned(ctx);
     if (!texture)
         SetShaderVerifyFunctions(iface);
     else if (ctx->state.textureState.textures[sampler].format != texture->format)
@@ -402,14 +621,41 @@ static void SetSampler(GGLInterface * iface, const unsigned sampler, GGLTexture
         SetShaderVerifyFunctions(iface);
     else if (ctx->state.textureState.textures[sampler].magFilter != texture->magFilter)
         SetShaderVerifyFunctions(iface);
+    else if (ctx->state.textureState.textures[sampler].layout != StorageLayout(texture))
+        SetShaderVerifyFunctions(iface);
+    else if (ctx->state.textureState.textures[sampler].constantSize != texture->constantSize)
+        SetShaderVerifyFunctions(iface);
+    else if (IsPowerOf2Texture(ctx->state.textureState.textures[sampler]) != IsPowerOf2Texture(*texture))
+        SetShaderVerifyFunctions(iface);
+    else if (texture->constantSize && (ctx->state.textureState.textures[sampler].width != texture->width ||
+                                       ctx->state.textureState.textures[sampler].height != texture->height))
+        SetShaderVerifyFunctions(iface);
              
     if (texture)
     {
         ctx->state.textureState.textures[sampler] = *texture; // shallow copy, data pointed to must remain valid 
+        ctx->state.textureState.textures[sampler].layout = StorageLayout(texture);
+        if (GGL_PIXEL_FORMAT_ETC1 == texture->format)
+            InvalidateETC1Caches(); // blocks may have been replaced at the same address
         //ctx->state.textureState.textureData[sampler] = texture->levels[0];
         ctx->state.textureState.textureData[sampler] = texture->levels;
         ctx->state.textureState.textureDimensions[sampler * 2] = texture->width;
         ctx->state.textureState.textureDimensions[sampler * 2 + 1] = texture->height;
+        const unsigned levelCount = MIN2(MAX2(texture->levelCount, 1u), (unsigned)GGL_MAXTEXTURELEVELS);
+        for (unsigned level = 0; level < levelCount; level++)
+            ctx->state.textureState.textureLevels[sampler * GGL_MAXTEXTURELEVELS + level] =
+                LevelOffset(texture, level, 0);
+        ctx->state.textureState.textureMaxLevel[sampler] =
+            GGLTexture::GGL_NEAREST_MIPMAP_NEAREST > texture->minFilter ? 0 : levelCount - 1;
+        unsigned * shifts = ctx->state.textureState.textureShifts + sampler * 2;
+        shifts[0] = shifts[1] = 0;
+        if (IsPowerOf2Texture(*texture))
+        {
+            while ((texture->width >> shifts[0]) > 1)
+                shifts[0]++;
+            while ((texture->height >> shifts[1]) > 1)
+                shifts[1]++;
+        }
     }
     else
     {
@@ -417,10 +663,205 @@ static void SetSampler(GGLInterface * iface, const unsigned sampler, GGLTexture
         ctx->state.textureState.textureData[sampler] = NULL;
         ctx->state.textureState.textureDimensions[sampler * 2] = 0;
         ctx->state.textureState.textureDimensions[sampler * 2 + 1] = 0;
+        ctx->state.textureState.textureMaxLevel[sampler] = 0;
+        ctx->state.textureState.textureShifts[sampler * 2] = 0;
+        ctx->state.textureState.textureShifts[sampler * 2 + 1] = 0;
     }
 }
 
+static void SetSamplerSurface(GGLInterface * iface, const unsigned sampler, const GGLSurface * surface,
+                              const GGLTexture * parameters)
+{
+    assert(GGL_MAXCOMBINEDTEXTUREIMAGEUNITS > sampler);
+    GGL_GET_CONTEXT(ctx, iface);
+    if (!surface || !surface->data)
+        return SetSampler(iface, sampler, NULL);
+    switch (surface->format) {
+    case GGL_PIXEL_FORMAT_RGBA_8888:
+    case GGL_PIXEL_FORMAT_RGBX_8888:
+    case GGL_PIXEL_FORMAT_RGB_565:
+        break;
+    default: // depth and stencil surfaces are not sampleable
+        return gglError(GL_INVALID_ENUM);
+    }
+    if (surface->stride && surface->stride != surface->width)
+        return gglError(GL_INVALID_OPERATION); // sampler rows are width texels apart
+
+    // tiles and fast clears still pending for the render target must land before it is read
+    if (surface->data == ctx->frameSurface.data)
+        iface->Finish(iface);
+
+    GGLTexture texture;
+    memset(&texture, 0, sizeof(texture));
+    texture.type = GL_TEXTURE_2D;
+    texture.format = surface->format;
+    texture.width = surface->width;
+    texture.height = surface->height;
+    texture.levelCount = 1;
+    texture.levels = surface->data;
+    if (parameters)
+    {
+        texture.wrapS = parameters->wrapS;
+        texture.wrapT = parameters->wrapT;
+        texture.minFilter = parameters->minFilter;
+        texture.magFilter = parameters->magFilter;
+        texture.constantSize = parameters->constantSize;
+    }
+    else
+    {
+        texture.wrapS = texture.wrapT = GGLTexture::GGL_CLAMP_TO_EDGE;
+        texture.magFilter = texture.minFilter = GGLTexture::GGL_LINEAR;
+    }
+    SetSampler(iface, sampler, &texture);
+}
+
+static unsigned TexelBytes(const GGLPixelFormat format)
+{
+    switch (format)
+    {
+    case GGL_PIXEL_FORMAT_A_8:
+    case GGL_PIXEL_FORMAT_L_8:
+        return 1;
+    case GGL_PIXEL_FORMAT_RGB_565:
+    case GGL_PIXEL_FORMAT_RGBA_4444:
+    case GGL_PIXEL_FORMAT_RGBA_5551:
+    case GGL_PIXEL_FORMAT_LA_88:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+unsigned GGLTextureDataSize(const GGLTexture * texture)
+{
+    const unsigned texels = LevelOffset(texture, MAX2(texture->levelCount, 1u), 0);
+    if (GGL_PIXEL_FORMAT_ETC1 == texture->format)
+        return texels / 2; // 8 bytes per 4x4 block
+    return texels * TexelBytes(texture->format);
+}
+
+void GGLTextureStore(const GGLTexture * texture, const unsigned level, const unsigned face,
+                     const void * pixels)
+{
+    assert(MAX2(texture->levelCount, 1u) > level);
+    assert((GL_TEXTURE_CUBE_MAP == texture->type ? 6u : 1u) > face);
+    const unsigned bytes = TexelBytes(texture->format);
+    const unsigned width = MAX2(texture->width >> level, 1u), height = MAX2(texture->height >> level, 1u);
+    char * data = (char *)texture->levels + LevelOffset(texture, level, face) * bytes;
+    const char * src = (const char *)pixels;
+    if (GGL_PIXEL_FORMAT_ETC1 == texture->format) // rows of blocks are already in tile order
+    {
+        memcpy((char *)texture->levels + LevelOffset(texture, level, face) / 2, src,
+               ((width + 3) / 4) * ((height + 3) / 4) * 8);
+        InvalidateETC1Caches(); // blocks are replaced at the same address
+        return;
+    }
+    if (GGLTexture::GGL_LINEAR_LAYOUT == texture->layout)
+        return (void)memcpy(data, src, width * height * bytes);
+    for (unsigned y = 0; y < height; y++)
+        for (unsigned x = 0; x < width; x += 4) // a row of a tile at a time
+            memcpy(data + TexelIndex(texture->layout, x, y, width) * bytes,
+                   src + (y * width + x) * bytes, MIN2(4u, width - x) * bytes);
+}
+
+// rounded averages of 2x2 texels, channels are summed in parallel within a word
+template<GGLPixelFormat format>
+static inline unsigned Average(const unsigned a, const unsigned b, const unsigned c, const unsigned d)
+{
+    if (GGL_PIXEL_FORMAT_RGBA_8888 == format || GGL_PIXEL_FORMAT_RGBX_8888 == format)
+    {
+        const unsigned rb = (a & 0xff00ff) + (b & 0xff00ff) + (c & 0xff00ff) + (d & 0xff00ff) + 0x20002;
+        const unsigned ga = ((a >> 8) & 0xff00ff) + ((b >> 8) & 0xff00ff) + ((c >> 8) & 0xff00ff) +
+                            ((d >> 8) & 0xff00ff) + 0x20002;
+        return ((rb >> 2) & 0xff00ff) | (((ga >> 2) & 0xff00ff) << 8);
+    }
+    else if (GGL_PIXEL_FORMAT_RGB_565 == format)
+    {
+        const unsigned rb = (a & 0xf81f) + (b & 0xf81f) + (c & 0xf81f) + (d & 0xf81f) + 0x1002;
+        const unsigned g = (a & 0x7e0) + (b & 0x7e0) + (c & 0x7e0) + (d & 0x7e0) + 0x40;
+        return ((rb >> 2) & 0xf81f) | ((g >> 2) & 0x7e0);
+    }
+    else if (GGL_PIXEL_FORMAT_RGBA_4444 == format) // nibbles are spread to 8 bit lanes
+    {
+        const unsigned rgba = (a & 0x0f0f) + (b & 0x0f0f) + (c & 0x0f0f) + (d & 0x0f0f) +
+                              ((a & 0xf0f0) << 12) + ((b & 0xf0f0) << 12) + ((c & 0xf0f0) << 12) +
+                              ((d & 0xf0f0) << 12) + 0x02020202;
+        return ((rgba >> 2) & 0x0f0f) | ((rgba >> 14) & 0xf0f0);
+    }
+    else if (GGL_PIXEL_FORMAT_RGBA_5551 == format)
+    {
+        const unsigned rb = (a & 0xf83e) + (b & 0xf83e) + (c & 0xf83e) + (d & 0xf83e) + 0x1004;
+        const unsigned ga = (a & 0x07c1) + (b & 0x07c1) + (c & 0x07c1) + (d & 0x07c1) + 0x82;
+        return ((rb >> 2) & 0xf83e) | ((ga >> 2) & 0x07c1);
+    }
+    else // A_8, L_8 and LA_88; bytes are spread to 16 bit lanes
+    {
+        const unsigned la = (a & 0xff) + (b & 0xff) + (c & 0xff) + (d & 0xff) +
+                            ((a & 0xff00) << 8) + ((b & 0xff00) << 8) + ((c & 0xff00) << 8) +
+                            ((d & 0xff00) << 8) + 0x20002;
+        return ((la >> 2) & 0xff) | ((la >> 10) & 0xff00);
+    }
+}
+
+template<GGLPixelFormat format, typename Texel>
+static void BoxFilterLevel(const GGLTexture * texture, const unsigned level, const unsigned face)
+{
+    const unsigned srcWidth = MAX2(texture->width >> (level - 1), 1u);
+    const unsigned srcHeight = MAX2(texture->height >> (level - 1), 1u);
+    const unsigned width = MAX2(srcWidth >> 1, 1u), height = MAX2(srcHeight >> 1, 1u);
+    const unsigned layout = texture->layout;
+    const Texel * src = (const Texel *)texture->levels + LevelOffset(texture, level - 1, face);
+    Texel * dst = (Texel *)texture->levels + LevelOffset(texture, level, face);
+    for (unsigned y = 0; y < height; y++)
+    {
+        const unsigned y0 = MIN2(y * 2, srcHeight - 1), y1 = MIN2(y * 2 + 1, srcHeight - 1);
+        for (unsigned x = 0; x < width; x++)
+        {
+            const unsigned x0 = MIN2(x * 2, srcWidth - 1), x1 = MIN2(x * 2 + 1, srcWidth - 1);
+            dst[TexelIndex(layout, x, y, width)] = Average<format>(src[TexelIndex(layout, x0, y0, srcWidth)],
+                src[TexelIndex(layout, x1, y0, srcWidth)], src[TexelIndex(layout, x0, y1, srcWidth)],
+                src[TexelIndex(layout, x1, y1, srcWidth)]);
+        }
+    }
+}
+
+void GGLTextureGenerateMipmaps(const GGLTexture * texture)
+{
+    const unsigned faces = GL_TEXTURE_CUBE_MAP == texture->type ? 6 : 1;
+    const unsigned levelCount = MIN2(texture->levelCount, (unsigned)GGL_MAXTEXTURELEVELS);
+    for (unsigned level = 1; level < levelCount; level++)
+        for (unsigned face = 0; face < faces; face++)
+            switch (texture->format)
+            {
+            case GGL_PIXEL_FORMAT_RGBA_8888:
+            case GGL_PIXEL_FORMAT_RGBX_8888:
+                BoxFilterLevel<GGL_PIXEL_FORMAT_RGBA_8888, unsigned>(texture, level, face);
+                break;
+            case GGL_PIXEL_FORMAT_RGB_565:
+                BoxFilterLevel<GGL_PIXEL_FORMAT_RGB_565, unsigned short>(texture, level, face);
+                break;
+            case GGL_PIXEL_FORMAT_RGBA_4444:
+                BoxFilterLevel<GGL_PIXEL_FORMAT_RGBA_4444, unsigned short>(texture, level, face);
+                break;
+            case GGL_PIXEL_FORMAT_RGBA_5551:
+                BoxFilterLevel<GGL_PIXEL_FORMAT_RGBA_5551, unsigned short>(texture, level, face);
+                break;
+            case GGL_PIXEL_FORMAT_A_8:
+            case GGL_PIXEL_FORMAT_L_8:
+                BoxFilterLevel<GGL_PIXEL_FORMAT_L_8, unsigned char>(texture, level, face);
+                break;
+            case GGL_PIXEL_FORMAT_LA_88:
+                BoxFilterLevel<GGL_PIXEL_FORMAT_LA_88, unsigned short>(texture, level, face);
+                break;
+            default:
+                assert(!"unsupported mipmap format");
+                return;
+            }
+}
+
 void InitializeTextureFunctions(GGLInterface * iface)
 {
     iface->SetSampler = SetSampler;
+    iface->SetSamplerSurface = SetSamplerSurface;
+    pthread_once(&etc1CacheOnce, CreateETC1CacheKey);
 }
\ No newline at end of file
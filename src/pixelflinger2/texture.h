@@ -40,4 +40,7 @@ void tex2d_int32(unsigned sample[4], const float tex_coord[4], const unsigned sa
 
 void InitializeTextureFunctions(struct GGLInterface * iface);
 
+// texel at index into ETC1 data as 0xAABBGGRR, index is in tiled layout; called by jit sampler
+extern "C" unsigned GGLSampleETC1(const void * data, const unsigned index);
+
 #endif // #ifndef _TEXTURE_H_
\ No newline at end of file
@@ -0,0 +1,335 @@
+/**
+ **
+ ** Copyright 2010, The Android Open Source Project
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include "pixelflinger2.h"
+#include "src/mesa/main/mtypes.h"
+
+#if USE_TILED_RASTER
+
+// Trapezoids and triangles are binned into GGL_TILE_SIZE square tiles of frameSurface, in submission order.
+// Each tile with work is a job; a job is claimed by exactly one thread per flush, so depth,
+// stencil and color read-modify-writes of a pixel never race, and primitives within a tile
+// stay ordered. Jobs are claimed with an atomic increment, and the only locking is to park
+// and wake threads that ran out of spins.
+
+static inline void CpuRelax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+   __asm__ __volatile__("pause" ::: "memory");
+#else
+   __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+static void ShadeTile(const GGLContext * ctx, const unsigned tile)
+{
+   const GGLContext::RasterPool & pool = ctx->rasterPool;
+   const int tx = tile % pool.tilesX, ty = tile / pool.tilesX;
+   GGLRect rect; // tile within clipRect, not empty since primitives are only binned there
+   rect.left = MAX2(tx << GGL_TILE_SIZE_SHIFT, ctx->clipRect.left);
+   rect.top = MAX2(ty << GGL_TILE_SIZE_SHIFT, ctx->clipRect.top);
+   rect.right = MIN2((tx + 1) << GGL_TILE_SIZE_SHIFT, ctx->clipRect.right);
+   rect.bottom = MIN2((ty + 1) << GGL_TILE_SIZE_SHIFT, ctx->clipRect.bottom);
+   ResolveRect(ctx, rect); // fill fast cleared buffers of tile before shading it
+   const unsigned short * bin = pool.bins + tile * GGL_MAX_BINNED_PRIMITIVES;
+   for (unsigned i = 0; i < pool.binSizes[tile]; i++) {
+      GGLTrapezoid * trapezoid = pool.primitives + bin[i];
+#if USE_QUAD_RASTER
+      if (trapezoid->triangle) {
+         RasterTriangleRect(ctx, &trapezoid->tl, &trapezoid->tr, &trapezoid->bl,
+                            &trapezoid->activeStencil, rect);
+         continue;
+      }
+#endif
+      RasterTrapezoidRect(ctx, &trapezoid->tl, &trapezoid->tr, &trapezoid->bl,
+                          &trapezoid->br, &trapezoid->activeStencil, rect);
+   }
+}
+
+static void ShadeJobs(const GGLContext * ctx)
+{
+   GGLContext::RasterPool & pool = ctx->rasterPool;
+   while (true) {
+      const unsigned job = __sync_fetch_and_add(&pool.nextJob, 1);
+      if (job >= pool.jobCount)
+         break;
+      ShadeTile(ctx, pool.jobs[job]);
+   }
+}
+
+static void * RasterWorker(void * threadArgs)
+{
+   GGLContext::RasterPool::Thread * args = (GGLContext::RasterPool::Thread *)threadArgs;
+   GGLContext::RasterPool & pool = args->ctx->rasterPool;
+
+   while (true) {
+      for (unsigned spin = 0; args->generation == pool.generation && !pool.quit; spin++) {
+         if (spin < GGL_RASTER_SPIN_COUNT) {
+            CpuRelax();
+            continue;
+         }
+         pthread_mutex_lock(&pool.lock);
+         __sync_fetch_and_add(&pool.parkedCount, 1); // full barrier before rechecking generation
+         while (args->generation == pool.generation && !pool.quit)
+            pthread_cond_wait(&pool.startCond, &pool.lock);
+         __sync_fetch_and_sub(&pool.parkedCount, 1);
+         pthread_mutex_unlock(&pool.lock);
+      }
+      if (pool.quit)
+         break;
+      args->generation = pool.generation;
+      __sync_synchronize(); // bins and jobs were written before generation
+
+      ShadeJobs(args->ctx);
+
+      if (!__sync_sub_and_fetch(&pool.busyCount, 1) && pool.joinParked) {
+         pthread_mutex_lock(&pool.lock);
+         pthread_cond_signal(&pool.finishCond);
+         pthread_mutex_unlock(&pool.lock);
+      }
+   }
+   return NULL;
+}
+
+static void StopRasterThreads(GGLContext::RasterPool & pool)
+{
+   pthread_mutex_lock(&pool.lock);
+   pool.quit = true;
+   pthread_cond_broadcast(&pool.startCond);
+   pthread_mutex_unlock(&pool.lock);
+   for (unsigned i = 1; i < pool.threadCount; i++)
+      pthread_join(pool.threads[i].thread, NULL);
+   pool.quit = false;
+   pool.threadCount = 1;
+}
+
+static void SetRasterThreads(GGLInterface * iface, unsigned count)
+{
+   GGL_GET_CONTEXT(ctx, iface);
+   GGLContext::RasterPool & pool = ctx->rasterPool;
+   if (!count) {
+      const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      count = cpus > 0 ? cpus : 1;
+   }
+   count = MIN2(count, GGL_MAX_RASTER_THREADS);
+   if (count == pool.threadCount)
+      return;
+
+   FlushTiles(ctx);
+   StopRasterThreads(pool);
+
+   pthread_attr_t attr;
+   pthread_attr_init(&attr);
+   pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+   for (unsigned i = 0; i < count; i++) {
+      GGLContext::RasterPool::Thread & thread = pool.threads[i];
+      thread.ctx = ctx;
+      thread.index = i;
+      thread.generation = pool.generation;
+      if (!i)
+         continue; // calling thread
+      int rc = pthread_create(&thread.thread, &attr, RasterWorker, &thread);
+      assert(!rc);
+      pool.threadCount = i + 1;
+   }
+   pthread_attr_destroy(&attr);
+}
+
+// called with an empty pool, sizes bins to current frameSurface
+static void ResizeBins(GGLContext::RasterPool & pool, const unsigned width, const unsigned height)
+{
+   pool.tilesX = (width + GGL_TILE_SIZE - 1) >> GGL_TILE_SIZE_SHIFT;
+   pool.tilesY = (height + GGL_TILE_SIZE - 1) >> GGL_TILE_SIZE_SHIFT;
+   const unsigned tileCount = pool.tilesX * pool.tilesY;
+   if (tileCount > pool.tileCapacity) {
+      free(pool.bins);
+      free(pool.binSizes);
+      free(pool.jobs);
+      pool.bins = (unsigned short *)malloc(tileCount * GGL_MAX_BINNED_PRIMITIVES * sizeof(*pool.bins));
+      pool.binSizes = (unsigned *)malloc(tileCount * sizeof(*pool.binSizes));
+      pool.jobs = (unsigned *)malloc(tileCount * sizeof(*pool.jobs));
+      assert(pool.bins && pool.binSizes && pool.jobs);
+      pool.tileCapacity = tileCount;
+   }
+   memset(pool.binSizes, 0, tileCount * sizeof(*pool.binSizes));
+   pool.jobCount = 0;
+}
+
+// adds primitive to bins of tiles overlapped by its conservative pixel bounds within clipRect,
+// returns NULL if it is outside clipRect
+static GGLTrapezoid * BinPrimitive(const GGLContext * ctx, const VectorComp_t top,
+                                   const VectorComp_t bottom, const VectorComp_t left,
+                                   const VectorComp_t right)
+{
+   GGLContext::RasterPool & pool = ctx->rasterPool;
+   const GGLRect & clip = ctx->clipRect;
+   if (top >= clip.bottom || bottom < clip.top || left >= clip.right || right < clip.left)
+      return NULL;
+   const unsigned tileTop = (unsigned)MAX2(top, VectorComp_t_CTR(clip.top)) >> GGL_TILE_SIZE_SHIFT;
+   const unsigned tileBottom = (unsigned)MIN2(bottom, VectorComp_t_CTR(clip.bottom - 1)) >> GGL_TILE_SIZE_SHIFT;
+   const unsigned tileLeft = (unsigned)MAX2(left, VectorComp_t_CTR(clip.left)) >> GGL_TILE_SIZE_SHIFT;
+   const unsigned tileRight = (unsigned)MIN2(right, VectorComp_t_CTR(clip.right - 1)) >> GGL_TILE_SIZE_SHIFT;
+   const int width = ctx->frameSurface.width, height = ctx->frameSurface.height;
+
+   if (GGL_MAX_BINNED_PRIMITIVES == pool.primitiveCount)
+      FlushTiles(ctx);
+   if (!pool.primitiveCount)
+      ResizeBins(pool, width, height);
+
+   const unsigned index = pool.primitiveCount++;
+   for (unsigned ty = tileTop; ty <= tileBottom; ty++)
+      for (unsigned tx = tileLeft; tx <= tileRight; tx++) {
+         const unsigned tile = ty * pool.tilesX + tx;
+         if (!pool.binSizes[tile])
+            pool.jobs[pool.jobCount++] = tile;
+         pool.bins[tile * GGL_MAX_BINNED_PRIMITIVES + pool.binSizes[tile]++] = index;
+      }
+
+   GGLTrapezoid * primitive = pool.primitives + index;
+   primitive->activeStencil = ctx->activeStencil;
+   return primitive;
+}
+
+void BinTrapezoid(const GGLContext * ctx, const VertexOutput * tl, const VertexOutput * tr,
+                  const VertexOutput * bl, const VertexOutput * br)
+{
+   // trapezoid x extents lie between its corners
+   GGLTrapezoid * trapezoid = BinPrimitive(ctx, MIN2(tl->position.y, tr->position.y),
+                                           MAX2(bl->position.y, br->position.y),
+                                           MIN2(tl->position.x, bl->position.x),
+                                           MAX2(tr->position.x, br->position.x));
+   if (!trapezoid)
+      return;
+   trapezoid->tl = *tl;
+   trapezoid->tr = *tr;
+   trapezoid->bl = *bl;
+   trapezoid->br = *br;
+   trapezoid->triangle = false;
+}
+
+void BinTriangle(const GGLContext * ctx, const VertexOutput * v1, const VertexOutput * v2,
+                 const VertexOutput * v3)
+{
+   GGLTrapezoid * triangle = BinPrimitive(ctx,
+                                          MIN2(MIN2(v1->position.y, v2->position.y), v3->position.y),
+                                          MAX2(MAX2(v1->position.y, v2->position.y), v3->position.y),
+                                          MIN2(MIN2(v1->position.x, v2->position.x), v3->position.x),
+                                          MAX2(MAX2(v1->position.x, v2->position.x), v3->position.x));
+   if (!triangle)
+      return;
+   triangle->tl = *v1;
+   triangle->tr = *v2;
+   triangle->bl = *v3;
+   triangle->triangle = true;
+}
+
+void FlushTiles(const GGLContext * ctx)
+{
+   GGLContext::RasterPool & pool = ctx->rasterPool;
+   if (ctx->CurrentProgram && ctx == ctx->CurrentProgram->BinningContext)
+      ctx->CurrentProgram->BinningContext = NULL; // nothing left to flush from other threads
+   if (!pool.primitiveCount)
+      return;
+
+   if (pool.jobCount > 1) {
+      pool.nextJob = 0;
+      pool.busyCount = pool.threadCount - 1;
+      __sync_fetch_and_add(&pool.generation, 1); // full barrier, publishes bins and jobs
+      if (pool.parkedCount) {
+         pthread_mutex_lock(&pool.lock);
+         pthread_cond_broadcast(&pool.startCond);
+         pthread_mutex_unlock(&pool.lock);
+      }
+
+      ShadeJobs(ctx);
+
+      // single join per flush
+      for (unsigned spin = 0; pool.busyCount; spin++) {
+         if (spin < GGL_RASTER_SPIN_COUNT) {
+            CpuRelax();
+            continue;
+         }
+         pthread_mutex_lock(&pool.lock);
+         __sync_fetch_and_add(&pool.joinParked, 1); // full barrier before rechecking busyCount
+         while (pool.busyCount)
+            pthread_cond_wait(&pool.finishCond, &pool.lock);
+         __sync_fetch_and_sub(&pool.joinParked, 1);
+         pthread_mutex_unlock(&pool.lock);
+      }
+      __sync_synchronize(); // workers' writes are visible to caller
+   } else if (pool.jobCount) // not worth waking workers
+      ShadeTile(ctx, pool.jobs[0]);
+
+   for (unsigned i = 0; i < pool.jobCount; i++)
+      pool.binSizes[pool.jobs[i]] = 0;
+   pool.jobCount = 0;
+   pool.primitiveCount = 0;
+}
+
+void InitializeTileFunctions(GGLInterface * iface)
+{
+   GGL_GET_CONTEXT(ctx, iface);
+   GGLContext::RasterPool & pool = ctx->rasterPool;
+   memset(&pool, 0, sizeof(pool));
+   pthread_mutex_init(&pool.lock, NULL);
+   pthread_cond_init(&pool.startCond, NULL);
+   pthread_cond_init(&pool.finishCond, NULL);
+   pool.threadCount = 1;
+   // VertexOutput must be 16 byte aligned for LLVM generated code
+   pool.primitives = (GGLTrapezoid *)memalign(16, GGL_MAX_BINNED_PRIMITIVES * sizeof(*pool.primitives));
+   assert(pool.primitives);
+
+   iface->SetRasterThreads = SetRasterThreads;
+   iface->SetRasterThreads(iface, 0);
+}
+
+void DestroyTileFunctions(GGLInterface * iface)
+{
+   GGL_GET_CONTEXT(ctx, iface);
+   GGLContext::RasterPool & pool = ctx->rasterPool;
+   FlushTiles(ctx);
+   StopRasterThreads(pool);
+   free(pool.primitives);
+   free(pool.bins);
+   free(pool.binSizes);
+   free(pool.jobs);
+   pthread_cond_destroy(&pool.startCond);
+   pthread_cond_destroy(&pool.finishCond);
+   pthread_mutex_destroy(&pool.lock);
+}
+
+#else // #if USE_TILED_RASTER
+
+static void SetRasterThreads(GGLInterface * iface, unsigned count)
+{
+}
+
+void InitializeTileFunctions(GGLInterface * iface)
+{
+   iface->SetRasterThreads = SetRasterThreads;
+}
+
+void DestroyTileFunctions(GGLInterface * iface)
+{
+}
+
+#endif // #if USE_TILED_RASTER
@@ -0,0 +1,1266 @@
+/**
+ **
+ ** Copyright 2011, The Android Open Source Project
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <pthread.h>
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "pixelflinger2.h"
+
+// A trace is a header followed by records, each an opcode byte and its arguments in host
+// byte order and struct layout, so it replays on the same architecture it was recorded on.
+// Objects are identified by their address when recorded: shaders, programs, and surface and
+// texture data, which replay allocates. Texture data is recorded the first time it is set
+// and again only when its contents change; surface contents are not recorded.
+
+static const unsigned TRACE_MAGIC = 0x54324650; // "PF2T"
+static const unsigned TRACE_VERSION = 1;
+
+enum TraceOp {
+   TRACE_CULL_FACE = 1, TRACE_FRONT_FACE, TRACE_DEPTH_RANGE, TRACE_VIEWPORT,
+   TRACE_BLEND_COLOR, TRACE_BLEND_EQUATION, TRACE_BLEND_FUNC, TRACE_ENABLE_DISABLE, TRACE_SCISSOR,
+   TRACE_DEPTH_FUNC, TRACE_STENCIL_FUNC, TRACE_STENCIL_OP, TRACE_STENCIL_SELECT,
+   TRACE_CLEAR_STENCIL, TRACE_CLEAR_COLOR, TRACE_CLEAR_DEPTH, TRACE_CLEAR, TRACE_SET_FAST_CLEAR,
+   TRACE_FINISH, TRACE_SET_SAMPLER, TRACE_SET_BUFFER,
+   TRACE_PROCESS_VERTEX, TRACE_DRAW_TRIANGLE, TRACE_DRAW_ARRAYS, TRACE_DRAW_ELEMENTS,
+   TRACE_RASTER_TRIANGLE, TRACE_RASTER_TRAPEZOID, TRACE_SCAN_LINE,
+   TRACE_SHADER_CREATE, TRACE_SHADER_SOURCE, TRACE_SHADER_COMPILE, TRACE_SHADER_DELETE,
+   TRACE_PROGRAM_CREATE, TRACE_SHADER_ATTACH, TRACE_SHADER_DETACH, TRACE_PROGRAM_LINK,
+   TRACE_PROGRAM_DELETE, TRACE_SHADER_USE, TRACE_ATTRIBUTE_BIND, TRACE_UNIFORM, TRACE_UNIFORM_MATRIX, TRACE_FLUSH,
+   TRACE_SET_SAMPLER_SURFACE
+};
+
+typedef unsigned long long TraceId;
+
+struct TraceHeader {
+   unsigned magic, version;
+   unsigned vertexInputSize, vertexOutputSize, textureSize; // layout check
+};
+
+struct Trace {
+   GGLInterface interface; // must be first, trace functions cast iface to Trace
+   GGLInterface * iface; // wrapped
+   FILE * file;
+   bool writeFailed; // trace is incomplete, reported by DestroyGGLTraceInterface
+   std::map<const void *, unsigned long long> textures; // levels to hash of recorded data
+   std::set<const void *> surfaces; // data set by SetBuffer, contents are reproduced by replay
+   std::set<const void *> owned; // shaders and programs created through this trace
+};
+
+// shader functions that do not take iface record into the trace that created the object
+static std::map<const void *, Trace *> owners;
+static pthread_mutex_t ownersLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void SetOwner(Trace * trace, const void * object)
+{
+   pthread_mutex_lock(&ownersLock);
+   owners[object] = trace;
+   trace->owned.insert(object);
+   pthread_mutex_unlock(&ownersLock);
+}
+
+static void ClearOwner(Trace * trace, const void * object)
+{
+   pthread_mutex_lock(&ownersLock);
+   owners.erase(object);
+   trace->owned.erase(object);
+   pthread_mutex_unlock(&ownersLock);
+}
+
+static Trace * GetOwner(const void * object)
+{
+   pthread_mutex_lock(&ownersLock);
+   std::map<const void *, Trace *>::const_iterator it = owners.find(object);
+   Trace * const trace = owners.end() != it ? it->second : NULL;
+   pthread_mutex_unlock(&ownersLock);
+   assert(trace);
+   return trace;
+}
+
+static unsigned PixelBytes(const GGLPixelFormat format)
+{
+   switch (format) {
+   case GGL_PIXEL_FORMAT_A_8:
+   case GGL_PIXEL_FORMAT_L_8:
+   case GGL_PIXEL_FORMAT_RGB_332:
+   case GGL_PIXEL_FORMAT_S_8:
+      return 1;
+   case GGL_PIXEL_FORMAT_RGB_565:
+   case GGL_PIXEL_FORMAT_RGBA_5551:
+   case GGL_PIXEL_FORMAT_RGBA_4444:
+   case GGL_PIXEL_FORMAT_LA_88:
+   case GGL_PIXEL_FORMAT_Z_16:
+      return 2;
+   case GGL_PIXEL_FORMAT_RGB_888:
+      return 3;
+   default:
+      return 4;
+   }
+}
+
+
+static unsigned long long Hash(const void * data, const unsigned size)
+{
+   unsigned long long hash = 14695981039346656037ULL; // FNV-1a
+   for (const unsigned char * byte = (const unsigned char *)data; byte < (const unsigned char *)data + size; byte++)
+      hash = (hash ^ *byte) * 1099511628211ULL;
+   return hash;
+}
+
+#define GGL_GET_TRACE(trace, interface) Trace * trace = (Trace *)interface;
+
+static void Write(Trace * trace, const void * data, const unsigned size)
+{
+   if (size && !trace->writeFailed && 1 != fwrite(data, size, 1, trace->file))
+      trace->writeFailed = true; // rest of the trace would not parse, so stop writing
+}
+
+template <typename T>
+static inline void Write(Trace * trace, const T & value)
+{
+   Write(trace, &value, sizeof(value));
+}
+
+static inline void WriteOp(Trace * trace, const TraceOp op)
+{
+   Write(trace, (unsigned char)op);
+}
+
+static inline void WriteId(Trace * trace, const void * object)
+{
+   Write(trace, (TraceId)(unsigned long)object);
+}
+
+static void WriteString(Trace * trace, const char * string, int length = -1)
+{
+   if (string && length < 0)
+      length = strlen(string);
+   Write(trace, string ? (unsigned)length : ~0u); // NULL is ~0
+   if (string)
+      Write(trace, string, length);
+}
+
+static void CullFace(GGLInterface * iface, GLenum mode)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_CULL_FACE);
+   Write(trace, mode);
+   trace->iface->CullFace(trace->iface, mode);
+}
+
+static void FrontFace(GGLInterface * iface, GLenum mode)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_FRONT_FACE);
+   Write(trace, mode);
+   trace->iface->FrontFace(trace->iface, mode);
+}
+
+static void DepthRangef(GGLInterface * iface, GLclampf zNear, GLclampf zFar)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_DEPTH_RANGE);
+   Write(trace, zNear);
+   Write(trace, zFar);
+   trace->iface->DepthRangef(trace->iface, zNear, zFar);
+}
+
+static void Viewport(GGLInterface * iface, GLint x, GLint y, GLsizei width, GLsizei height)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_VIEWPORT);
+   Write(trace, x);
+   Write(trace, y);
+   Write(trace, width);
+   Write(trace, height);
+   trace->iface->Viewport(trace->iface, x, y, width, height);
+}
+
+static void ViewportTransform(const GGLInterface * iface, Vector4 * v)
+{
+   GGL_GET_TRACE(trace, iface);
+   trace->iface->ViewportTransform(trace->iface, v);
+}
+
+static void BlendColor(GGLInterface * iface, GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_BLEND_COLOR);
+   const GLclampf color[4] = {red, green, blue, alpha};
+   Write(trace, color);
+   trace->iface->BlendColor(trace->iface, red, green, blue, alpha);
+}
+
+static void BlendEquationSeparate(GGLInterface * iface, GLenum modeRGB, GLenum modeAlpha)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_BLEND_EQUATION);
+   Write(trace, modeRGB);
+   Write(trace, modeAlpha);
+   trace->iface->BlendEquationSeparate(trace->iface, modeRGB, modeAlpha);
+}
+
+static void BlendFuncSeparate(GGLInterface * iface, GLenum srcRGB, GLenum dstRGB,
+                              GLenum srcAlpha, GLenum dstAlpha)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_BLEND_FUNC);
+   const GLenum funcs[4] = {srcRGB, dstRGB, srcAlpha, dstAlpha};
+   Write(trace, funcs);
+   trace->iface->BlendFuncSeparate(trace->iface, srcRGB, dstRGB, srcAlpha, dstAlpha);
+}
+
+static void EnableDisable(GGLInterface * iface, GLenum cap, GLboolean enable)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_ENABLE_DISABLE);
+   Write(trace, cap);
+   Write(trace, enable);
+   trace->iface->EnableDisable(trace->iface, cap, enable);
+}
+
+static void Scissor(GGLInterface * iface, GLint x, GLint y, GLsizei width, GLsizei height)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_SCISSOR);
+   Write(trace, x);
+   Write(trace, y);
+   Write(trace, width);
+   Write(trace, height);
+   trace->iface->Scissor(trace->iface, x, y, width, height);
+}
+
+static void DepthFunc(GGLInterface * iface, GLenum func)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_DEPTH_FUNC);
+   Write(trace, func);
+   trace->iface->DepthFunc(trace->iface, func);
+}
+
+static void StencilFuncSeparate(GGLInterface * iface, GLenum face, GLenum func, GLint ref, GLuint mask)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_STENCIL_FUNC);
+   Write(trace, face);
+   Write(trace, func);
+   Write(trace, ref);
+   Write(trace, mask);
+   trace->iface->StencilFuncSeparate(trace->iface, face, func, ref, mask);
+}
+
+static void StencilOpSeparate(GGLInterface * iface, GLenum face, GLenum sfail,
+                              GLenum dpfail, GLenum dppass)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_STENCIL_OP);
+   const GLenum ops[4] = {face, sfail, dpfail, dppass};
+   Write(trace, ops);
+   trace->iface->StencilOpSeparate(trace->iface, face, sfail, dpfail, dppass);
+}
+
+static void StencilSelect(const GGLInterface * iface, GLenum face)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_STENCIL_SELECT);
+   Write(trace, face);
+   trace->iface->StencilSelect(trace->iface, face);
+}
+
+static void ClearStencil(GGLInterface * iface, GLint s)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_CLEAR_STENCIL);
+   Write(trace, s);
+   trace->iface->ClearStencil(trace->iface, s);
+}
+
+static void ClearColor(GGLInterface * iface, GLclampf r, GLclampf g, GLclampf b, GLclampf a)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_CLEAR_COLOR);
+   const GLclampf color[4] = {r, g, b, a};
+   Write(trace, color);
+   trace->iface->ClearColor(trace->iface, r, g, b, a);
+}
+
+static void ClearDepthf(GGLInterface * iface, GLclampf d)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_CLEAR_DEPTH);
+   Write(trace, d);
+   trace->iface->ClearDepthf(trace->iface, d);
+}
+
+static void Clear(const GGLInterface * iface, GLbitfield buf)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_CLEAR);
+   Write(trace, buf);
+   trace->iface->Clear(trace->iface, buf);
+}
+
+static void SetFastClear(GGLInterface * iface, GLboolean enable)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_SET_FAST_CLEAR);
+   Write(trace, enable);
+   trace->iface->SetFastClear(trace->iface, enable);
+}
+
+static void Flush(const GGLInterface * iface)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_FLUSH);
+   trace->iface->Flush(trace->iface);
+}
+
+static void Finish(const GGLInterface * iface)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_FINISH); // ends a frame for replay
+   trace->iface->Finish(trace->iface);
+   fflush(trace->file);
+}
+
+static void SetSampler(GGLInterface * iface, const unsigned sampler, GGLTexture * texture)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_SET_SAMPLER);
+   Write(trace, sampler);
+   Write(trace, (unsigned char)(NULL != texture));
+   if (texture) {
+      Write(trace, *texture);
+      WriteId(trace, texture->levels);
+      const unsigned bytes = texture->levels ? GGLTextureDataSize(texture) : 0;
+      const unsigned long long hash = Hash(texture->levels, bytes);
+      std::map<const void *, unsigned long long>::iterator it = trace->textures.find(texture->levels);
+      const bool recorded = it != trace->textures.end() && it->second == hash;
+      trace->textures[texture->levels] = hash;
+      Write(trace, recorded ? 0u : bytes);
+      if (!recorded)
+         Write(trace, texture->levels, bytes);
+   }
+   trace->iface->SetSampler(trace->iface, sampler, texture);
+}
+
+static void SetBuffer(GGLInterface * iface, const GLenum type, GGLSurface * surface)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_SET_BUFFER);
+   Write(trace, type);
+   Write(trace, (unsigned char)(NULL != surface));
+   if (surface) {
+      Write(trace, *surface);
+      WriteId(trace, surface->data);
+      trace->textures.erase(surface->data); // may be rendered to, then used as texture
+      trace->surfaces.insert(surface->data);
+   }
+   trace->iface->SetBuffer(trace->iface, type, surface);
+}
+
+static void SetSamplerSurface(GGLInterface * iface, const unsigned sampler, const GGLSurface * surface,
+                              const GGLTexture * parameters)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_SET_SAMPLER_SURFACE);
+   Write(trace, sampler);
+   Write(trace, (unsigned char)(NULL != surface));
+   if (surface) {
+      Write(trace, *surface);
+      WriteId(trace, surface->data);
+      unsigned bytes = 0;
+      if (surface->data && !trace->surfaces.count(surface->data)) {
+         const unsigned stride = surface->stride ? surface->stride : surface->width;
+         bytes = stride * surface->height * PixelBytes(surface->format);
+         const unsigned long long hash = Hash(surface->data, bytes);
+         std::map<const void *, unsigned long long>::iterator it = trace->textures.find(surface->data);
+         if (it != trace->textures.end() && it->second == hash)
+            bytes = 0;
+         trace->textures[surface->data] = hash;
+      }
+      Write(trace, bytes);
+      Write(trace, surface->data, bytes);
+   }
+   Write(trace, (unsigned char)(NULL != parameters));
+   if (parameters)
+      Write(trace, *parameters);
+   trace->iface->SetSamplerSurface(trace->iface, sampler, surface, parameters);
+}
+
+static void ProcessVertex(const GGLInterface * iface, const VertexInput * input, VertexOutput * output)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_PROCESS_VERTEX);
+   Write(trace, *input);
+   trace->iface->ProcessVertex(trace->iface, input, output);
+}
+
+static void DrawTriangle(const GGLInterface * iface, const VertexInput * v0,
+                         const VertexInput * v1, const VertexInput * v2)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_DRAW_TRIANGLE);
+   Write(trace, *v0);
+   Write(trace, *v1);
+   Write(trace, *v2);
+   trace->iface->DrawTriangle(trace->iface, v0, v1, v2);
+}
+
+// only the vertices drawn are recorded, and replay draws them from first 0
+static void DrawArrays(const GGLInterface * iface, GLenum mode, const VertexInput * vertices,
+                       GLint first, GLsizei count)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_DRAW_ARRAYS);
+   Write(trace, mode);
+   Write(trace, count);
+   Write(trace, vertices + first, MAX2(count, 0) * sizeof(*vertices));
+   trace->iface->DrawArrays(trace->iface, mode, vertices, first, count);
+}
+
+static unsigned IndexBytes(const GLenum type)
+{
+   return GL_UNSIGNED_BYTE == type ? 1 : GL_UNSIGNED_SHORT == type ? 2 : 4;
+}
+
+static void DrawElements(const GGLInterface * iface, GLenum mode, const VertexInput * vertices,
+                         GLsizei count, GLenum type, const GLvoid * indices)
+{
+   GGL_GET_TRACE(trace, iface);
+   unsigned vertexCount = 0;
+   for (GLsizei i = 0; i < count; i++) {
+      unsigned index = 0;
+      if (GL_UNSIGNED_BYTE == type)
+         index = ((const GLubyte *)indices)[i];
+      else if (GL_UNSIGNED_SHORT == type)
+         index = ((const GLushort *)indices)[i];
+      else
+         index = ((const GLuint *)indices)[i];
+      vertexCount = MAX2(vertexCount, index + 1);
+   }
+   WriteOp(trace, TRACE_DRAW_ELEMENTS);
+   Write(trace, mode);
+   Write(trace, count);
+   Write(trace, type);
+   Write(trace, indices, MAX2(count, 0) * IndexBytes(type));
+   Write(trace, vertexCount);
+   Write(trace, vertices, vertexCount * sizeof(*vertices));
+   trace->iface->DrawElements(trace->iface, mode, vertices, count, type, indices);
+}
+
+static void RasterTriangle(const GGLInterface * iface, const VertexOutput * v1,
+                           const VertexOutput * v2, const VertexOutput * v3)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_RASTER_TRIANGLE);
+   Write(trace, *v1);
+   Write(trace, *v2);
+   Write(trace, *v3);
+   trace->iface->RasterTriangle(trace->iface, v1, v2, v3);
+}
+
+static void RasterTrapezoid(const GGLInterface * iface, const VertexOutput * tl,
+                            const VertexOutput * tr, const VertexOutput * bl, const VertexOutput * br)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_RASTER_TRAPEZOID);
+   Write(trace, *tl);
+   Write(trace, *tr);
+   Write(trace, *bl);
+   Write(trace, *br);
+   trace->iface->RasterTrapezoid(trace->iface, tl, tr, bl, br);
+}
+
+static void ScanLine(const GGLInterface * iface, const VertexOutput * v1, const VertexOutput * v2)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_SCAN_LINE);
+   Write(trace, *v1);
+   Write(trace, *v2);
+   trace->iface->ScanLine(trace->iface, v1, v2);
+}
+
+// raster threads and statistics are left to whoever replays the trace, so are not recorded
+static void SetRasterThreads(GGLInterface * iface, unsigned count)
+{
+   GGL_GET_TRACE(trace, iface);
+   trace->iface->SetRasterThreads(trace->iface, count);
+}
+
+static void GetStatistics(const GGLInterface * iface, GGLStatistics * stats)
+{
+   GGL_GET_TRACE(trace, iface);
+   trace->iface->GetStatistics(trace->iface, stats);
+}
+
+static void ResetStatistics(GGLInterface * iface)
+{
+   GGL_GET_TRACE(trace, iface);
+   trace->iface->ResetStatistics(trace->iface);
+}
+
+static void EnableStatistics(GGLInterface * iface, GLboolean enable)
+{
+   GGL_GET_TRACE(trace, iface);
+   trace->iface->EnableStatistics(trace->iface, enable);
+}
+
+static gl_shader * ShaderCreate(const GGLInterface * iface, GLenum type)
+{
+   GGL_GET_TRACE(trace, iface);
+   gl_shader * shader = trace->iface->ShaderCreate(trace->iface, type);
+   WriteOp(trace, TRACE_SHADER_CREATE);
+   Write(trace, type);
+   WriteId(trace, shader);
+   SetOwner(trace, shader);
+   return shader;
+}
+
+static void ShaderSource(gl_shader * shader, GLsizei count, const char ** string, const int * length)
+{
+   Trace * trace = GetOwner(shader);
+   WriteOp(trace, TRACE_SHADER_SOURCE);
+   WriteId(trace, shader);
+   Write(trace, count);
+   for (GLsizei i = 0; i < count; i++)
+      WriteString(trace, string[i], length && length[i] >= 0 ? length[i] : -1);
+   trace->iface->ShaderSource(shader, count, string, length);
+}
+
+static GLboolean ShaderCompile(const GGLInterface * iface, gl_shader * shader,
+                               const char * glsl, const char ** infoLog)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_SHADER_COMPILE);
+   WriteId(trace, shader);
+   WriteString(trace, glsl);
+   return trace->iface->ShaderCompile(trace->iface, shader, glsl, infoLog);
+}
+
+static void ShaderDelete(const GGLInterface * iface, gl_shader * shader)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_SHADER_DELETE);
+   WriteId(trace, shader);
+   ClearOwner(trace, shader);
+   trace->iface->ShaderDelete(trace->iface, shader);
+}
+
+static gl_shader_program * ShaderProgramCreate(const GGLInterface * iface)
+{
+   GGL_GET_TRACE(trace, iface);
+   gl_shader_program * program = trace->iface->ShaderProgramCreate(trace->iface);
+   WriteOp(trace, TRACE_PROGRAM_CREATE);
+   WriteId(trace, program);
+   SetOwner(trace, program);
+   return program;
+}
+
+static void ShaderAttach(const GGLInterface * iface, gl_shader_program * program, gl_shader * shader)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_SHADER_ATTACH);
+   WriteId(trace, program);
+   WriteId(trace, shader);
+   trace->iface->ShaderAttach(trace->iface, program, shader);
+}
+
+static void ShaderDetach(const GGLInterface * iface, gl_shader_program * program, gl_shader * shader)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_SHADER_DETACH);
+   WriteId(trace, program);
+   WriteId(trace, shader);
+   trace->iface->ShaderDetach(trace->iface, program, shader);
+}
+
+static GLboolean ShaderProgramLink(gl_shader_program * program, const char ** infoLog)
+{
+   Trace * trace = GetOwner(program);
+   WriteOp(trace, TRACE_PROGRAM_LINK);
+   WriteId(trace, program);
+   return trace->iface->ShaderProgramLink(program, infoLog);
+}
+
+static void ShaderProgramDelete(GGLInterface * iface, gl_shader_program * program)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_PROGRAM_DELETE);
+   WriteId(trace, program);
+   ClearOwner(trace, program);
+   trace->iface->ShaderProgramDelete(trace->iface, program);
+}
+
+static void ShaderUse(GGLInterface * iface, gl_shader_program * program)
+{
+   GGL_GET_TRACE(trace, iface);
+   WriteOp(trace, TRACE_SHADER_USE);
+   WriteId(trace, program);
+   trace->iface->ShaderUse(trace->iface, program);
+}
+
+static void ShaderAttributeBind(const gl_shader_program * program, GLuint index, const GLchar * name)
+{
+   Trace * trace = GetOwner(program);
+   WriteOp(trace, TRACE_ATTRIBUTE_BIND);
+   WriteId(trace, program);
+   Write(trace, index);
+   WriteString(trace, name);
+   trace->iface->ShaderAttributeBind(program, index, name);
+}
+
+static unsigned UniformBytes(const GLenum type, const GLsizei count)
+{
+   switch (type) {
+   case GL_FLOAT_VEC2:
+   case GL_INT_VEC2:
+   case GL_BOOL_VEC2:
+      return count * 2 * 4;
+   case GL_FLOAT_VEC3:
+   case GL_INT_VEC3:
+   case GL_BOOL_VEC3:
+      return count * 3 * 4;
+   case GL_FLOAT_VEC4:
+   case GL_INT_VEC4:
+   case GL_BOOL_VEC4:
+      return count * 4 * 4;
+   default:
+      return count * 4;
+   }
+}
+
+static GLint ShaderUniform(gl_shader_program * program, GLint location, GLsizei count,
+                           const GLvoid * values, GLenum type)
+{
+   Trace * trace = GetOwner(program);
+   WriteOp(trace, TRACE_UNIFORM);
+   WriteId(trace, program);
+   Write(trace, location);
+   Write(trace, count);
+   Write(trace, type);
+   Write(trace, values, -1 == location ? 0 : UniformBytes(type, count));
+   return trace->iface->ShaderUniform(program, location, count, values, type);
+}
+
+static void ShaderUniformMatrix(gl_shader_program * program, GLint cols, GLint rows, GLint location,
+                                GLsizei count, GLboolean transpose, const GLfloat * values)
+{
+   Trace * trace = GetOwner(program);
+   WriteOp(trace, TRACE_UNIFORM_MATRIX);
+   WriteId(trace, program);
+   Write(trace, cols);
+   Write(trace, rows);
+   Write(trace, location);
+   Write(trace, count);
+   Write(trace, transpose);
+   // GGLShaderUniformMatrix reads columns 4 floats apart
+   const unsigned floats = -1 == location || !count ? 0 : (cols * count - 1) * 4 + rows;
+   Write(trace, floats);
+   Write(trace, values, floats * sizeof(*values));
+   trace->iface->ShaderUniformMatrix(program, cols, rows, location, count, transpose, values);
+}
+
+GGLInterface * CreateGGLTraceInterface(GGLInterface * iface, const char * fileName)
+{
+   Trace * const trace = new Trace();
+   trace->iface = iface;
+   trace->writeFailed = false;
+   trace->file = fopen(fileName, "wb");
+   if (!trace->file) {
+      delete trace;
+      return NULL;
+   }
+   const TraceHeader header = {TRACE_MAGIC, TRACE_VERSION, sizeof(VertexInput),
+                               sizeof(VertexOutput), sizeof(GGLTexture)};
+   Write(trace, header);
+
+   // functions that do not change state are forwarded unrecorded
+   GGLInterface & traced = trace->interface;
+   traced = *iface;
+   traced.CullFace = CullFace;
+   traced.FrontFace = FrontFace;
+   traced.DepthRangef = DepthRangef;
+   traced.Viewport = Viewport;
+   traced.ViewportTransform = ViewportTransform;
+   traced.BlendColor = BlendColor;
+   traced.BlendEquationSeparate = BlendEquationSeparate;
+   traced.BlendFuncSeparate = BlendFuncSeparate;
+   traced.EnableDisable = EnableDisable;
+   traced.Scissor = Scissor;
+   traced.DepthFunc = DepthFunc;
+   traced.StencilFuncSeparate = StencilFuncSeparate;
+   traced.StencilOpSeparate = StencilOpSeparate;
+   traced.StencilSelect = StencilSelect;
+   traced.ClearStencil = ClearStencil;
+   traced.ClearColor = ClearColor;
+   traced.ClearDepthf = ClearDepthf;
+   traced.Clear = Clear;
+   traced.SetFastClear = SetFastClear;
+   traced.Flush = Flush;
+   traced.Finish = Finish;
+   traced.SetSampler = SetSampler;
+   traced.SetBuffer = SetBuffer;
+   traced.SetSamplerSurface = SetSamplerSurface;
+   traced.ProcessVertex = ProcessVertex;
+   traced.DrawTriangle = DrawTriangle;
+   traced.DrawArrays = DrawArrays;
+   traced.DrawElements = DrawElements;
+   traced.RasterTriangle = RasterTriangle;
+   traced.RasterTrapezoid = RasterTrapezoid;
+   traced.ScanLine = ScanLine;
+   traced.SetRasterThreads = SetRasterThreads;
+   traced.GetStatistics = GetStatistics;
+   traced.ResetStatistics = ResetStatistics;
+   traced.EnableStatistics = EnableStatistics;
+   traced.ShaderCreate = ShaderCreate;
+   traced.ShaderSource = ShaderSource;
+   traced.ShaderCompile = ShaderCompile;
+   traced.ShaderDelete = ShaderDelete;
+   traced.ShaderProgramCreate = ShaderProgramCreate;
+   traced.ShaderAttach = ShaderAttach;
+   traced.ShaderDetach = ShaderDetach;
+   traced.ShaderProgramLink = ShaderProgramLink;
+   traced.ShaderProgramDelete = ShaderProgramDelete;
+   traced.ShaderUse = ShaderUse;
+   traced.ShaderAttributeBind = ShaderAttributeBind;
+   traced.ShaderUniform = ShaderUniform;
+   traced.ShaderUniformMatrix = ShaderUniformMatrix;
+
+   return &trace->interface;
+}
+
+int DestroyGGLTraceInterface(GGLInterface * iface)
+{
+   GGL_GET_TRACE(trace, iface);
+   pthread_mutex_lock(&ownersLock);
+   for (std::set<const void *>::const_iterator it = trace->owned.begin(); it != trace->owned.end(); ++it)
+      owners.erase(*it);
+   pthread_mutex_unlock(&ownersLock);
+   const bool failed = fclose(trace->file) || trace->writeFailed;
+   if (failed)
+      fprintf(stderr, "pf2 trace: write failed, trace is incomplete \n");
+   delete trace;
+   return !failed;
+}
+
+struct GGLTraceReplay {
+   GGLInterface * iface;
+   FILE * file;
+   std::map<TraceId, gl_shader *> shaders;
+   std::map<TraceId, gl_shader_program *> programs;
+   std::map<TraceId, std::pair<void *, unsigned> > buffers; // surface and texture data, and size
+   std::vector<void *> retired; // data replaced while it may still be set, freed on close
+   void * scratch; // 16 byte aligned for vertices
+   unsigned scratchSize;
+   std::vector<char> bytes;
+   bool failed; // short read, calls are not made with what was read after it
+};
+
+static bool Read(GGLTraceReplay * replay, void * data, const unsigned size)
+{
+   if (size && 1 != fread(data, size, 1, replay->file)) {
+      memset(data, 0, size);
+      replay->failed = true;
+   }
+   return !replay->failed;
+}
+
+template <typename T>
+static inline T Read(GGLTraceReplay * replay)
+{
+   T value;
+   memset(&value, 0, sizeof(value));
+   Read(replay, &value, sizeof(value));
+   return value;
+}
+
+// reads size bytes into 16 byte aligned scratch, valid until next call
+static void * ReadScratch(GGLTraceReplay * replay, const unsigned size)
+{
+   if (size > replay->scratchSize) {
+      free(replay->scratch);
+      replay->scratch = memalign(16, size);
+      assert(replay->scratch);
+      replay->scratchSize = size;
+   }
+   Read(replay, replay->scratch, size);
+   return replay->scratch;
+}
+
+// NULL for NULL string, valid until next call
+static const char * ReadString(GGLTraceReplay * replay)
+{
+   const unsigned length = Read<unsigned>(replay);
+   if (~0u == length)
+      return NULL;
+   replay->bytes.resize(length + 1);
+   Read(replay, &replay->bytes[0], length);
+   replay->bytes[length] = 0;
+   return &replay->bytes[0];
+}
+
+// replay data for recorded id of at least size bytes
+static void * ReplayBuffer(GGLTraceReplay * replay, const TraceId id, const unsigned size)
+{
+   if (!id)
+      return NULL;
+   std::pair<void *, unsigned> & buffer = replay->buffers[id];
+   if (buffer.second < size) {
+      if (buffer.first)
+         replay->retired.push_back(buffer.first);
+      buffer.first = memalign(16, size);
+      assert(buffer.first);
+      memset(buffer.first, 0, size);
+      buffer.second = size;
+   }
+   return buffer.first;
+}
+
+GGLTraceReplay * GGLTraceReplayOpen(GGLInterface * iface, const char * fileName)
+{
+   FILE * file = fopen(fileName, "rb");
+   if (!file)
+      return NULL;
+   TraceHeader header;
+   if (1 != fread(&header, sizeof(header), 1, file) || TRACE_MAGIC != header.magic ||
+         TRACE_VERSION != header.version || sizeof(VertexInput) != header.vertexInputSize ||
+         sizeof(VertexOutput) != header.vertexOutputSize || sizeof(GGLTexture) != header.textureSize) {
+      fclose(file);
+      return NULL;
+   }
+   GGLTraceReplay * replay = new GGLTraceReplay();
+   replay->iface = iface;
+   replay->file = file;
+   replay->scratch = NULL;
+   replay->scratchSize = 0;
+   replay->failed = false;
+   return replay;
+}
+
+int GGLTraceReplayFrame(GGLTraceReplay * replay)
+{
+   GGLInterface * const iface = replay->iface;
+   int op = 0;
+   while (EOF != (op = fgetc(replay->file))) {
+      switch (op) {
+      case TRACE_CULL_FACE:
+      case TRACE_FRONT_FACE: {
+         const GLenum mode = Read<GLenum>(replay);
+         if (replay->failed)
+            break;
+         if (TRACE_CULL_FACE == op)
+            iface->CullFace(iface, mode);
+         else
+            iface->FrontFace(iface, mode);
+         break;
+      }
+      case TRACE_DEPTH_RANGE: {
+         const GLclampf zNear = Read<GLclampf>(replay), zFar = Read<GLclampf>(replay);
+         if (replay->failed)
+            break;
+         iface->DepthRangef(iface, zNear, zFar);
+         break;
+      }
+      case TRACE_VIEWPORT:
+      case TRACE_SCISSOR: {
+         GLint rect[4];
+         if (!Read(replay, rect, sizeof(rect)))
+            break;
+         if (TRACE_VIEWPORT == op)
+            iface->Viewport(iface, rect[0], rect[1], rect[2], rect[3]);
+         else
+            iface->Scissor(iface, rect[0], rect[1], rect[2], rect[3]);
+         break;
+      }
+      case TRACE_BLEND_COLOR:
+      case TRACE_CLEAR_COLOR: {
+         GLclampf color[4];
+         if (!Read(replay, color, sizeof(color)))
+            break;
+         if (TRACE_BLEND_COLOR == op)
+            iface->BlendColor(iface, color[0], color[1], color[2], color[3]);
+         else
+            iface->ClearColor(iface, color[0], color[1], color[2], color[3]);
+         break;
+      }
+      case TRACE_BLEND_EQUATION: {
+         const GLenum modeRGB = Read<GLenum>(replay), modeAlpha = Read<GLenum>(replay);
+         if (replay->failed)
+            break;
+         iface->BlendEquationSeparate(iface, modeRGB, modeAlpha);
+         break;
+      }
+      case TRACE_BLEND_FUNC: {
+         GLenum funcs[4];
+         if (!Read(replay, funcs, sizeof(funcs)))
+            break;
+         iface->BlendFuncSeparate(iface, funcs[0], funcs[1], funcs[2], funcs[3]);
+         break;
+      }
+      case TRACE_ENABLE_DISABLE: {
+         const GLenum cap = Read<GLenum>(replay);
+         const GLboolean enable = Read<GLboolean>(replay);
+         if (replay->failed)
+            break;
+         iface->EnableDisable(iface, cap, enable);
+         break;
+      }
+      case TRACE_DEPTH_FUNC: {
+         const GLenum func = Read<GLenum>(replay);
+         if (replay->failed)
+            break;
+         iface->DepthFunc(iface, func);
+         break;
+      }
+      case TRACE_STENCIL_FUNC: {
+         const GLenum face = Read<GLenum>(replay), func = Read<GLenum>(replay);
+         const GLint ref = Read<GLint>(replay);
+         const GLuint mask = Read<GLuint>(replay);
+         if (replay->failed)
+            break;
+         iface->StencilFuncSeparate(iface, face, func, ref, mask);
+         break;
+      }
+      case TRACE_STENCIL_OP: {
+         GLenum ops[4];
+         if (!Read(replay, ops, sizeof(ops)))
+            break;
+         iface->StencilOpSeparate(iface, ops[0], ops[1], ops[2], ops[3]);
+         break;
+      }
+      case TRACE_STENCIL_SELECT: {
+         const GLenum face = Read<GLenum>(replay);
+         if (replay->failed)
+            break;
+         iface->StencilSelect(iface, face);
+         break;
+      }
+      case TRACE_CLEAR_STENCIL: {
+         const GLint stencil = Read<GLint>(replay);
+         if (replay->failed)
+            break;
+         iface->ClearStencil(iface, stencil);
+         break;
+      }
+      case TRACE_CLEAR_DEPTH: {
+         const GLclampf depth = Read<GLclampf>(replay);
+         if (replay->failed)
+            break;
+         iface->ClearDepthf(iface, depth);
+         break;
+      }
+      case TRACE_CLEAR: {
+         const GLbitfield buf = Read<GLbitfield>(replay);
+         if (replay->failed)
+            break;
+         iface->Clear(iface, buf);
+         break;
+      }
+      case TRACE_SET_FAST_CLEAR: {
+         const GLboolean enable = Read<GLboolean>(replay);
+         if (replay->failed)
+            break;
+         iface->SetFastClear(iface, enable);
+         break;
+      }
+      case TRACE_FLUSH:
+         iface->Flush(iface);
+         break;
+      case TRACE_FINISH:
+         iface->Finish(iface);
+         return 1;
+      case TRACE_SET_SAMPLER: {
+         const unsigned sampler = Read<unsigned>(replay);
+         const bool set = Read<unsigned char>(replay);
+         if (replay->failed)
+            break;
+         if (!set) {
+            iface->SetSampler(iface, sampler, NULL);
+            break;
+         }
+         GGLTexture texture = Read<GGLTexture>(replay);
+         const TraceId id = Read<TraceId>(replay);
+         const unsigned bytes = Read<unsigned>(replay);
+         if (replay->failed)
+            break;
+         texture.levels = ReplayBuffer(replay, id, bytes);
+         if (!Read(replay, texture.levels, bytes))
+            break;
+         iface->SetSampler(iface, sampler, &texture);
+         break;
+      }
+      case TRACE_SET_BUFFER: {
+         const GLenum type = Read<GLenum>(replay);
+         const bool set = Read<unsigned char>(replay);
+         if (replay->failed)
+            break;
+         if (!set) {
+            iface->SetBuffer(iface, type, NULL);
+            break;
+         }
+         GGLSurface surface = Read<GGLSurface>(replay);
+         const TraceId id = Read<TraceId>(replay);
+         if (replay->failed)
+            break;
+         const unsigned stride = surface.stride ? surface.stride : surface.width;
+         surface.data = ReplayBuffer(replay, id, stride * surface.height * PixelBytes(surface.format));
+         iface->SetBuffer(iface, type, &surface);
+         break;
+      }
+      case TRACE_SET_SAMPLER_SURFACE: {
+         const unsigned sampler = Read<unsigned>(replay);
+         GGLSurface surface;
+         const bool set = Read<unsigned char>(replay);
+         if (set) {
+            surface = Read<GGLSurface>(replay);
+            const TraceId id = Read<TraceId>(replay);
+            const unsigned bytes = Read<unsigned>(replay);
+            if (replay->failed)
+               break;
+            if (surface.data) {
+               const unsigned stride = surface.stride ? surface.stride : surface.width;
+               surface.data = ReplayBuffer(replay, id, stride * surface.height * PixelBytes(surface.format));
+            }
+            Read(replay, surface.data, bytes);
+         }
+         GGLTexture parameters;
+         const bool hasParameters = Read<unsigned char>(replay);
+         if (hasParameters)
+            parameters = Read<GGLTexture>(replay);
+         if (replay->failed)
+            break;
+         iface->SetSamplerSurface(iface, sampler, set ? &surface : NULL, hasParameters ? &parameters : NULL);
+         break;
+      }
+      case TRACE_PROCESS_VERTEX: {
+         const VertexInput * input = (const VertexInput *)ReadScratch(replay, sizeof(VertexInput));
+         VertexOutput output __attribute__ ((aligned (16))); // only input is recorded
+         if (replay->failed)
+            break;
+         iface->ProcessVertex(iface, input, &output);
+         break;
+      }
+      case TRACE_DRAW_TRIANGLE: {
+         const VertexInput * v = (const VertexInput *)ReadScratch(replay, 3 * sizeof(VertexInput));
+         if (replay->failed)
+            break;
+         iface->DrawTriangle(iface, v, v + 1, v + 2);
+         break;
+      }
+      case TRACE_DRAW_ARRAYS: {
+         const GLenum mode = Read<GLenum>(replay);
+         const GLsizei count = Read<GLsizei>(replay);
+         if (replay->failed)
+            break;
+         const VertexInput * v = (const VertexInput *)ReadScratch(replay, MAX2(count, 0) * sizeof(VertexInput));
+         if (replay->failed)
+            break;
+         iface->DrawArrays(iface, mode, v, 0, count);
+         break;
+      }
+      case TRACE_DRAW_ELEMENTS: {
+         const GLenum mode = Read<GLenum>(replay);
+         const GLsizei count = Read<GLsizei>(replay);
+         const GLenum type = Read<GLenum>(replay);
+         if (replay->failed)
+            break;
+         std::vector<char> indices(MAX2(count, 0) * IndexBytes(type) + 1);
+         Read(replay, &indices[0], indices.size() - 1);
+         const unsigned vertexCount = Read<unsigned>(replay);
+         if (replay->failed)
+            break;
+         const VertexInput * v = (const VertexInput *)ReadScratch(replay, vertexCount * sizeof(VertexInput));
+         if (replay->failed)
+            break;
+         iface->DrawElements(iface, mode, v, count, type, &indices[0]);
+         break;
+      }
+      case TRACE_RASTER_TRIANGLE: {
+         const VertexOutput * v = (const VertexOutput *)ReadScratch(replay, 3 * sizeof(VertexOutput));
+         if (replay->failed)
+            break;
+         iface->RasterTriangle(iface, v, v + 1, v + 2);
+         break;
+      }
+      case TRACE_RASTER_TRAPEZOID: {
+         const VertexOutput * v = (const VertexOutput *)ReadScratch(replay, 4 * sizeof(VertexOutput));
+         if (replay->failed)
+            break;
+         iface->RasterTrapezoid(iface, v, v + 1, v + 2, v + 3);
+         break;
+      }
+      case TRACE_SCAN_LINE: {
+         const VertexOutput * v = (const VertexOutput *)ReadScratch(replay, 2 * sizeof(VertexOutput));
+         if (replay->failed)
+            break;
+         iface->ScanLine(iface, v, v + 1);
+         break;
+      }
+      case TRACE_SHADER_CREATE: {
+         const GLenum type = Read<GLenum>(replay);
+         const TraceId id = Read<TraceId>(replay);
+         if (replay->failed)
+            break;
+         replay->shaders[id] = iface->ShaderCreate(iface, type);
+         break;
+      }
+      case TRACE_SHADER_SOURCE: {
+         gl_shader * shader = replay->shaders[Read<TraceId>(replay)];
+         const GLsizei count = Read<GLsizei>(replay);
+         if (replay->failed)
+            break;
+         std::vector<std::vector<char> > strings(MAX2(count, 0));
+         std::vector<const char *> pointers;
+         for (GLsizei i = 0; i < count; i++) {
+            const char * string = ReadString(replay);
+            if (!string)
+               continue; // recorded NULL string, contributes no source
+            strings[i].assign(string, string + strlen(string) + 1);
+            pointers.push_back(&strings[i][0]);
+         }
+         if (replay->failed)
+            break;
+         iface->ShaderSource(shader, pointers.size(), pointers.empty() ? NULL : &pointers[0], NULL);
+         break;
+      }
+      case TRACE_SHADER_COMPILE: {
+         gl_shader * shader = replay->shaders[Read<TraceId>(replay)];
+         const char * glsl = ReadString(replay);
+         if (replay->failed)
+            break;
+         if (!iface->ShaderCompile(iface, shader, glsl, NULL))
+            fprintf(stderr, "pf2 replay: shader compile failed \n");
+         break;
+      }
+      case TRACE_SHADER_DELETE: {
+         const TraceId id = Read<TraceId>(replay);
+         if (replay->failed)
+            break;
+         iface->ShaderDelete(iface, replay->shaders[id]);
+         replay->shaders.erase(id);
+         break;
+      }
+      case TRACE_PROGRAM_CREATE: {
+         const TraceId id = Read<TraceId>(replay);
+         if (replay->failed)
+            break;
+         replay->programs[id] = iface->ShaderProgramCreate(iface);
+         break;
+      }
+      case TRACE_SHADER_ATTACH:
+      case TRACE_SHADER_DETACH: {
+         gl_shader_program * program = replay->programs[Read<TraceId>(replay)];
+         gl_shader * shader = replay->shaders[Read<TraceId>(replay)];
+         if (replay->failed)
+            break;
+         if (TRACE_SHADER_ATTACH == op)
+            iface->ShaderAttach(iface, program, shader);
+         else
+            iface->ShaderDetach(iface, program, shader);
+         break;
+      }
+      case TRACE_PROGRAM_LINK: {
+         gl_shader_program * program = replay->programs[Read<TraceId>(replay)];
+         if (replay->failed)
+            break;
+         if (!iface->ShaderProgramLink(program, NULL))
+            fprintf(stderr, "pf2 replay: program link failed \n");
+         break;
+      }
+      case TRACE_PROGRAM_DELETE: {
+         const TraceId id = Read<TraceId>(replay);
+         if (replay->failed)
+            break;
+         iface->ShaderProgramDelete(iface, replay->programs[id]);
+         replay->programs.erase(id);
+         break;
+      }
+      case TRACE_SHADER_USE: {
+         const TraceId id = Read<TraceId>(replay);
+         if (replay->failed)
+            break;
+         iface->ShaderUse(iface, id ? replay->programs[id] : NULL);
+         break;
+      }
+      case TRACE_ATTRIBUTE_BIND: {
+         gl_shader_program * program = replay->programs[Read<TraceId>(replay)];
+         const GLuint index = Read<GLuint>(replay);
+         const char * name = ReadString(replay);
+         if (replay->failed)
+            break;
+         iface->ShaderAttributeBind(program, index, name);
+         break;
+      }
+      case TRACE_UNIFORM: {
+         gl_shader_program * program = replay->programs[Read<TraceId>(replay)];
+         const GLint location = Read<GLint>(replay);
+         const GLsizei count = Read<GLsizei>(replay);
+         const GLenum type = Read<GLenum>(replay);
+         if (replay->failed)
+            break;
+         const void * values = ReadScratch(replay, -1 == location ? 0 : UniformBytes(type, count));
+         if (replay->failed)
+            break;
+         iface->ShaderUniform(program, location, count, values, type);
+         break;
+      }
+      case TRACE_UNIFORM_MATRIX: {
+         gl_shader_program * program = replay->programs[Read<TraceId>(replay)];
+         const GLint cols = Read<GLint>(replay), rows = Read<GLint>(replay);
+         const GLint location = Read<GLint>(replay);
+         const GLsizei count = Read<GLsizei>(replay);
+         const GLboolean transpose = Read<GLboolean>(replay);
+         const unsigned floats = Read<unsigned>(replay);
+         if (replay->failed)
+            break;
+         const GLfloat * values = (const GLfloat *)ReadScratch(replay, floats * sizeof(GLfloat));
+         if (replay->failed)
+            break;
+         iface->ShaderUniformMatrix(program, cols, rows, location, count, transpose, values);
+         break;
+      }
+      default:
+         fprintf(stderr, "pf2 replay: unknown trace op %d \n", op);
+         return 0;
+      }
+      if (replay->failed) {
+         fprintf(stderr, "pf2 replay: trace ends inside op %d, truncated or corrupt \n", op);
+         return 0;
+      }
+   }
+   return 0;
+}
+
+void GGLTraceReplayClose(GGLTraceReplay * replay)
+{
+   // objects left by the trace belong to iface, which may still use them
+   fclose(replay->file);
+   for (std::map<TraceId, std::pair<void *, unsigned> >::iterator it = replay->buffers.begin();
+         it != replay->buffers.end(); it++)
+      free(it->second.first);
+   for (unsigned i = 0; i < replay->retired.size(); i++)
+      free(replay->retired[i]);
+   free(replay->scratch);
+   delete replay;
+}